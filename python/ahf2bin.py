@@ -0,0 +1,102 @@
+import numpy as np
+import struct
+import sys
+import os
+
+'''
+	ahf2bin.py
+	Convert AHF ASCII .AHF_halos / .AHF_particles files to the MetroC++ native binary format (inputFormat = MetroCPP).
+	Usage: python3 ahf2bin.py file1.AHF_halos file2.AHF_particles ...
+	Each file is written next to the original one, with the AHF_ suffix replaced by MCPP_
+'''
+
+binVersion = 1
+
+# uint64 ID, hostID; int32 nSub, nPart[6]; float mTot, rVir, rsNFW, cNFW, lambda, vMax, sigV, fMhires, X[3], V[3], L[3]
+haloRecord = np.dtype([('ID', '<u8'), ('hostID', '<u8'), ('nSub', '<i4'), ('nPart', '<i4', 6),
+			('mTot', '<f4'), ('rVir', '<f4'), ('rsNFW', '<f4'), ('cNFW', '<f4'),
+			('lambda', '<f4'), ('vMax', '<f4'), ('sigV', '<f4'), ('fMhires', '<f4'),
+			('X', '<f4', 3), ('V', '<f4', 3), ('L', '<f4', 3)])
+
+
+def halos2bin(fileIn, fileOut):
+	data = np.loadtxt(fileIn, comments='#', ndmin=2)
+	halos = np.zeros(len(data), dtype=haloRecord)
+
+	# Column numbers as in the AHF header, starting from zero
+	halos['ID'] = data[:, 0].astype(np.uint64)
+	halos['hostID'] = data[:, 1].astype(np.uint64)
+	halos['nSub'] = data[:, 2]
+	halos['mTot'] = data[:, 3]
+	halos['X'] = data[:, 5:8]
+	halos['V'] = data[:, 8:11]
+	halos['rVir'] = data[:, 11]
+	halos['rsNFW'] = data[:, 13]
+	halos['vMax'] = data[:, 16]
+	halos['sigV'] = data[:, 18]
+	halos['lambda'] = data[:, 19]
+	halos['L'] = data[:, 21:24]
+	halos['fMhires'] = data[:, 37]
+	halos['cNFW'] = data[:, 42]
+
+	# Gas and star particles are stored as types 0 and 4, as in Gadget
+	nAll = data[:, 4].astype(np.int32)
+	nGas = data[:, 43].astype(np.int32) if data.shape[1] > 43 else 0
+	nStar = data[:, 63].astype(np.int32) if data.shape[1] > 63 else 0
+	halos['nPart'][:, 0] = nGas
+	halos['nPart'][:, 1] = nAll - nGas - nStar
+	halos['nPart'][:, 4] = nStar
+
+	with open(fileOut, 'wb') as f:
+		f.write(struct.pack('<8siiQ', b'MCPPHALO', binVersion, 0, len(halos)))
+		halos.tofile(f)
+
+
+def parts2bin(fileIn, fileOut):
+	blocks = []
+	hasTypes = False
+
+	with open(fileIn, 'r') as f:
+		lines = f.readlines()
+
+	iLine = 0
+	while iLine < len(lines):
+		nFileHalos = int(lines[iLine].split()[0])
+		iLine += 1
+
+		for iH in range(0, nFileHalos):
+			nPart, haloID = [int(x) for x in lines[iLine].split()[0:2]]
+			iLine += 1
+
+			cols = [l.split() for l in lines[iLine:iLine + nPart]]
+			iLine += nPart
+
+			ids = np.array([int(c[0]) for c in cols], dtype='<u8')
+			types = np.array([int(c[1]) if len(c) > 1 else 1 for c in cols], dtype=np.uint8)
+			hasTypes = hasTypes or (len(cols) > 0 and len(cols[0]) > 1)
+
+			blocks.append((haloID, ids, types))
+
+	with open(fileOut, 'wb') as f:
+		f.write(struct.pack('<8siiQ', b'MCPPPART', binVersion, int(hasTypes), len(blocks)))
+
+		for haloID, ids, types in blocks:
+			f.write(struct.pack('<QQ', haloID, len(ids)))
+			ids.tofile(f)
+
+			if hasTypes:
+				types.tofile(f)
+
+
+for fileIn in sys.argv[1:]:
+	fileOut = fileIn.replace('AHF_', 'MCPP_')
+
+	if fileIn.endswith('AHF_halos'):
+		halos2bin(fileIn, fileOut)
+	elif fileIn.endswith('AHF_particles'):
+		parts2bin(fileIn, fileOut)
+	else:
+		print('Skipping ', fileIn, ', not an AHF file.')
+		continue
+
+	print('Written ', fileOut)
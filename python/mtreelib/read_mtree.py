@@ -95,10 +95,116 @@ class ReadSettings:
 			
 
 
+# Record layout of the binary .mtree files written with outFormat = binary, see src/TreeFile.h
+binTreeHeader = np.dtype([('magic', 'S8'), ('version', '<i4'), ('snapshot', '<i4'), ('nTrees', '<u8'), ('nProgs', '<u8'),
+			('offTrees', '<u8'), ('offProgs', '<u8'), ('offIndex', '<u8'), ('unused', '<u8')])
+binTreeRecord = np.dtype([('ID', '<u8'), ('firstProg', '<u8'), ('nPart', '<i4'), ('nProg', '<i4'), ('isOrphan', '<i4'), ('unused', '<i4')])
+binProgRecord = np.dtype([('ID', '<u8'), ('nPart', '<i4'), ('nCommon', '<i4')])
+binIndexRecord = np.dtype([('ID', '<u8'), ('iTree', '<u8')])
+
+# Single file per snapshot written with outSingleFile = 1, followed by nSections+1 uint64 offsets
+sharedTreeHeader = np.dtype([('magic', 'S8'), ('version', '<i4'), ('nSections', '<i4')])
+
+
+# Map a binary tree file in memory, return the descendant, progenitor and index record arrays. 
+# fileOffset is the start of the binary trees within a shared file
+def map_metrocpp_bin_tree(fileMetroCpp, fileOffset=0):
+	header = np.memmap(fileMetroCpp, dtype=binTreeHeader, mode='r', offset=fileOffset, shape=(1,))[0]
+	nTrees = int(header['nTrees'])
+	nProgs = int(header['nProgs'])
+
+	trees = np.memmap(fileMetroCpp, dtype=binTreeRecord, mode='r', offset=fileOffset+int(header['offTrees']), shape=(nTrees,)) if nTrees > 0 else np.zeros(0, binTreeRecord)
+	progs = np.memmap(fileMetroCpp, dtype=binProgRecord, mode='r', offset=fileOffset+int(header['offProgs']), shape=(nProgs,)) if nProgs > 0 else np.zeros(0, binProgRecord)
+	index = np.memmap(fileMetroCpp, dtype=binIndexRecord, mode='r', offset=fileOffset+int(header['offIndex']), shape=(nTrees,)) if nTrees > 0 else np.zeros(0, binIndexRecord)
+
+	return [trees, progs, index]
+
+
+# Same output as read_metrocpp_tree, from a binary file
+def read_metrocpp_bin_tree(fileMetroCpp, fileOffset=0):
+
+	print('Reading file: %s in MetroCPP binary format.' % fileMetroCpp)
+
+	[trees, progs, index] = map_metrocpp_bin_tree(fileMetroCpp, fileOffset)
+	descProg = dict()
+
+	hasProg = np.where(trees['nProg'] > 0)[0]
+	mainProgs = progs[trees['firstProg'][hasProg]]
+
+	for iTree, mainProg in zip(hasProg, mainProgs):
+		descID = str(trees['ID'][iTree])
+		descProg[descID] = DescendantProgenitor(str(mainProg['ID']), int(mainProg['nCommon']), descID, 
+				int(trees['nPart'][iTree]), int(trees['nProg'][iTree]))
+
+	return descProg
+
+
+# Depth-first forest files written with outForest = 1, see src/TreeForest.h
+forestHeader = np.dtype([('magic', 'S8'), ('version', '<i4'), ('unused', '<i4'), ('nTrees', '<u8'), ('nHalos', '<u8'),
+			('offTrees', '<u8'), ('offHalos', '<u8'), ('unused2', '<u8', 2)])
+forestTree = np.dtype([('rootID', '<u8'), ('offset', '<u8'), ('nHalos', '<u8')])
+forestHalo = np.dtype([('ID', '<u8'), ('snapshot', '<i4'), ('nPart', '<i4'), ('firstProg', '<i4'), ('nextProg', '<i4'),
+			('desc', '<i4'), ('isToken', '<i4'), ('mTot', '<f4'), ('rVir', '<f4'), ('vMax', '<f4'), ('unused', '<f4'),
+			('X', '<f4', 3), ('V', '<f4', 3)])
+
+
+# Return the tree table of a forest file
+def read_metrocpp_forest_table(fileForest):
+	header = np.fromfile(fileForest, dtype=forestHeader, count=1)[0]
+
+	return np.fromfile(fileForest, dtype=forestTree, count=int(header['nTrees']), offset=int(header['offTrees']))
+
+
+# Read the halos of a single tree, given its position in the table (e.g. found from its z=0 ID in the rootID column)
+def read_metrocpp_forest_tree(fileForest, iTree, treeTable=None):
+	if treeTable is None:
+		treeTable = read_metrocpp_forest_table(fileForest)
+
+	return np.fromfile(fileForest, dtype=forestHalo, count=int(treeTable['nHalos'][iTree]), offset=int(treeTable['offset'][iTree]))
+
+
+# Shared file: each section is read as a separate ASCII or binary tree file
+def read_metrocpp_shared_tree(fileMetroCpp):
+
+	print('Reading file: %s in MetroCPP shared format.' % fileMetroCpp)
+
+	header = np.fromfile(fileMetroCpp, dtype=sharedTreeHeader, count=1)[0]
+	secOffsets = np.fromfile(fileMetroCpp, dtype='<u8', count=int(header['nSections'])+1, offset=sharedTreeHeader.itemsize)
+	descProg = dict()
+
+	with open(fileMetroCpp, 'rb') as fileIn:
+		for iS in range(0, int(header['nSections'])):
+			fileIn.seek(int(secOffsets[iS]))
+			secData = fileIn.read(int(secOffsets[iS+1] - secOffsets[iS]))
+
+			if secData[0:8] == b'MCPPTREE':
+				descProg.update(read_metrocpp_bin_tree(fileMetroCpp, int(secOffsets[iS])))
+			else:
+				descProg.update(read_metrocpp_lines(secData.decode().splitlines()))
+
+	return descProg
+
+
 def read_metrocpp_tree(fileMetroCpp):
+
+	with open(fileMetroCpp, 'rb') as fileIn:
+		magic = fileIn.read(8)
+
+	if magic == b'MCPPTREE':
+		return read_metrocpp_bin_tree(fileMetroCpp)
+	elif magic == b'MCPPMTRS':
+		return read_metrocpp_shared_tree(fileMetroCpp)
 	
 	print('Reading file: %s in MetroCPP format.' % fileMetroCpp)
 
+	with open(fileMetroCpp) as fileIn:
+		allLines = fileIn.read().splitlines()
+
+	return read_metrocpp_lines(allLines)
+
+
+def read_metrocpp_lines(allLines):
+
 	# IDs are already initialized as strings as they will be stored into dictionaries
 	descID = '123123123123123123123123'
 	progID = '123123123123123123123123'
@@ -109,9 +215,6 @@ def read_metrocpp_tree(fileMetroCpp):
 	# Create a dictionary that connects the descendant IDs to their main progenitor 
 	descProg = dict()
 
-	with open(fileMetroCpp) as fileIn:
-		allLines = fileIn.read().splitlines()
-		
 	iLineProg = 0
 
 	for thisLine in allLines:
@@ -0,0 +1,803 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * CatalogReader.cpp:
+ * Format-specific parsing of halo catalogs and particle files. Each halo finder format implements the CatalogReader
+ * interface, so that IOSettings can read and distribute halos and particles without knowing how they are stored.
+ */
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#include "global_vars.h"
+#include "utils.h"
+#include "CatalogReader.h"
+
+#ifdef IDADD
+#define idADD 1000000000
+#endif
+
+using namespace std;
+
+
+CatalogReader *CatalogReader::New(string format)
+{
+	if (format == "AHF")
+		return new AHFReader;
+	else if (format == "Rockstar")
+		return new RockstarReader;
+	else if (format == "MetroCPP")
+		return new MetroReader;
+	else
+		return nullptr;
+};
+
+
+/* Set the particle numbers per type, types beyond nPTypes are dropped */
+static void SetPartNumbers(Halo *halo, int nPartType[6])
+{
+#ifdef NOPTYPE
+	halo->nPart[0] = 0;
+	halo->nPart[1] = 0;
+
+	for (int iT = 0; iT < 6; iT++)
+		halo->nPart[1] += nPartType[iT];
+#else
+	for (int iT = 0; iT < nPTypes; iT++)
+		halo->nPart[iT] = (iT < 6) ? nPartType[iT] : 0;
+#endif
+};
+
+
+
+	/* ================================================================= */
+	/*			AHF ASCII FORMAT			     */
+	/* ================================================================= */
+
+void PartIndex::Add(uint64_t haloID, uint64_t offset, int nPart)
+{
+	haloIDs.push_back(haloID);
+	offsets.push_back(offset);
+	nParts.push_back(nPart);
+};
+
+
+void PartIndex::Clean()
+{
+	haloIDs.clear();
+	offsets.clear();
+	nParts.clear();
+};
+
+
+/* Sidecar layout: "MCPPPIDX", int32 version, int32 unused, uint64 file size, int64 file time, uint64 nBlocks,
+ * then the halo IDs (uint64), the offsets (uint64) and the particle numbers (int32) of all the blocks */
+bool PartIndex::Read(string partName)
+{
+	char magic[8];
+	int32_t version[2];
+	uint64_t fileInfo[3];
+
+	Clean();
+
+	FILE *fileIdx = fopen((partName + ".idx").c_str(), "rb");
+
+	if (fileIdx == nullptr)
+		return false;
+
+	bool isGood = (fread(magic, 1, 8, fileIdx) == 8 && strncmp(magic, "MCPPPIDX", 8) == 0
+			&& fread(version, sizeof(int32_t), 2, fileIdx) == 2 && version[0] == 1
+			&& fread(fileInfo, sizeof(uint64_t), 3, fileIdx) == 3
+			&& fileInfo[0] == FileSize(partName) && (time_t) fileInfo[1] == FileTime(partName));
+
+	if (isGood)
+	{
+		haloIDs.resize(fileInfo[2]);
+		offsets.resize(fileInfo[2]);
+		nParts.resize(fileInfo[2]);
+
+		isGood = (fread(haloIDs.data(), sizeof(uint64_t), fileInfo[2], fileIdx) == fileInfo[2]
+			&& fread(offsets.data(), sizeof(uint64_t), fileInfo[2], fileIdx) == fileInfo[2]
+			&& fread(nParts.data(), sizeof(int32_t), fileInfo[2], fileIdx) == fileInfo[2]);
+	}
+
+	fclose(fileIdx);
+
+	if (!isGood)
+		Clean();
+
+	return isGood;
+};
+
+
+/* The index is written to a temporary file first, so that concurrent readers never see it half-written */
+bool PartIndex::Write(string partName)
+{
+	int32_t version[2] = { 1, 0 };
+	uint64_t fileInfo[3] = { FileSize(partName), (uint64_t) FileTime(partName), Size() };
+	string idxName = partName + ".idx";
+	string tmpName = idxName + ".tmp";
+
+	FILE *fileIdx = fopen(tmpName.c_str(), "wb");
+
+	if (fileIdx == nullptr)
+	{
+		cout << "WARNING: could not write the particle index " << idxName << endl;
+		return false;
+	}
+
+	bool isGood = (fwrite("MCPPPIDX", 1, 8, fileIdx) == 8
+		&& fwrite(version, sizeof(int32_t), 2, fileIdx) == 2
+		&& fwrite(fileInfo, sizeof(uint64_t), 3, fileIdx) == 3
+		&& fwrite(haloIDs.data(), sizeof(uint64_t), Size(), fileIdx) == Size()
+		&& fwrite(offsets.data(), sizeof(uint64_t), Size(), fileIdx) == Size()
+		&& fwrite(nParts.data(), sizeof(int32_t), Size(), fileIdx) == Size());
+
+	isGood = (fclose(fileIdx) == 0) && isGood;
+
+	if (isGood)
+		isGood = (rename(tmpName.c_str(), idxName.c_str()) == 0);
+	else
+		remove(tmpName.c_str());
+
+	return isGood;
+};
+
+
+
+bool AHFReader::OpenHalos(string fileName)
+{
+	return fileIn.Open(fileName);
+};
+
+
+bool AHFReader::NextHalo(Halo &halo)
+{
+	const char *lineHead = "#";
+
+	while (fileIn.GetLine(lineIn))
+	{
+		const char *lineRead = lineIn.c_str();
+
+		if (lineRead[0] != lineHead[0] && lineIn.size() > 0)
+		{
+			ReadLine(lineRead, &halo);
+			return true;
+		}
+	}
+
+	return false;
+};
+
+
+bool AHFReader::GetLine()
+{
+	if (!fileIn.GetLine(lineIn))
+		return false;
+
+	filePos += lineIn.size() + 1;
+	return true;
+};
+
+
+bool AHFReader::OpenParticles(string fileName)
+{
+	nFileHalos = 0; nBlockPart = 0; filePos = 0;
+	hasIndex = false; buildIndex = false;
+	index.Clean();
+
+	if (!fileIn.Open(fileName))
+		return false;
+
+	/* Offsets are only meaningful in uncompressed files */
+	if (partIndex && InputStream::Compression(fileName) == InputStream::kPlain)
+	{
+		partName = fileName;
+		hasIndex = index.Read(fileName);
+		buildIndex = !hasIndex;
+	}
+
+	iBlock = 0;
+	endBlock = index.Size();
+
+	return true;
+};
+
+
+PartIndex *AHFReader::Index()
+{
+	return hasIndex ? &index : nullptr;
+};
+
+
+void AHFReader::SetBlockRange(size_t firstBlock, size_t lastBlock)
+{
+	if (!hasIndex)
+		return;
+
+	iBlock = firstBlock;
+	endBlock = min(lastBlock, index.Size());
+};
+
+
+/* The particle file is made of one or more sections, each starting with the number of halos it contains.
+ * Each halo block starts with a line containing the number of particles and the halo ID.
+ * With an index, the section headers are ignored and the reader jumps to the next block whenever it is not already there */
+bool AHFReader::NextBlock(uint64_t &haloID, int &nPart)
+{
+	if (hasIndex)
+	{
+		if (iBlock == endBlock)
+			return false;
+
+		if (filePos != index.offsets[iBlock])
+		{
+			fileIn.Seek(index.offsets[iBlock]);
+			filePos = index.offsets[iBlock];
+		}
+
+		iBlock++;
+	} else {
+		while (nFileHalos == 0)
+		{
+			if (!GetLine())
+			{
+				/* The whole file has been scanned, save the block positions for the next runs */
+				if (buildIndex)
+					index.Write(partName);
+
+				buildIndex = false;
+				return false;
+			}
+
+		       	sscanf(lineIn.c_str(), "%u", &nFileHalos);
+		}
+
+		nFileHalos--;
+	}
+
+	size_t blockPos = filePos;
+
+	if (!GetLine())
+		return false;
+
+       	sscanf(lineIn.c_str(), "%d %lu", &nBlockPart, &haloID);
+
+	if (buildIndex)
+		index.Add(haloID, blockPos, nBlockPart);
+#ifdef IDADD
+	if (haloID < idADD)
+		haloID += idADD;
+#endif
+	nPart = nBlockPart;
+
+	return true;
+};
+
+
+bool AHFReader::ReadBlock(vector<uint64_t> &partIDs, vector<int> &partTypes)
+{
+	uint64_t partID = 0;
+	int partType = 1;
+
+	partIDs.resize(nBlockPart);
+	partTypes.resize(nBlockPart);
+
+	for (int iP = 0; iP < nBlockPart; iP++)
+	{
+		if (!GetLine())
+			return false;
+#ifdef NOPTYPE
+       	        sscanf(lineIn.c_str(), "%lu", &partID);
+#else
+       	        sscanf(lineIn.c_str(), "%lu %d", &partID, &partType);
+#endif
+		partIDs[iP] = partID;
+		partTypes[iP] = partType;
+	}
+
+	return true;
+};
+
+
+/* With an index, the next call to NextBlock() seeks over the block */
+void AHFReader::SkipBlock()
+{
+	if (hasIndex)
+		return;
+
+	for (int iP = 0; iP < nBlockPart; iP++)
+		GetLine();
+};
+
+
+void AHFReader::Close()
+{
+	fileIn.Close();
+};
+
+
+#ifndef AHF_CB
+void AHFReader::ReadLine(const char * lineRead, Halo *halo)
+{
+	float dummy;
+	unsigned int tmpNpart = 0, nGas = 0, nStar = 0;
+	//uint64_t dummyID;
+	int dummyID;
+
+	/* AHF file structure:
+	   ID(1)  hostHalo(2)     numSubStruct(3) Mvir(4) npart(5)        Xc(6)   Yc(7)   Zc(8)   VXc(9)  VYc(10) VZc(11)
+	   Rvir(12)        Rmax(13)        r2(14)  mbp_offset(15)  com_offset(16)  Vmax(17)        v_esc(18)       sigV(19)
+           lambda(20)      lambdaE(21)     Lx(22)  Ly(23)  Lz(24)  b(25)   c(26)   Eax(27) Eay(28) Eaz(29) Ebx(30) Eby(31)
+	   Ebz(32) Ecx(33) Ecy(34) Ecz(35) ovdens(36)      nbins(37)       fMhires(38)     Ekin(39)        Epot(40)
+	   SurfP(41)       Phi0(42)        cNFW(43)        n_gas(44)       M_gas(45)       lambda_gas(46)  lambdaE_gas(47)
+	   Lx_gas(48)      Ly_gas(49)      Lz_gas(50)      b_gas(51)       c_gas(52)       Eax_gas(53)     Eay_gas(54)
+	   Eaz_gas(55)     Ebx_gas(56)     Eby_gas(57)     Ebz_gas(58)     Ecx_gas(59)     Ecy_gas(60)     Ecz_gas(61)
+	   Ekin_gas(62)    Epot_gas(63)    n_star(64)      M_star(65)      lambda_star(66) lambdaE_star(67)
+           Lx_star(68)     Ly_star(69)     Lz_star(70)     b_star(71)      c_star(72)      Eax_star(73)    Eay_star(74) Eaz_star(75)
+	   Ebx_star(76)    Eby_star(77)    Ebz_star(78)    Ecx_star(79)    Ecy_star(80)    Ecz_star(81)    Ekin_star(82)Epot_star(83) */
+
+	/* Col:		    1   2    3  4  5  6  7  8  9 10 11 */
+	sscanf(lineRead, "%lu  %d   %d %f %d \
+			  %f   %f   %f %f %f %f \
+			  %f   %f   %f %f %f %f %f %f %f %f \
+			  %f   %f   %f \
+			  %f   %f   %f %f %f %f %f %f %f %f \
+			  %f   %f   %f %f %f %f %f %f %f %f ",
+
+			&halo->ID,   &dummyID, &halo->nSub, &halo->mTot, &tmpNpart,
+			&halo->X[0], &halo->X[1], &halo->X[2], &halo->V[0], &halo->V[1], &halo->V[2], 				// 11
+			&halo->rVir, &dummy, &halo->rsNFW, &dummy, &dummy, &halo->vMax, &dummy, &halo->sigV, &halo->lambda, &dummy, // 21
+			&halo->L[0], &halo->L[1], &halo->L[2],									// 24
+			&dummy, &dummy, &dummy, &dummy,   &dummy, &dummy, &dummy, &dummy, &dummy, &dummy,			// 34
+			&dummy, &dummy, &dummy, &halo->fMhires, &dummy, &dummy, &dummy, &dummy, &halo->cNFW, &dummy);		 // 44
+
+	/* Particle numbers were not allocated correctly sometimes, so let's reset them carefully */
+	nGas = 0; nStar = 0;
+
+	int nPartType[6] = { (int) nGas, (int) (tmpNpart - nGas - nStar), 0, 0, (int) nStar, 0 };
+	SetPartNumbers(halo, nPartType);
+};
+
+#else
+// TODO!!!!!! Enable a different output format --> CB format does not have halo IDs, which is problematic for the MergerTree algorithm
+void AHFReader::ReadLine(const char * lineRead, Halo *halo)
+{
+	float dummy, dummyID;
+	unsigned int tmpNpart, nGas = 0, nStar = 0;
+
+	/* AHF file structure:
+	 npart(1)       fMhires(2)      Xc(3)   Yc(4)   Zc(5)   VXc(6)  VYc(7)  VZc(8)  Mvir(9) Rvir(10)        Vmax(11)        Rmax(12)
+  	 sigV(13)        lambda(14)      Lx(15)  Ly(16)  Lz(17)  a(18)   Eax(19) Eay(20) Eaz(21) b(22)
+	 Ebx(23) Eby(24) Ebz(25) c(26)   Ecx(27) Ecy(28) Ecz(29) ovdens(30)      Redge(31)
+	 nbins(32)       Ekin(33)        Epot(34)        mbp_offset(35)  com_offset(36)  r2(37)  lambdaE(38)
+	 v_esc(39)       Phi0(40)        n_gas(41)       M_gas(42)       lambda_gas(43)  Lx_gas(44)      Ly_gas(45)      Lz_gas(46)
+	a_gas(47)       Eax_gas(48)     Eay_gas(49)     Eaz_gas(50)     b_gas(51)       Ebx_gas(52)     Eby_gas(53)     Ebz_gas(54)
+	 c_gas(55)       Ecx_gas(56)     Ecy_gas(57)     Ecz_gas(58)     Ekin_gas(59)    Epot_gas(60)    lambdaE_gas(61)
+	 n_star(62)      M_star(63)      lambda_star(64) Lx_star(65)     Ly_star(66)     Lz_star(67)     a_star(68)
+	Eax_star(69)    Eay_star(70)    Eaz_star(71)    b_star(72)      Ebx_star(73)    Eby_star(74)    Ebz_star(75)    c_star(76)
+	 Ecx_star(77)    Ecy_star(78)    Ecz_star(79)    Ekin_star(80)   Epot_star(81)   lambdaE_star(82) */
+
+	/* Col:		    1   2    3  4  5  6  7  8  9 10 11 */
+	sscanf(lineRead, "%d  %d  %d %f %d \
+			  %f   %f   %f %f %f %f \
+			  %f   %f   %f %f %f %f %f %f %f %f \
+			  %f   %f   %f \
+			  %f   %f   %f %f %f %f %f %f %f %f \
+			  %f   %f   %f %f %f %f %f %f %f %f ",
+
+			&dummyID, &halo->hostID, &halo->nSub, &halo->mTot, &tmpNpart,
+			&halo->X[0], &halo->X[1], &halo->X[2], &halo->V[0], &halo->V[1], &halo->V[2], 				// 11
+			&halo->rVir, &dummy, &halo->rsNFW, &dummy, &dummy, &halo->vMax, &dummy, &halo->sigV, &halo->lambda, &dummy, // 21
+			&halo->L[0], &halo->L[1], &halo->L[2],									// 24
+			&dummy, &dummy, &dummy, &dummy,   &dummy, &dummy, &dummy, &dummy, &dummy, &dummy,			// 34
+			&dummy, &dummy, &dummy, &halo->fMhires, &dummy, &dummy, &dummy, &dummy, &halo->cNFW, &dummy);		 // 44
+
+	/* Particle numbers were not allocated correctly sometimes, so let's reset them carefully */
+	nGas = 0; nStar = 0;
+
+#ifdef IDADD
+	if (dummyID < idADD)
+		dummyID += dummyID;
+#endif
+
+	halo->ID = dummyID;
+
+	int nPartType[6] = { (int) nGas, (int) (tmpNpart - nGas - nStar), 0, 0, (int) nStar, 0 };
+	SetPartNumbers(halo, nPartType);
+};
+#endif
+
+
+
+	/* ================================================================= */
+	/*			ROCKSTAR BINARY FORMAT			     */
+	/* ================================================================= */
+
+/* Layout of the halos_*.bin files written by Rockstar (io/io_internal.h, halo.h): a 256 byte header,
+ * num_halos halo records and then the num_particles int64 particle IDs, grouped by halo in the same order */
+#define ROCKSTAR_MAGIC ((uint64_t) 0xfadedacec0c0d0d0)
+
+struct RockstarHeader {
+	uint64_t magic;
+	int64_t snap, chunk;
+	float scale, Om, Ol, h0;
+	float bounds[6];
+	int64_t num_halos, num_particles;
+	float box_size, particle_mass;
+	int64_t particle_type;
+	int32_t format_revision;
+	char rockstar_version[12];
+	char unused[144];
+};
+
+struct RockstarHalo {
+	int64_t id;
+	float pos[6], corevel[3], bulkvel[3];
+	float m, r, child_r, vmax_r, mgrav, vmax, rvmax, rs, klypin_rs, vrms,
+		J[3], energy, spin, alt_m[4], Xoff, Voff, b_to_a, c_to_a, A[3],
+		b_to_a2, c_to_a2, A2[3],
+		bullock_spin, kin_to_pot, m_pe_b, m_pe_d, halfmass_radius;
+	int64_t num_p, num_child_particles, p_start, desc, flags, n_core;
+	float min_pos_err, min_vel_err, min_bulkvel_err;
+};
+
+static_assert(sizeof(RockstarHeader) == 256, "Rockstar binary header must be 256 bytes");
+static_assert(sizeof(RockstarHalo) == 264, "Rockstar binary halo record must be 264 bytes");
+
+
+RockstarReader::RockstarReader()
+{
+	fileIn = nullptr;
+	nFileHalos = 0; iFileHalo = 0; nBlockPart = 0;
+};
+
+
+RockstarReader::~RockstarReader()
+{
+	Close();
+};
+
+
+bool RockstarReader::ReadHeader(string fileName)
+{
+	RockstarHeader header;
+
+	Close();
+	fileIn = fopen(fileName.c_str(), "rb");
+
+	if (fileIn == nullptr)
+		return false;
+
+	if (fread(&header, sizeof(RockstarHeader), 1, fileIn) != 1 || header.magic != ROCKSTAR_MAGIC)
+	{
+		cout << "ERROR: " << fileName << " is not a Rockstar binary file." << endl;
+		Close();
+		return false;
+	}
+
+	nFileHalos = header.num_halos;
+	iFileHalo = 0;
+
+	return true;
+};
+
+
+bool RockstarReader::OpenHalos(string fileName)
+{
+	return ReadHeader(fileName);
+};
+
+
+/* Rockstar positions are in comoving Mpc/h, they are converted to kpc/h as in AHF. Host IDs are not stored in the binary files */
+bool RockstarReader::NextHalo(Halo &halo)
+{
+	RockstarHalo rockHalo;
+
+	if (iFileHalo == nFileHalos || fread(&rockHalo, sizeof(RockstarHalo), 1, fileIn) != 1)
+		return false;
+
+	iFileHalo++;
+
+	halo.ID = rockHalo.id;
+	halo.hostID = 0;
+	halo.nSub = 0;
+	halo.mTot = rockHalo.m;
+	halo.rVir = rockHalo.r;
+	halo.rsNFW = rockHalo.rs;
+	halo.cNFW = (rockHalo.rs > 0.0) ? rockHalo.r / rockHalo.rs : 0.0;
+	halo.vMax = rockHalo.vmax;
+	halo.sigV = rockHalo.vrms;
+	halo.lambda = rockHalo.spin;
+	halo.fMhires = 1.0;
+
+	for (int iX = 0; iX < 3; iX++)
+	{
+		halo.X[iX] = rockHalo.pos[iX] * 1.e+3;
+		halo.V[iX] = rockHalo.pos[iX + 3];
+		halo.L[iX] = rockHalo.J[iX];
+	}
+
+	int nPartType[6] = { 0, (int) rockHalo.num_p, 0, 0, 0, 0 };
+	SetPartNumbers(&halo, nPartType);
+
+	return true;
+};
+
+
+/* The halo records have to be scanned first, to know the size of each particle block */
+bool RockstarReader::OpenParticles(string fileName)
+{
+	RockstarHalo rockHalo;
+
+	if (!ReadHeader(fileName))
+		return false;
+
+	blockIDs.resize(nFileHalos);
+	blockParts.resize(nFileHalos);
+
+	for (int64_t iH = 0; iH < nFileHalos; iH++)
+	{
+		if (fread(&rockHalo, sizeof(RockstarHalo), 1, fileIn) != 1)
+		{
+			cout << "ERROR: " << fileName << " is truncated." << endl;
+			Close();
+			return false;
+		}
+
+		blockIDs[iH] = rockHalo.id;
+		blockParts[iH] = rockHalo.num_p;
+	}
+
+	return true;
+};
+
+
+bool RockstarReader::NextBlock(uint64_t &haloID, int &nPart)
+{
+	if (iFileHalo == nFileHalos)
+		return false;
+
+	haloID = blockIDs[iFileHalo];
+	nBlockPart = blockParts[iFileHalo];
+	nPart = nBlockPart;
+	iFileHalo++;
+
+	return true;
+};
+
+
+bool RockstarReader::ReadBlock(vector<uint64_t> &partIDs, vector<int> &partTypes)
+{
+	vector<int64_t> rockIDs(nBlockPart);
+
+	if ((int) fread(rockIDs.data(), sizeof(int64_t), nBlockPart, fileIn) != nBlockPart)
+		return false;
+
+	partIDs.assign(rockIDs.begin(), rockIDs.end());
+	partTypes.assign(nBlockPart, 1);
+
+	return true;
+};
+
+
+void RockstarReader::SkipBlock()
+{
+	fseek(fileIn, (long) nBlockPart * sizeof(int64_t), SEEK_CUR);
+};
+
+
+void RockstarReader::Close()
+{
+	if (fileIn != nullptr)
+		fclose(fileIn);
+
+	fileIn = nullptr;
+	blockIDs.clear();
+	blockParts.clear();
+};
+
+
+
+	/* ================================================================= */
+	/*			METROC++ BINARY FORMAT			     */
+	/* ================================================================= */
+
+/* Halo files:	 "MCPPHALO" int32 version, int32 flags (unused), uint64 nHalos, then nHalos MetroHalo records.
+ * Particle files: "MCPPPART" int32 version, int32 flags, uint64 nBlocks, then for each block
+ *		 uint64 haloID, uint64 nPart, uint64 IDs[nPart] and, if flags & 1, uint8 types[nPart].
+ * All values are little-endian, as written by python/ahf2bin.py */
+#define METRO_BIN_VERSION 1
+
+struct MetroHeader {
+	char magic[8];
+	int32_t version, flags;
+	uint64_t nRecords;
+};
+
+struct MetroHalo {
+	uint64_t ID, hostID;
+	int32_t nSub, nPart[6];
+	float mTot, rVir, rsNFW, cNFW, lambda, vMax, sigV, fMhires;
+	float X[3], V[3], L[3];
+};
+
+static_assert(sizeof(MetroHeader) == 24, "MetroC++ binary header must be 24 bytes");
+static_assert(sizeof(MetroHalo) == 112, "MetroC++ binary halo record must be 112 bytes");
+
+
+MetroReader::MetroReader()
+{
+	fileIn = nullptr;
+	nFileRecords = 0; iFileRecord = 0; partFlags = 0; nBlockPart = 0;
+};
+
+
+MetroReader::~MetroReader()
+{
+	Close();
+};
+
+
+bool MetroReader::ReadHeader(string fileName, const char *magic)
+{
+	MetroHeader header;
+
+	Close();
+	fileIn = fopen(fileName.c_str(), "rb");
+
+	if (fileIn == nullptr)
+		return false;
+
+	if (fread(&header, sizeof(MetroHeader), 1, fileIn) != 1 || strncmp(header.magic, magic, 8) != 0)
+	{
+		cout << "ERROR: " << fileName << " is not a MetroC++ binary " << magic << " file." << endl;
+		Close();
+		return false;
+	}
+
+	if (header.version != METRO_BIN_VERSION)
+	{
+		cout << "ERROR: " << fileName << " has version " << header.version << ", expected " << METRO_BIN_VERSION << endl;
+		Close();
+		return false;
+	}
+
+	nFileRecords = header.nRecords;
+	iFileRecord = 0;
+	partFlags = header.flags;
+
+	return true;
+};
+
+
+bool MetroReader::OpenHalos(string fileName)
+{
+	return ReadHeader(fileName, "MCPPHALO");
+};
+
+
+bool MetroReader::NextHalo(Halo &halo)
+{
+	MetroHalo binHalo;
+
+	if (iFileRecord == nFileRecords || fread(&binHalo, sizeof(MetroHalo), 1, fileIn) != 1)
+		return false;
+
+	iFileRecord++;
+
+	halo.ID = binHalo.ID;
+	halo.hostID = binHalo.hostID;
+	halo.nSub = binHalo.nSub;
+	halo.mTot = binHalo.mTot;
+	halo.rVir = binHalo.rVir;
+	halo.rsNFW = binHalo.rsNFW;
+	halo.cNFW = binHalo.cNFW;
+	halo.lambda = binHalo.lambda;
+	halo.vMax = binHalo.vMax;
+	halo.sigV = binHalo.sigV;
+	halo.fMhires = binHalo.fMhires;
+
+	for (int iX = 0; iX < 3; iX++)
+	{
+		halo.X[iX] = binHalo.X[iX];
+		halo.V[iX] = binHalo.V[iX];
+		halo.L[iX] = binHalo.L[iX];
+	}
+
+	SetPartNumbers(&halo, binHalo.nPart);
+
+	return true;
+};
+
+
+bool MetroReader::OpenParticles(string fileName)
+{
+	return ReadHeader(fileName, "MCPPPART");
+};
+
+
+bool MetroReader::NextBlock(uint64_t &haloID, int &nPart)
+{
+	uint64_t blockHead[2];
+
+	if (iFileRecord == nFileRecords || fread(blockHead, sizeof(uint64_t), 2, fileIn) != 2)
+		return false;
+
+	iFileRecord++;
+
+	haloID = blockHead[0];
+	nBlockPart = (int) blockHead[1];
+	nPart = nBlockPart;
+
+	return true;
+};
+
+
+bool MetroReader::ReadBlock(vector<uint64_t> &partIDs, vector<int> &partTypes)
+{
+	partIDs.resize(nBlockPart);
+
+	if ((int) fread(partIDs.data(), sizeof(uint64_t), nBlockPart, fileIn) != nBlockPart)
+		return false;
+
+#ifndef NOPTYPE
+	if (partFlags & 1)
+	{
+		vector<uint8_t> binTypes(nBlockPart);
+
+		if ((int) fread(binTypes.data(), sizeof(uint8_t), nBlockPart, fileIn) != nBlockPart)
+			return false;
+
+		partTypes.assign(binTypes.begin(), binTypes.end());
+		return true;
+	}
+#else
+	if (partFlags & 1)
+		fseek(fileIn, (long) nBlockPart * sizeof(uint8_t), SEEK_CUR);
+#endif
+
+	partTypes.assign(nBlockPart, 1);
+
+	return true;
+};
+
+
+void MetroReader::SkipBlock()
+{
+	long nBytes = (long) nBlockPart * sizeof(uint64_t);
+
+	if (partFlags & 1)
+		nBytes += (long) nBlockPart * sizeof(uint8_t);
+
+	fseek(fileIn, nBytes, SEEK_CUR);
+};
+
+
+void MetroReader::Close()
+{
+	if (fileIn != nullptr)
+		fclose(fileIn);
+
+	fileIn = nullptr;
+};
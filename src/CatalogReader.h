@@ -0,0 +1,170 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CATALOGREADER_H
+#define CATALOGREADER_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include "InputStream.h"
+#include "Halo.h"
+
+using namespace std;
+
+
+/* Position of each halo block in a particle file, stored in a sidecar file (particle file name + .idx).
+ * The size and modification time of the particle file are stored too, so that a stale index is rebuilt */
+class PartIndex {
+
+public:
+	vector<uint64_t> haloIDs;
+	vector<uint64_t> offsets;	// Byte offset of the block header line
+	vector<int> nParts;
+
+	size_t Size(void) { return offsets.size(); };
+	void Add(uint64_t, uint64_t, int);
+	void Clean(void);
+
+	bool Read(string);
+	bool Write(string);
+};
+
+
+/* Interface to the halo finder outputs. A reader returns the halos of a catalog file one by one,
+ * and the particle file as a sequence of per-halo blocks (halo ID, number of particles, particle IDs and types).
+ * Selecting, sorting and storing halos and particles is done by IOSettings, independently of the format. */
+class CatalogReader {
+
+public:
+	virtual ~CatalogReader() {};
+
+	/* Halo catalogs */
+	virtual bool OpenHalos(string) = 0;
+	virtual bool NextHalo(Halo &) = 0;
+
+	/* Particle files: read the header of the next block, then either its content or skip over it */
+	virtual bool OpenParticles(string) = 0;
+	virtual bool NextBlock(uint64_t &, int &) = 0;
+	virtual bool ReadBlock(vector<uint64_t> &, vector<int> &) = 0;	// false if the block is truncated
+	virtual void SkipBlock(void) = 0;
+
+	virtual void Close(void) = 0;
+
+	/* Formats with a block index can read a subset [first, last) of the blocks of an open particle file */
+	virtual PartIndex *Index(void) { return nullptr; };
+	virtual void SetBlockRange(size_t, size_t) {};
+
+	/* Returns a reader for the inputFormat string, nullptr if the format is unknown */
+	static CatalogReader *New(string);
+};
+
+
+/* AHF ASCII .AHF_halos / .AHF_particles, possibly compressed */
+class AHFReader : public CatalogReader {
+
+public:
+	bool OpenHalos(string);
+	bool NextHalo(Halo &);
+
+	bool OpenParticles(string);
+	bool NextBlock(uint64_t &, int &);
+	bool ReadBlock(vector<uint64_t> &, vector<int> &);
+	void SkipBlock(void);
+
+	void Close(void);
+
+	PartIndex *Index(void);
+	void SetBlockRange(size_t, size_t);
+
+private:
+	InputStream fileIn;
+	string lineIn;
+	string partName;
+
+	// Particle blocks left in the current section of the particle file, the number of particles in the current block
+	unsigned int nFileHalos;
+	int nBlockPart;
+
+	// Current byte offset in the file, the index is either read from the sidecar file or built while reading
+	size_t filePos;
+	PartIndex index;
+	bool hasIndex, buildIndex;
+	size_t iBlock, endBlock;
+
+	bool GetLine(void);
+	void ReadLine(const char *, Halo *);
+};
+
+
+/* Rockstar binary halos_*.bin files, which contain both the halo properties and the particle IDs */
+class RockstarReader : public CatalogReader {
+
+public:
+	RockstarReader();
+	~RockstarReader();
+
+	bool OpenHalos(string);
+	bool NextHalo(Halo &);
+
+	bool OpenParticles(string);
+	bool NextBlock(uint64_t &, int &);
+	bool ReadBlock(vector<uint64_t> &, vector<int> &);
+	void SkipBlock(void);
+
+	void Close(void);
+
+private:
+	FILE *fileIn;
+	int64_t nFileHalos, iFileHalo;
+
+	// Halo IDs and particle numbers, the particle IDs follow the halo records in the same order
+	vector<int64_t> blockIDs, blockParts;
+	int nBlockPart;
+
+	bool ReadHeader(string);
+};
+
+
+/* MetroC++ native binary catalogs, see the user guide for the layout */
+class MetroReader : public CatalogReader {
+
+public:
+	MetroReader();
+	~MetroReader();
+
+	bool OpenHalos(string);
+	bool NextHalo(Halo &);
+
+	bool OpenParticles(string);
+	bool NextBlock(uint64_t &, int &);
+	bool ReadBlock(vector<uint64_t> &, vector<int> &);
+	void SkipBlock(void);
+
+	void Close(void);
+
+private:
+	FILE *fileIn;
+	uint64_t nFileRecords, iFileRecord;
+	int32_t partFlags;
+	int nBlockPart;
+
+	bool ReadHeader(string, const char *);
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Checkpoint.cpp:
+ * Plain or gzip-compressed binary files used to restart the main loop. The content is assembled by IOSettings.
+ */
+
+#include <string>
+#include <cstdio>
+
+#include "Checkpoint.h"
+
+using namespace std;
+
+
+static_assert(sizeof(CheckpointHeader) == 48, "Checkpoint header must be 48 bytes");
+
+
+Checkpoint::Checkpoint()
+{
+	filePlain = nullptr;
+#ifdef GZIP_INPUT
+	fileGz = nullptr;
+#endif
+	isGood = false;
+};
+
+
+Checkpoint::~Checkpoint()
+{
+	Close();
+};
+
+
+/* Compression is faster at the lowest level, which already removes most of the redundancy of the particle IDs */
+bool Checkpoint::Open(string fileName, bool isWrite, bool isCompressed)
+{
+	Close();
+
+#ifdef GZIP_INPUT
+	if (!isWrite || isCompressed)
+	{
+		fileGz = gzopen(fileName.c_str(), isWrite ? "wb1" : "rb");
+
+		if (fileGz != nullptr)
+			gzbuffer(fileGz, 1024 * 1024);
+
+		isGood = (fileGz != nullptr);
+		return isGood;
+	}
+#endif
+
+	filePlain = fopen(fileName.c_str(), isWrite ? "wb" : "rb");
+	isGood = (filePlain != nullptr);
+
+	return isGood;
+};
+
+
+bool Checkpoint::Close()
+{
+	if (filePlain != nullptr)
+		isGood = (fclose(filePlain) == 0) && isGood;
+
+#ifdef GZIP_INPUT
+	if (fileGz != nullptr)
+		isGood = (gzclose(fileGz) == Z_OK) && isGood;
+
+	fileGz = nullptr;
+#endif
+	filePlain = nullptr;
+
+	return isGood;
+};
+
+
+bool Checkpoint::Write(const void *thisData, size_t nBytes)
+{
+	const char *thisBytes = (const char *) thisData;
+
+#ifdef GZIP_INPUT
+	/* gzwrite takes an unsigned int size */
+	while (isGood && fileGz != nullptr && nBytes > 0)
+	{
+		unsigned int nWrite = (nBytes > (1u << 30)) ? (1u << 30) : nBytes;
+
+		isGood = (gzwrite(fileGz, thisBytes, nWrite) == (int) nWrite);
+		thisBytes += nWrite;
+		nBytes -= nWrite;
+	}
+#endif
+
+	if (isGood && filePlain != nullptr && nBytes > 0)
+		isGood = (fwrite(thisBytes, 1, nBytes, filePlain) == nBytes);
+
+	return isGood;
+};
+
+
+bool Checkpoint::Read(void *thisData, size_t nBytes)
+{
+	char *thisBytes = (char *) thisData;
+
+#ifdef GZIP_INPUT
+	while (isGood && fileGz != nullptr && nBytes > 0)
+	{
+		unsigned int nRead = (nBytes > (1u << 30)) ? (1u << 30) : nBytes;
+
+		isGood = (gzread(fileGz, thisBytes, nRead) == (int) nRead);
+		thisBytes += nRead;
+		nBytes -= nRead;
+	}
+#endif
+
+	if (isGood && filePlain != nullptr && nBytes > 0)
+		isGood = (fread(thisBytes, 1, nBytes, filePlain) == nBytes);
+
+	return isGood;
+};
@@ -0,0 +1,88 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#ifdef GZIP_INPUT
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+
+/* Restart file layout, one file per task:
+ *	CheckpointHeader		magic, version, step to restart from, task and run settings, number of halos
+ *	locHalos[0]			Halo records, including the orphan halos being tracked
+ *	locParts[0]			number of particles of each halo and type, then all the particle IDs
+ *	trees				on the task holding the trees, the tree graph and the database branches (if used) */
+struct CheckpointHeader {
+	char magic[8];			// "MCPPCKPT"
+	int32_t version, iNumCat;
+	int32_t locTask, totTask;
+	int32_t nPTypes, sizeHalo;
+	int32_t nLocHalos, nLocParts;
+	int32_t hasTrees, unused;
+};
+
+
+/* Binary file written and read back in order. With -DGZIP_INPUT the file can be gzip-compressed,
+ * and plain files are read through zlib as well */
+class Checkpoint {
+
+public:
+	Checkpoint();
+	~Checkpoint();
+
+	bool Open(string, bool, bool = false);
+	bool Close(void);
+
+	bool Write(const void *, size_t);
+	bool Read(void *, size_t);
+
+	/* Vectors of plain structures are stored as their size followed by the elements */
+	template <typename T> bool WriteVector(vector<T> &thisVector)
+	{
+		uint64_t nElements = thisVector.size();
+		return Write(&nElements, sizeof(uint64_t)) && Write(thisVector.data(), nElements * sizeof(T));
+	};
+
+	template <typename T> bool ReadVector(vector<T> &thisVector)
+	{
+		uint64_t nElements = 0;
+
+		if (!Read(&nElements, sizeof(uint64_t)))
+			return false;
+
+		thisVector.resize(nElements);
+		return Read(thisVector.data(), nElements * sizeof(T));
+	};
+
+private:
+	FILE *filePlain;
+#ifdef GZIP_INPUT
+	gzFile fileGz;
+#endif
+	bool isGood;
+};
+
+#endif
@@ -21,6 +21,7 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 
 #include "utils.h"
 #include "global_vars.h"
@@ -32,6 +33,13 @@
 using namespace std;
 
 
+Communication::Communication()
+{
+	commBuffer = MPI_COMM_NULL;
+	isBuffPending = false;
+};
+
+
 Communication::~Communication()
 {
 	sendTasks.clear();
@@ -53,229 +61,361 @@ Communication::~Communication()
 };
 
 
+/* Point-to-point version of MPI_Alltoallv with size_t counts and offsets. Each block is split into messages of at most
+ * MAX_MSG_BYTES, which are matched in order as they are posted in the same order on both sides with the same tag. */
+void Communication::PostExchange(const void *sendBuf, const vector<size_t> &sendNum, const vector<size_t> &sendOff,
+	void *recvBuf, const vector<size_t> &recvNum, const vector<size_t> &recvOff, const vector<int> &thisTasks, 
+	MPI_Datatype thisType, int thisTag, vector<MPI_Request> &thisRequests)
+{
+	MPI_Aint lowBound = 0, typeSize = 0;
+	MPI_Type_get_extent(thisType, &lowBound, &typeSize);
+
+	size_t maxCount = max((size_t) 1, (size_t) MAX_MSG_BYTES / typeSize);
+
+	for (int iT = 0; iT < thisTasks.size(); iT++)
+		for (size_t iC = 0; iC < recvNum[iT]; iC += maxCount)
+		{
+			thisRequests.push_back(MPI_REQUEST_NULL);
+			MPI_Irecv((char *) recvBuf + (recvOff[iT] + iC) * typeSize, min(maxCount, recvNum[iT] - iC), thisType, 
+				thisTasks[iT], thisTag, MPI_COMM_WORLD, &thisRequests.back());
+		}
+
+	for (int iT = 0; iT < thisTasks.size(); iT++)
+		for (size_t iC = 0; iC < sendNum[iT]; iC += maxCount)
+		{
+			thisRequests.push_back(MPI_REQUEST_NULL);
+			MPI_Isend((const char *) sendBuf + (sendOff[iT] + iC) * typeSize, min(maxCount, sendNum[iT] - iC), thisType, 
+				thisTasks[iT], thisTag, MPI_COMM_WORLD, &thisRequests.back());
+		}
+};
+
+
+void Communication::Exchange(const void *sendBuf, const vector<size_t> &sendNum, const vector<size_t> &sendOff,
+	void *recvBuf, const vector<size_t> &recvNum, const vector<size_t> &recvOff, const vector<int> &thisTasks, 
+	MPI_Datatype thisType, int thisTag)
+{
+	vector<MPI_Request> thisRequests;
+
+	PostExchange(sendBuf, sendNum, sendOff, recvBuf, recvNum, recvOff, thisTasks, thisType, thisTag, thisRequests);
+	MPI_Waitall(thisRequests.size(), thisRequests.data(), MPI_STATUSES_IGNORE);
+};
+
+
+void Communication::Bcast(void *thisBuf, size_t nElements, MPI_Datatype thisType, int rootTask)
+{
+	MPI_Aint lowBound = 0, typeSize = 0;
+	MPI_Type_get_extent(thisType, &lowBound, &typeSize);
+
+	size_t maxCount = max((size_t) 1, (size_t) MAX_MSG_BYTES / typeSize);
+
+	for (size_t iC = 0; iC < nElements; iC += maxCount)
+		MPI_Bcast((char *) thisBuf + iC * typeSize, min(maxCount, nElements - iC), thisType, rootTask, MPI_COMM_WORLD);
+};
+
+
+vector<size_t> Communication::Offsets(const vector<size_t> &thisNum)
+{
+	vector<size_t> thisOff(thisNum.size(), 0);
+
+	for (size_t iN = 1; iN < thisNum.size(); iN++)
+		thisOff[iN] = thisOff[iN-1] + thisNum[iN-1];
+
+	return thisOff;
+};
+
+
+/* The type is never freed, it is used until the end of the run */
+MPI_Datatype Communication::HaloType()
+{
+	static MPI_Datatype haloType = MPI_DATATYPE_NULL;
+
+	if (haloType == MPI_DATATYPE_NULL)
+	{
+		MPI_Type_contiguous(sizeof(Halo), MPI_BYTE, &haloType);
+		MPI_Type_commit(&haloType);
+	}
+
+	return haloType;
+};
+
+
 /* NOTE: In ZOOM mode there is no buffer to be communicated, as everything works on shared memory */
 
 #ifndef ZOOM
-/* This function first determines the size of the buffers to be broadcasted, then communicates it to all the tasks.
- * Each task packs all the halos and particles that are requested by other halos for comparison into several buffers,
- * which are communicated with a call to MPI_Sendrecv. The buffers are then unpacked into the locBuffHalos and locBuffParts
- * vectors, which contain all of the halos/particles received from the neighbouring subvolumes. */
-void Communication::BufferSendRecv()
+
+/* The graph and neighbourhood calls reject null arrays even when their count is 0, and data() of an empty vector might 
+ * be null: empty vectors are passed as a dummy element instead, which is never read nor written */
+template <typename T> static T *NonNull(vector<T> &thisVector)
 {
-	/* Tasks receiving and sending messages */
-	int recvTask = 0, sendTask = 0;
-	
-	/* Keep track of all the halos & particles in the buffer region */
-	int iBuffTotHalo = 0;
-	int iBuffTotPart = 0;
+	static T dummyElement[1];
 
-	/* These buffers hold the number of halos to be sent/recvd to/from multiple tasks */
-	int nBuffSendHalos = 0, nBuffRecvHalos = 0; 
-	int buffIndexHalo = 0, buffIndexPart = 0;
-
-	/* Technical note:
-	 * Halo buffers can be allocated directly as vectors.
-	 * However, since Particles buffers are allocated as vectors of vectors, the contiguity of ALL the memory blocks is not
-	 * guaranteed - thus, it is safer to MPI_Pack all the particle objects into a generic void* buffer and then unpack it  */
-	vector<Halo> buffSendHalos;
-	vector<Halo> buffRecvHalos;
-
-	/* Buffers and buffer sizes */
-	void *buffSendParts = nullptr, *buffRecvParts = nullptr;
-	size_t buffSendSizeParts = 0, buffRecvSizeParts = 0;
-	size_t buffSendSizeHalos = 0, buffRecvSizeHalos = 0;
-	int nTmpPart = 0;
+	return thisVector.empty() ? dummyElement : thisVector.data();
+};
 
-	/* Determine the order of sending and receiving tasks to avoid gridlocks and make it consistent through
-	 * all the tasks  */
-	SetSendRecvTasks();
+
+/* Particle IDs of the other catalog inside a list of intervals, only counted up to minPartCmp + 1. 
+ * The buffer halos are compared with the particles of catalog 0. */
+static int CountInRanges(const vector<uint64_t> &thisBounds)
+{
+	int nInside = 0;
+
+	for (int iR = 0; iR < thisBounds.size(); iR += 2)
+		for (auto thisMap = locMapParts[0].lower_bound(thisBounds[iR]); thisMap != locMapParts[0].end() 
+				&& thisMap->first <= thisBounds[iR + 1] && nInside <= minPartCmp; thisMap++)
+			nInside++;
+
+	return nInside;
+};
+
+
+/* This function first determines the size of the buffers to be exchanged with the neighbouring tasks.
+ * Each task packs all the halos and particles that are requested by other halos for comparison into two buffers,
+ * which are communicated with non-blocking messages to the tasks of the buffer graph, so that only the tasks sharing 
+ * a buffer region take part. The halos are sent first with the intervals covering their particle IDs, and the particles
+ * only of the halos requested by the receiving task. The exchange of the particles is only started here, BufferWait 
+ * completes it and unpacks the buffers into the locBuffHalos and locBuffParts vectors, which contain all of the 
+ * halos/particles received from the neighbouring subvolumes. In the meantime the particles of the local halos can be 
+ * compared. */
+void Communication::BufferSendRecv()
+{
+	/* The graph of the tasks sharing a buffer region is set from the nodes requested by each task */
+	SetBufferGraph();
 
 	/* First communicate the list of nodes to be sent and received by every task 
 	 * The list of nodes also contains the list of haloes associated to them  */
 	ExchangeBuffers();
 
+	int nBuffTasks = buffTasks.size();
+	vector<uint64_t> sendCounts(2 * nBuffTasks), recvCounts(2 * nBuffTasks), sendWords(nBuffTasks), recvWords(nBuffTasks);
+	vector<size_t> sendHaloNum(nBuffTasks), recvHaloNum(nBuffTasks), sendSignNum(nBuffTasks), recvSignNum(nBuffTasks);
+	vector<size_t> sendPartNum(nBuffTasks), recvPartNum(nBuffTasks);
+	vector<uint64_t> sendSigns, recvSigns;
+	vector<char> sendWanted;
+	size_t nSendIDs = 0, nWanted = 0;
+
 	if (locTask == 0)
 		cout << "Sending and receiving halos in the buffer regions..." << endl; 
 
-	/*
-	 * 		FIRST EXCHANGE HALO BUFFERS
-	 */
-
-	/* Loop on all the tasks, minus one - the local one */
-	for (int iT = 0; iT < totTask-1; iT++)
+	/* The halos are sent first, together with the intervals covering the first nPart IDs of all their types */
+	for (int iB = 0; iB < nBuffTasks; iB++)
 	{
-		sendTask = sendTasks[iT];
-		recvTask = recvTasks[iT];
+		int sendTask = buffTasks[iB];
+		size_t iFirstWord = sendSigns.size();
 
-		/* Now compute the size of the particle buffer and copy the halos into the buffer to be communicated */
-		buffSendSizeParts = 0;
+		sendHaloNum[iB] = buffIndexSendHalo[sendTask].size();
 
-		/* At this step, locTask will send nBuffSendHalos to sendTask */
-		nBuffSendHalos = buffIndexSendHalo[sendTask].size();
-
-#ifdef VERBOSE
-		if (nBuffSendHalos == 0)
-			cout << "Task=" << locTask << " has zero send buffer to " << sendTask << endl;  
-#endif
-
-		for (int iP = 0; iP < nBuffSendHalos; iP ++)
+		for (int iI = 0; iI < sendHaloNum[iB]; iI++)
 		{
-			int iH = buffIndexSendHalo[sendTask][iP];
-			
-			buffSendHalos.push_back(locHalos[iUseCat][iH]);
-			
-			for (int iT = 0; iT < nPTypes; iT ++)
-				buffSendSizeParts += locHalos[iUseCat][iH].nPart[iT] * sizePart;
+			int iH = buffIndexSendHalo[sendTask][iI];
 
 			if (iH > locHalos[iUseCat].size())	// Sanity check 
 				cout << "WARNING. Halo index " << iH << " not found locally (locHalos). " 
 					<< "Required in the send buffer from task=" << locTask << " to task=" << sendTask << endl;
-		}
 
-		buffSendSizeHalos = nBuffSendHalos * sizeHalo;
+			buffSendHalos.push_back(locHalos[iUseCat][iH]);
 
-#ifdef VERBOSE
-		cout << iT << ") On task=" << locTask << ") sending " << nBuffSendHalos << " halos to " << sendTask <<endl;
-		cout << iT << ") On task=" << locTask << ") sending " << buffSendSizeHalos << " b to " << sendTask <<endl;
-#endif
-		MPI_Sendrecv(&nBuffSendHalos, 1, MPI_INT, sendTask, 0, 
-			     &nBuffRecvHalos, 1, MPI_INT, recvTask, 0, MPI_COMM_WORLD, &status);
+			if (nBufferRanges > 0)
+			{
+				vector<uint64_t> tmpIDs, tmpBounds;
 
-		buffRecvSizeHalos = nBuffRecvHalos * sizeHalo;
-		buffRecvHalos.resize(nBuffRecvHalos);	
+				for (int iP = 0; iP < nPTypes; iP++)
+					tmpIDs.insert(tmpIDs.end(), locParts[iUseCat][iH][iP].begin(), 
+						locParts[iUseCat][iH][iP].begin() + locHalos[iUseCat][iH].nPart[iP]);
 
-#ifdef VERBOSE
-		cout << iT << ") On task=" << locTask << ") recving " << nBuffRecvHalos << " halos from " << recvTask <<endl;
-		cout << iT << ") On task=" << locTask << ") recving " << buffRecvSizeHalos << " b from " << recvTask <<endl;
-#endif
-		MPI_Sendrecv(&buffSendHalos[0], buffSendSizeHalos, MPI_BYTE, sendTask, 0, 
-			     &buffRecvHalos[0], buffRecvSizeHalos, MPI_BYTE, recvTask, 0, MPI_COMM_WORLD, &status);
+				sort(tmpIDs.begin(), tmpIDs.end());
+				RangeIDs(tmpIDs, nBufferRanges, tmpBounds);
+				EncodeIDs(tmpBounds, sendSigns);
+			}
+		}
 
-		/* Add the halos to the local buffer AND a local grid node which is now part of the buffer grid */
-		for (int iH = 0; iH < nBuffRecvHalos; iH++)
-			locBuffHalos.push_back(buffRecvHalos[iH]);
+		sendSignNum[iB] = sendSigns.size() - iFirstWord;
+		sendCounts[2 * iB] = sendHaloNum[iB];
+		sendCounts[2 * iB + 1] = sendSignNum[iB];
+	}
 
-		/* Clean the recv halo buffer */
-		if (buffRecvHalos.size() > 0)
-		{
-			buffRecvHalos.clear();
-			buffRecvHalos.shrink_to_fit();
-		}
+	/* The counts can exceed the range of an int on large tasks */
+	MPI_Neighbor_alltoall(NonNull(sendCounts), 2, MPI_UINT64_T, NonNull(recvCounts), 2, MPI_UINT64_T, commBuffer);
 
-		/* Clean the send buffer after Sendrecv */
-		if (buffSendHalos.size() > 0)
-		{
-			buffSendHalos.clear();
-			buffSendHalos.shrink_to_fit();
-		}
+	for (int iB = 0; iB < nBuffTasks; iB++)
+	{
+		recvHaloNum[iB] = recvCounts[2 * iB];
+		recvSignNum[iB] = recvCounts[2 * iB + 1];
+	}
 
-	/*
-	 * 		MPI_Pack & exchange particle buffers
-	 */
+	vector<size_t> sendHaloOff = Offsets(sendHaloNum), recvHaloOff = Offsets(recvHaloNum);
+	vector<size_t> sendSignOff = Offsets(sendSignNum), recvSignOff = Offsets(recvSignNum);
 
+	if (nBuffTasks > 0)
 	{
-		/* Local particles to be sent will be mpi-packed into this buffer */
-		buffSendParts = (void *) malloc(buffSendSizeParts);
+		buffRecvHalos.resize(recvHaloOff[nBuffTasks-1] + recvHaloNum[nBuffTasks-1]);
+		recvSigns.resize(recvSignOff[nBuffTasks-1] + recvSignNum[nBuffTasks-1]);
+	}
 
-		locBuffParts.resize(locBuffHalos.size());
+	Exchange(buffSendHalos.data(), sendHaloNum, sendHaloOff, buffRecvHalos.data(), recvHaloNum, recvHaloOff, 
+			buffTasks, HaloType(), 1);
 
-#ifdef VERBOSE
-		cout << "OnTask=" << locTask <<  ", allocating " 
-			<< buffSendSizeParts/1024/1024 << "MB particle send buffer. " << endl;
-#else
-		if (locTask == 0 && iT == 0)
-			cout << "Allocating " << buffSendSizeParts/1024/1024 << "MB for the particle send buffer. " << endl;
-#endif
+	buffRecvWanted.assign(buffRecvHalos.size(), 1);
+	sendWanted.assign(buffSendHalos.size(), 1);
+
+	/* The particles of a halo are requested only if more than minPartCmp local IDs fall inside its intervals, 
+	 * otherwise it cannot share enough particles with any local halo to be connected to it */
+	if (nBufferRanges > 0)
+	{
+		size_t iWord = 0;
 
-		/* MPI_Pack variables - for some reason if defined at the beginning MPI_Pack crashes... */
-		int posSendPart = 0;
+		Exchange(sendSigns.data(), sendSignNum, sendSignOff, recvSigns.data(), recvSignNum, recvSignOff, 
+				buffTasks, MPI_UINT64_T, 3);
 
-		/* Pack all the selected particles into a single buffer */
-		for (int iI = 0; iI < nBuffSendHalos; iI ++)
+		for (int iH = 0; iH < buffRecvHalos.size(); iH++)
+		{
+			vector<uint64_t> tmpBounds;
+			int nTmpPart = 0;
+
+			for (int iP = 0; iP < nPTypes; iP++)
+				nTmpPart += buffRecvHalos[iH].nPart[iP];
+
+			iWord += DecodeIDs(recvSigns.data() + iWord, 2 * min(nBufferRanges, nTmpPart), tmpBounds);
+			buffRecvWanted[iH] = (CountInRanges(tmpBounds) > minPartCmp);
+		}
+
+		Exchange(buffRecvWanted.data(), recvHaloNum, recvHaloOff, sendWanted.data(), sendHaloNum, sendHaloOff, 
+				buffTasks, MPI_CHAR, 4);
+	}
+
+	/* Then the IDs of the requested halos, in the compact form of EncodeIDs */
+	for (int iB = 0; iB < nBuffTasks; iB++)
+	{
+		int sendTask = buffTasks[iB];
+		size_t iFirstWord = buffSendParts.size();
+
+		for (int iI = 0; iI < sendHaloNum[iB]; iI++)
 		{
 			int iH = buffIndexSendHalo[sendTask][iI];
 
-			for (int iP = 0; iP < nPTypes; iP ++)
+			if (!sendWanted[sendHaloOff[iB] + iI])
+				continue;
+
+			nWanted++;
+
+			/* Only the first nPart IDs of each type are used */
+			for (int iP = 0; iP < nPTypes; iP++)
 			{
-				if (locHalos[iUseCat][iH].nPart[iP] > 0)
+				int nTmpPart = locHalos[iUseCat][iH].nPart[iP];
+
+				nSendIDs += nTmpPart;
+
+				if (nTmpPart > 0)
 				{
-					MPI_Pack(&locParts[iUseCat][iH][iP][0], locHalos[iUseCat][iH].nPart[iP] * sizePart, MPI_BYTE, 
-						  buffSendParts, buffSendSizeParts, &posSendPart, MPI_COMM_WORLD);
+					vector<uint64_t> tmpIDs(locParts[iUseCat][iH][iP].begin(), locParts[iUseCat][iH][iP].begin() + nTmpPart);
+					EncodeIDs(tmpIDs, buffSendParts);
 				}
 			}
 		}
 
-		/* Communicate the MPI_Pack-ed buffer sizes */
-		MPI_Sendrecv(&buffSendSizeParts, sizeof(size_t), MPI_BYTE, sendTask, 0, 
-			     &buffRecvSizeParts, sizeof(size_t), MPI_BYTE, recvTask, 0, MPI_COMM_WORLD, &status);
+		sendPartNum[iB] = buffSendParts.size() - iFirstWord;
+		sendWords[iB] = sendPartNum[iB];
 
-		/* Check that the receiving buffer is a null pointer before allocating it */
-		if (buffRecvParts != nullptr)
-		{
-			free(buffRecvParts);
-			buffRecvParts = nullptr;
-		}
+#ifdef VERBOSE
+		cout << "On task=" << locTask << " sending " << sendHaloNum[iB] << " halos and " << sendPartNum[iB] 
+			<< " particle words to " << sendTask << endl;
+#endif
+	}
+
+	MPI_Neighbor_alltoall(NonNull(sendWords), 1, MPI_UINT64_T, NonNull(recvWords), 1, MPI_UINT64_T, commBuffer);
+
+	for (int iB = 0; iB < nBuffTasks; iB++)
+		recvPartNum[iB] = recvWords[iB];
 
-		buffRecvParts = (void *) malloc(buffRecvSizeParts);
+	vector<size_t> sendPartOff = Offsets(sendPartNum), recvPartOff = Offsets(recvPartNum);
+
+	if (nBuffTasks > 0)
+		buffRecvParts.resize(recvPartOff[nBuffTasks-1] + recvPartNum[nBuffTasks-1]);
 
 #ifdef VERBOSE
-		cout << "Allocating " << buffRecvSizeParts/1024/1024 << "MB recv buffer for " << nBuffRecvHalos << endl;
+	cout << "OnTask=" << locTask << ", " << nBuffTasks << " neighbours, allocating " 
+		<< buffRecvParts.size() * sizePart/1024/1024 << "MB particle recv buffer. " << endl;
 #else
-		if (locTask == 0 && iT == 0)
-			cout << "Allocating " << buffRecvSizeParts/1024/1024 
-				<< "MB for the particle recv buffer. " << endl;
+	if (locTask == 0)
+		cout << "Allocating " << buffRecvParts.size() * sizePart/1024/1024 << "MB for the particle recv buffer from " 
+			<< nBuffTasks << " neighbouring tasks." << endl;
 #endif
 
-		/* Send and recv the MPI_Pack-ed buffers */
-		MPI_Sendrecv(buffSendParts, buffSendSizeParts, MPI_BYTE, sendTask, 0, 
-			     buffRecvParts, buffRecvSizeParts, MPI_BYTE, recvTask, 0, MPI_COMM_WORLD, &status);
+	if (locTask == 0 && buffSendHalos.size() > 0)
+		cout << "Particles requested for " << nWanted << " of the " << buffSendHalos.size() << " buffer halos sent." << endl;
 
-		/* Particles have been sent, free the buffer */
-		free(buffSendParts);
+	if (locTask == 0 && nSendIDs > 0)
+		cout << "Particle IDs on the buffer compressed to " << 100.0 * buffSendParts.size() / nSendIDs 
+			<< "% of their size." << endl;
 
-		int posRecvPart = 0;
+	/* The buffers are kept until BufferWait, the counts and offsets are only needed to post the messages */
+	buffRequests.clear();
 
-		/* Unpack the particle buffer */
-		for (int iH = 0; iH < nBuffRecvHalos; iH++)
-		{
-			locBuffParts[iBuffTotHalo].resize(nPTypes);
+	PostExchange(buffSendParts.data(), sendPartNum, sendPartOff, buffRecvParts.data(), recvPartNum, recvPartOff, 
+			buffTasks, MPI_UINT64_T, 2, buffRequests);
 
-			for (int iT = 0; iT < nPTypes; iT++)
-			{	
-				nTmpPart = locBuffHalos[iBuffTotHalo].nPart[iT];
-				iBuffTotPart += nTmpPart;
+	isBuffPending = true;
+};
 
-				if (nTmpPart > 0)
+
+/* Complete the exchange started by BufferSendRecv and add the received halos and particles to the buffer */
+void Communication::BufferWait()
+{
+	/* Keep track of all the halos & particles in the buffer region */
+	int iBuffTotHalo = locBuffHalos.size();
+	size_t iBuffTotPart = 0;
+
+	if (!isBuffPending)
+		return;
+
+	MPI_Waitall(buffRequests.size(), buffRequests.data(), MPI_STATUSES_IGNORE);
+	isBuffPending = false;
+
+	vector<Halo>().swap(buffSendHalos);
+	vector<uint64_t>().swap(buffSendParts);
+
+	/* Unpack the particle buffer, halos are in the order of the neighbouring tasks */
+	locBuffHalos.insert(locBuffHalos.end(), buffRecvHalos.begin(), buffRecvHalos.end());
+	locBuffParts.resize(locBuffHalos.size());
+
+	for (int iH = 0; iH < buffRecvHalos.size(); iH++)
+	{
+		locBuffParts[iBuffTotHalo].resize(nPTypes);
+
+		/* Halos whose particles were not requested are kept without them */
+		for (int iT = 0; iT < nPTypes && buffRecvWanted[iH]; iT++)
+		{	
+			int nTmpPart = locBuffHalos[iBuffTotHalo].nPart[iT];
+
+			if (nTmpPart > 0)
+			{
+				iBuffTotPart += DecodeIDs(&buffRecvParts[iBuffTotPart], nTmpPart, locBuffParts[iBuffTotHalo][iT]);
+
+				for (auto const& partID : locBuffParts[iBuffTotHalo][iT])
 				{
-					locBuffParts[iBuffTotHalo][iT].resize(nTmpPart);
-	
-					MPI_Unpack(buffRecvParts, buffRecvSizeParts, &posRecvPart, &locBuffParts[iBuffTotHalo][iT][0], 
-							nTmpPart * sizePart, MPI_BYTE, MPI_COMM_WORLD);
-
-					for (auto const& partID : locBuffParts[iBuffTotHalo][iT])
-					{
-				       		Particle thisParticle;
-   	                      	        	thisParticle.haloID = locBuffHalos[iBuffTotHalo].ID;
-        	                        	thisParticle.type   = iT;
-                	                	locMapParts[iUseCat][partID].push_back(thisParticle);
-					}
+					Particle thisParticle;
+					thisParticle.haloID = locBuffHalos[iBuffTotHalo].ID;
+					thisParticle.type   = iT;
+					locMapParts[iUseCat][partID].push_back(thisParticle);
 				}
 			}
-			
-			iBuffTotHalo++;
 		}
-	}	
+			
+		iBuffTotHalo++;
+	}
 
-}	/* Loop on all the send/recv tasks */
+	vector<Halo>().swap(buffRecvHalos);
+	vector<uint64_t>().swap(buffRecvParts);
+	vector<char>().swap(buffRecvWanted);
 
 	/* Now assign the halos on the buffer to the respective nodes */
 	for (int iH = 0; iH < locBuffHalos.size(); iH++)
 		GlobalGrid[iUseCat].AssignToGrid(locBuffHalos[iH].X, -iH-1);	// iH is negative - this is used for halos on the buffer, 
 										// the -1 is added to avoid overlap with halo num 0
+	GlobalGrid[iUseCat].SortHalos();
 
 #ifdef VERBOSE
 	cout << "Gathered " << locBuffHalos.size() << " halos in the buffer on task=" << locTask << endl;
-	cout << "Gathered " << iBuffTotPart << " parts in the buffer on task=" << locTask << endl;
+	cout << "Gathered " << iBuffTotPart << " words of particle IDs in the buffer on task=" << locTask << endl;
 #else
 	if (locTask == 0)
 		cout << "Gathered halo and particle buffers. " << endl;
@@ -290,7 +430,6 @@ void Communication::GatherMergerTrees(int iMTree)
 {
 	int nSendProgs = 0, nSendMains = 0, nRecvProgs= 0, nRecvMains = 0;
 	int *sizeProgs = nullptr, *sizeMains = nullptr, *dispProgs = nullptr, *dispMains = nullptr;
-	int *sizePTProgs = nullptr, *dispPTProgs = nullptr; 
 	int *recvTrackProgs = nullptr, *recvTrackNComm = nullptr;
 	Halo *recvMainHalos = nullptr, *recvProgHalos = nullptr;
 	
@@ -333,13 +472,11 @@ void Communication::GatherMergerTrees(int iMTree)
 		sizeMains = (int *) malloc(totTask * sizeof(int));
 		dispProgs = (int *) malloc(totTask * sizeof(int));
 		dispMains = (int *) malloc(totTask * sizeof(int));
-		dispPTProgs = (int *) malloc(totTask * sizeof(int));
-		sizePTProgs = (int *) malloc(totTask * sizeof(int));
 
-		recvMainHalos = (Halo *) malloc(nRecvMains * sizeof(Halo));
-		recvProgHalos = (Halo *) malloc(nRecvProgs * sizeof(Halo));
-		recvTrackProgs = (int *) malloc(nRecvMains * sizeof(int));
-		recvTrackNComm = (int *) malloc(nRecvProgs * nPTypes * sizeof(int));
+		recvMainHalos = (Halo *) malloc((size_t) nRecvMains * sizeof(Halo));
+		recvProgHalos = (Halo *) malloc((size_t) nRecvProgs * sizeof(Halo));
+		recvTrackProgs = (int *) malloc((size_t) nRecvMains * sizeof(int));
+		recvTrackNComm = (int *) malloc((size_t) nRecvProgs * nPTypes * sizeof(int));
 	}
 
 	/* Gather step 0 */
@@ -351,45 +488,39 @@ void Communication::GatherMergerTrees(int iMTree)
 		nSendMains = 0;
 		dispProgs[0] = 0;
 		dispMains[0] = 0;
-		sizePTProgs[0] = 0;
-		dispPTProgs[0] = 0;
 
 		for (int iT = 1; iT < totTask; iT++)
 		{
 			dispProgs[iT] = dispProgs[iT -1] + sizeProgs[iT -1];
 			dispMains[iT] = dispMains[iT -1] + sizeMains[iT -1];
-
-			/* Correct the sizes for number of particle types */
-			dispPTProgs[iT] = dispProgs[iT] * nPTypes;
-			sizePTProgs[iT] = sizeProgs[iT] * nPTypes;
 		}
 	}
 
+	/* Counts and displacements are in halos or in progenitors, not in bytes or ints, so that they stay within the range 
+	 * of an int also for large catalogs */
+	MPI_Datatype commType;
+	MPI_Type_contiguous(nPTypes, MPI_INT, &commType);
+	MPI_Type_commit(&commType);
+
 	/* How many progenitors per main halo */
 	MPI_Gatherv(&trackProgs[0], nSendMains, MPI_INT, recvTrackProgs, sizeMains, dispMains, MPI_INT, 0, MPI_COMM_WORLD);
 
 	/* Particles shared by each progenitor */
-	MPI_Gatherv(&trackNComm[0], nSendProgs * nPTypes, MPI_INT, recvTrackNComm, sizePTProgs, dispPTProgs, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Gatherv(&trackNComm[0], nSendProgs, commType, recvTrackNComm, sizeProgs, dispProgs, commType, 0, MPI_COMM_WORLD);
+
+	MPI_Type_free(&commType);
 
 	if (locTask == 0)
 	{
-		for (int iT = 0; iT < totTask; iT++)
-		{
-			dispMains[iT] *= (int) sizeHalo;
-			sizeMains[iT] *= (int) sizeHalo;
-			dispProgs[iT] *= (int) sizeHalo;
-			sizeProgs[iT] *= (int) sizeHalo;
-		}
-	
 		mainHalos.clear();
 		mainHalos.shrink_to_fit();
 	}	
 
 	/* Gather descendant main halos */
-	MPI_Gatherv(&mainHalos[0], nSendMains * sizeHalo, MPI_BYTE, recvMainHalos, sizeMains, dispMains, MPI_BYTE, 0, MPI_COMM_WORLD);
+	MPI_Gatherv(&mainHalos[0], nSendMains, HaloType(), recvMainHalos, sizeMains, dispMains, HaloType(), 0, MPI_COMM_WORLD);
 
 	/* Gather progenitors */
-	MPI_Gatherv(&progHalos[0], nSendProgs * sizeHalo, MPI_BYTE, recvProgHalos, sizeProgs, dispProgs, MPI_BYTE, 0, MPI_COMM_WORLD);
+	MPI_Gatherv(&progHalos[0], nSendProgs, HaloType(), recvProgHalos, sizeProgs, dispProgs, HaloType(), 0, MPI_COMM_WORLD);
 
 	/* Free the buffer and the bufffer information */
 	if (locTask != 0)
@@ -399,7 +530,6 @@ void Communication::GatherMergerTrees(int iMTree)
 	} else {
 		free(sizeMains); free(dispMains);
 		free(sizeProgs); free(dispProgs);
-		free(sizePTProgs); free(dispPTProgs);
 	}
 
 	 /* Update the merger tree maps on the main task  */
@@ -492,7 +622,7 @@ void Communication::SyncOrphanHalos()
 	if (locTask != 0)
 		allOrphIDs.resize(nOrphIDs);
 
-	MPI_Bcast(&allOrphIDs[0], nOrphIDs * sizeof(uint64_t), MPI_BYTE, 0, MPI_COMM_WORLD);
+	Bcast(allOrphIDs.data(), nOrphIDs, MPI_UINT64_T, 0);
 
 	/* Each task looks for the orphan halo it holds */
 	for (auto const& thisOrphID: allOrphIDs)
@@ -618,19 +748,15 @@ void Communication::SyncMergerTreeBuffer()
 		MPI_Sendrecv(&nBuffSendProg, 1, MPI_INT, sendTask, 0, 
 			     &nBuffRecvProg, 1, MPI_INT, recvTask, 0, MPI_COMM_WORLD, &status);
 
-		/* Multiply by two to take into account progenitor and descendant */
-		size_t buffSendSizeDescID = nBuffSendDescID * sizeof(uint64_t);
-		size_t buffRecvSizeDescID = nBuffRecvDescID * sizeof(uint64_t);
-
 		buffRecvProgIndex.resize(nBuffRecvDescID);
 		buffRecvDescID.resize(nBuffRecvDescID);	
 
 #ifdef VERBOSE
 		cout << iT << ") On task=" << locTask << ") recving " << nBuffRecvProg << " halos from " << recvTask <<endl;
-		cout << iT << ") On task=" << locTask << ") recving " << buffRecvSizeDescID << " b from " << recvTask <<endl;
+		cout << iT << ") On task=" << locTask << ") recving " << nBuffRecvDescID << " IDs from " << recvTask <<endl;
 #endif
-		MPI_Sendrecv(&buffSendDescID[0], buffSendSizeDescID, MPI_BYTE, sendTask, 0, 
-			     &buffRecvDescID[0], buffRecvSizeDescID, MPI_BYTE, recvTask, 0, MPI_COMM_WORLD, &status);
+		MPI_Sendrecv(&buffSendDescID[0], nBuffSendDescID, MPI_UINT64_T, sendTask, 0, 
+			     &buffRecvDescID[0], nBuffRecvDescID, MPI_UINT64_T, recvTask, 0, MPI_COMM_WORLD, &status);
 
 		MPI_Sendrecv(&buffSendProgIndex[0], nBuffSendDescID, MPI_INT, sendTask, 0, 
 			     &buffRecvProgIndex[0], nBuffRecvDescID, MPI_INT, recvTask, 0, MPI_COMM_WORLD, &status);
@@ -639,8 +765,8 @@ void Communication::SyncMergerTreeBuffer()
 		buffRecvComm.resize(nBuffRecvProg * nPTypes);
 
 		/* Send the progenitor halos */
-		MPI_Sendrecv(&buffSendProg[0], nBuffSendProg * sizeHalo, MPI_BYTE, sendTask, 0, 
-			     &buffRecvProg[0], nBuffRecvProg * sizeHalo, MPI_BYTE, recvTask, 0, MPI_COMM_WORLD, &status);
+		MPI_Sendrecv(&buffSendProg[0], nBuffSendProg, HaloType(), sendTask, 0, 
+			     &buffRecvProg[0], nBuffRecvProg, HaloType(), recvTask, 0, MPI_COMM_WORLD, &status);
 
 		/* Send also the list of particle shared with each progenitor */
 		MPI_Sendrecv(&buffSendComm[0], nBuffSendProg * nPTypes, MPI_INT, sendTask, 0, 
@@ -730,85 +856,371 @@ void Communication::SyncMergerTreeBuffer()
 }
 
 
-/* This function collects all the non-empty grid nodes and broadcasts them to all the tasks.
- * Some nodes may be shared among several tasks, so we need to be careful when MPI_Gather-ing them.
- * In the end, a list of all the nodes of the grid and the tasks that hold them is shared among all the
- * tasks, so that everytime a task needs to access a chunk of the box knows where it needs to look for it. */
+/* Each task publishes the sorted list of the grid nodes it holds halos on, the lists of all tasks are then 
+ * concatenated on every task with MPI_Allgatherv. Only the occupied nodes are exchanged, so the traffic and the memory
+ * scale with the number of halos rather than with the number of tasks times the N^3 grid nodes.
+ * Some nodes may be shared among several tasks, so the result is kept as a list of (node, task) pairs sorted by node.
+ * In the end, every time a task needs to access a chunk of the box it knows where it needs to look for it. */
 void Communication::BroadcastAndGatherGrid()
 {
-	size_t gridSize = GlobalGrid[iUseCat].nNodes, globalGridSize = 0;
-	vector<int> tmpTaskOnGridNode, allNonZeroTasks, allNonZeroNodes;
-	int nNonZero = 0, thisTask = 0, thisNode = 0;
+	vector<int> nNodesTask(totTask), nodesOffset(totTask), allNodes;
+	int nAllNodes = 0, nLocNodes = 0;
 	
 	if (locTask == 0)
 		cout << "Exchanging node information among tasks..." << endl;
 
+	/* Nodes are sorted and unique on each task, so the concatenated list is already ordered by task */
+	GlobalGrid[iUseCat].SortLocNodes();
+	nLocNodes = GlobalGrid[iUseCat].locNodes.size();
+
+	MPI_Allgather(&nLocNodes, 1, MPI_INT, &nNodesTask[0], 1, MPI_INT, MPI_COMM_WORLD);
+
+	for (int iT = 0; iT < totTask; iT++)
+	{
+		nodesOffset[iT] = nAllNodes;
+		nAllNodes += nNodesTask[iT];
+	}
+
+	allNodes.resize(nAllNodes);
+
+	MPI_Allgatherv(GlobalGrid[iUseCat].locNodes.data(), nLocNodes, MPI_INT, 
+			allNodes.data(), &nNodesTask[0], &nodesOffset[0], MPI_INT, MPI_COMM_WORLD);
+
 	if (locTask == 0)
-		tmpTaskOnGridNode.resize(totTask * gridSize);
-	
-	/* Gather all the nodes on totTask * gridSize array, which can be large, but we need to check for nodes shared between
-	 * several processors so first we collect everything separately. */
-	MPI_Gather(&GlobalGrid[iUseCat].taskOnGridNode[0], gridSize, MPI_INT, 
-			&tmpTaskOnGridNode[0], gridSize, MPI_INT, 0, MPI_COMM_WORLD);
+		cout << "Halo positions on " << nAllNodes << " grid nodes have been shared among all tasks." << endl;
+
+	/* Now assign the task/node connection on every task, sorting by node and then by task */
+	vector<pair<int, int>> nodeTasks(nAllNodes);
+
+	for (int iT = 0; iT < totTask; iT++)
+		for (int iN = nodesOffset[iT]; iN < nodesOffset[iT] + nNodesTask[iT]; iN++)
+			nodeTasks[iN] = make_pair(allNodes[iN], iT);
+
+	vector<int>().swap(allNodes);
+	sort(nodeTasks.begin(), nodeTasks.end());
+
+	GlobalGrid[iUseCat].globalNodes.resize(nAllNodes);
+	GlobalGrid[iUseCat].globalTasks.resize(nAllNodes);
+
+	for (int iN = 0; iN < nAllNodes; iN++)
+	{
+		GlobalGrid[iUseCat].globalNodes[iN] = nodeTasks[iN].first;
+		GlobalGrid[iUseCat].globalTasks[iN] = nodeTasks[iN].second;
+	}
+};
+
+
+/* Optional domain decomposition of a catalog once it has been read. The occupied grid nodes of all the tasks are ordered
+ * along a Hilbert curve, which is cut into one segment per task holding about the same number of particles.
+ * Halos and their particles are then moved to the task owning their node, so that each task holds a compact subvolume 
+ * and the buffer region is reduced to its surface. All the halos of a node end up on the same task. 
+ * The cuts are kept for the following catalogs as long as no task gets more than 25% above the average, so that the
+ * two catalogs compared at each step share the same subvolumes. */
+void Communication::RedistributeHalos()
+{
+	Grid &thisGrid = GlobalGrid[iUseCat];
+	vector<int> nNodesTask(totTask), nodesOffset(totTask);
+	vector<uint64_t> locKeys, locWeights, allKeys, allWeights;
+	int nLocNodes = 0, nAllNodes = 0, nHalos = locHalos[iUseCat].size();
+	uint64_t totWeight = 0;
 
-	/* Loop on all the huge grid to take care of the nodes which might be assigned to several tasks */
 	if (locTask == 0)
+		cout << "Redistributing halos along a space-filling curve..." << endl;
+
+	/* Weight of each local node, all particles of its halos */
+	thisGrid.SortLocNodes();
+	nLocNodes = thisGrid.locNodes.size();
+	locKeys.resize(nLocNodes);
+	locWeights.resize(nLocNodes);
+
+	for (int iN = 0; iN < nLocNodes; iN++)
+	{
+		int thisNode = thisGrid.locNodes[iN];
+
+		locKeys[iN] = thisGrid.HilbertKey(thisNode);
+		locWeights[iN] = 0;
+
+		for (int iH = thisGrid.nodeStart[thisNode]; iH < thisGrid.nodeStart[thisNode + 1]; iH++)
+			locWeights[iN] += locHalos[iUseCat][thisGrid.nodeHalos[iH]].nAllPart();
+	}
+
+	MPI_Allgather(&nLocNodes, 1, MPI_INT, &nNodesTask[0], 1, MPI_INT, MPI_COMM_WORLD);
+
+	for (int iT = 0; iT < totTask; iT++)
+	{
+		nodesOffset[iT] = nAllNodes;
+		nAllNodes += nNodesTask[iT];
+	}
+
+	allKeys.resize(nAllNodes);
+	allWeights.resize(nAllNodes);
+
+	MPI_Allgatherv(locKeys.data(), nLocNodes, MPI_UINT64_T, 
+			allKeys.data(), &nNodesTask[0], &nodesOffset[0], MPI_UINT64_T, MPI_COMM_WORLD);
+	MPI_Allgatherv(locWeights.data(), nLocNodes, MPI_UINT64_T, 
+			allWeights.data(), &nNodesTask[0], &nodesOffset[0], MPI_UINT64_T, MPI_COMM_WORLD);
+
+	/* Sum the weights of the nodes shared among tasks, every task then computes the same cuts */
+	vector<pair<uint64_t, uint64_t>> keyWeights(nAllNodes);
+
+	for (int iN = 0; iN < nAllNodes; iN++)
+		keyWeights[iN] = make_pair(allKeys[iN], allWeights[iN]);
+
+	sort(keyWeights.begin(), keyWeights.end());
+	allKeys.clear();
+	allWeights.clear();
+
+	for (int iN = 0; iN < nAllNodes; iN++)
+	{
+		if (allKeys.size() > 0 && allKeys.back() == keyWeights[iN].first)
+			allWeights.back() += keyWeights[iN].second;
+		else
+		{
+			allKeys.push_back(keyWeights[iN].first);
+			allWeights.push_back(keyWeights[iN].second);
+		}
+
+		totWeight += keyWeights[iN].second;
+	}
+
+	vector<pair<uint64_t, uint64_t>>().swap(keyWeights);
+
+	vector<int> keyTask(allKeys.size());
+	vector<uint64_t> taskWeights(totTask, 0);
+	bool newCuts = (curveCuts.size() != totTask - 1);
+
+	if (!newCuts)
+	{
+		for (int iK = 0; iK < allKeys.size(); iK++)
+			taskWeights[upper_bound(curveCuts.begin(), curveCuts.end(), allKeys[iK]) - curveCuts.begin()] += allWeights[iK];
+
+		newCuts = (*max_element(taskWeights.begin(), taskWeights.end()) * totTask * 4 > totWeight * 5);
+	}
+
+	/* A node belongs to the task whose segment contains the middle of its weight. Tasks are increasing along the curve,
+	 * the cuts are the first keys of each task (or beyond the last key if a task gets nothing) */
+	if (newCuts)
+	{
+		uint64_t cumWeight = 0;
+
+		curveCuts.assign(totTask - 1, UINT64_MAX);
+
+		for (int iK = 0; iK < allKeys.size(); iK++)
+		{
+			int thisTask = (totWeight > 0) ? (2 * cumWeight + allWeights[iK]) * totTask / (2 * totWeight) : 0;
+			thisTask = min(thisTask, totTask - 1);
+
+			for (int iT = thisTask; iT > 0 && curveCuts[iT - 1] == UINT64_MAX; iT--)
+				curveCuts[iT - 1] = allKeys[iK];
+
+			cumWeight += allWeights[iK];
+		}
+	}
+
+	for (int iK = 0; iK < allKeys.size(); iK++)
+		keyTask[iK] = upper_bound(curveCuts.begin(), curveCuts.end(), allKeys[iK]) - curveCuts.begin();
+
+	/* Counts and offsets of the halos, particle numbers and particle IDs to be sent to each task */
+	vector<int> haloTask(nHalos), allTasks(totTask);
+	vector<uint64_t> sendCounts(3 * totTask, 0), recvCounts(3 * totTask);
+	vector<size_t> sendHaloNum(totTask), recvHaloNum(totTask), sendSizeNum(totTask), recvSizeNum(totTask);
+	vector<size_t> sendPartNum(totTask), recvPartNum(totTask);
+
+	for (int iN = 0; iN < nLocNodes; iN++)
 	{
-		for (int j = 0; j < totTask; j++)
-			for (int i = 0; i < gridSize; i++)
+		int thisNode = thisGrid.locNodes[iN];
+		int thisTask = keyTask[lower_bound(allKeys.begin(), allKeys.end(), locKeys[iN]) - allKeys.begin()];
+
+		for (int iH = thisGrid.nodeStart[thisNode]; iH < thisGrid.nodeStart[thisNode + 1]; iH++)
+			haloTask[thisGrid.nodeHalos[iH]] = thisTask;
+	}
+
+	for (int iH = 0; iH < nHalos; iH++)
+	{
+		sendCounts[3 * haloTask[iH]]++;
+
+		for (int iT = 0; iT < locParts[iUseCat][iH].size(); iT++)
+			sendCounts[3 * haloTask[iH] + 2] += locParts[iUseCat][iH][iT].size();
+	}
+
+	for (int iT = 0; iT < totTask; iT++)
+		sendCounts[3 * iT + 1] = sendCounts[3 * iT] * nPTypes;
+
+	MPI_Alltoall(&sendCounts[0], 3, MPI_UINT64_T, &recvCounts[0], 3, MPI_UINT64_T, MPI_COMM_WORLD);
+
+	for (int iT = 0; iT < totTask; iT++)
+	{
+		allTasks[iT] = iT;
+		sendHaloNum[iT] = sendCounts[3 * iT];
+		sendSizeNum[iT] = sendCounts[3 * iT + 1];
+		sendPartNum[iT] = sendCounts[3 * iT + 2];
+		recvHaloNum[iT] = recvCounts[3 * iT];
+		recvSizeNum[iT] = recvCounts[3 * iT + 1];
+		recvPartNum[iT] = recvCounts[3 * iT + 2];
+	}
+
+	vector<size_t> sendHaloOff = Offsets(sendHaloNum), recvHaloOff = Offsets(recvHaloNum);
+	vector<size_t> sendSizeOff = Offsets(sendSizeNum), recvSizeOff = Offsets(recvSizeNum);
+	vector<size_t> sendPartOff = Offsets(sendPartNum), recvPartOff = Offsets(recvPartNum);
+
+	/* Halos keep their order within each destination, the particles are released as soon as they are packed */
+	vector<Halo> sendHalos(sendHaloOff[totTask-1] + sendHaloNum[totTask-1]);
+	vector<int> sendSizes(sendSizeOff[totTask-1] + sendSizeNum[totTask-1]);
+	vector<uint64_t> sendParts(sendPartOff[totTask-1] + sendPartNum[totTask-1]);
+	vector<size_t> haloPos(sendHaloOff), partPos(sendPartOff);
+
+	for (int iH = 0; iH < nHalos; iH++)
+	{
+		int thisTask = haloTask[iH];
+		size_t iS = haloPos[thisTask]++;
+
+		sendHalos[iS] = locHalos[iUseCat][iH];
+
+		/* Particle types which have not been read are sent as empty */
+		for (int iT = 0; iT < nPTypes; iT++)
+		{
+			if (iT >= locParts[iUseCat][iH].size())
 			{
-				thisTask = tmpTaskOnGridNode[i + gridSize * j];
+				sendSizes[iS * nPTypes + iT] = 0;
+				continue;
+			}
 
-				if (thisTask > 0)
-				{
-					allNonZeroTasks.push_back(thisTask);	
-					allNonZeroNodes.push_back(i);	
-				}
-			}	
+			vector<uint64_t> &typeParts = locParts[iUseCat][iH][iT];
 
-		nNonZero = allNonZeroTasks.size();
-	}	// if (locTask == 0)
+			sendSizes[iS * nPTypes + iT] = typeParts.size();
+			copy(typeParts.begin(), typeParts.end(), sendParts.begin() + partPos[thisTask]);
+			partPos[thisTask] += typeParts.size();
+			vector<uint64_t>().swap(typeParts);
+		}
+	}
 
-	MPI_Bcast(&nNonZero, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	locHalos[iUseCat].clear();
+	locHalos[iUseCat].shrink_to_fit();
+	locParts[iUseCat].clear();
+	locParts[iUseCat].shrink_to_fit();
+	locMapParts[iUseCat].clear();
 
-	// Allocate the receiving buffers on all tasks
-	if (locTask != 0)
+	vector<int> recvSizes(recvSizeOff[totTask-1] + recvSizeNum[totTask-1]);
+	vector<uint64_t> recvParts(recvPartOff[totTask-1] + recvPartNum[totTask-1]);
+	locHalos[iUseCat].resize(recvHaloOff[totTask-1] + recvHaloNum[totTask-1]);
+
+	Exchange(sendHalos.data(), sendHaloNum, sendHaloOff, locHalos[iUseCat].data(), recvHaloNum, recvHaloOff, 
+			allTasks, HaloType(), 1);
+	Exchange(sendSizes.data(), sendSizeNum, sendSizeOff, recvSizes.data(), recvSizeNum, recvSizeOff, allTasks, MPI_INT, 2);
+	Exchange(sendParts.data(), sendPartNum, sendPartOff, recvParts.data(), recvPartNum, recvPartOff, 
+			allTasks, MPI_UINT64_T, 3);
+
+	vector<Halo>().swap(sendHalos);
+	vector<uint64_t>().swap(sendParts);
+
+	/* Rebuild the particle lists and maps, then the grid of the catalog */
+	nHalos = locHalos[iUseCat].size();
+	nLocHalos[iUseCat] = nHalos;
+	locParts[iUseCat].resize(nHalos);
+
+	size_t iP = 0;
+
+	for (int iH = 0; iH < nHalos; iH++)
 	{
-		//cout << "Recving: " << nNonZero << " nodes on task " << locTask << endl;
-		allNonZeroTasks.resize(nNonZero);
-		allNonZeroNodes.resize(nNonZero);
+		locParts[iUseCat][iH].resize(nPTypes);
+
+		for (int iT = 0; iT < nPTypes; iT++)
+		{
+			int nTypeParts = recvSizes[iH * nPTypes + iT];
+
+			locParts[iUseCat][iH][iT].assign(recvParts.begin() + iP, recvParts.begin() + iP + nTypeParts);
+			iP += nTypeParts;
+
+			for (auto const& partID : locParts[iUseCat][iH][iT])
+			{
+				Particle thisParticle;
+				thisParticle.haloID = locHalos[iUseCat][iH].ID;
+				thisParticle.type = iT;
+				locMapParts[iUseCat][partID].push_back(thisParticle);
+			}
+		}
 	}
 
-	MPI_Bcast(&allNonZeroNodes[0], nNonZero, MPI_INT, 0, MPI_COMM_WORLD);	
-	MPI_Bcast(&allNonZeroTasks[0], nNonZero, MPI_INT, 0, MPI_COMM_WORLD);	
-	
+	thisGrid.Clean();
+	thisGrid.Init(nGrid, boxSize);
+
+	for (int iH = 0; iH < nHalos; iH++)
+		thisGrid.AssignToGrid(locHalos[iUseCat][iH].X, iH);
+
+	thisGrid.SortLocNodes();
+	thisGrid.SortHalos();
+
+#ifdef VERBOSE
+	cout << "Task=" << locTask << " holds " << nHalos << " halos on " << thisGrid.locNodes.size() << " nodes." << endl;
+#else
 	if (locTask == 0)
-		cout << "Halo positions on the grid nodes have been broadcasted to all tasks." << endl;
+		cout << "Halos redistributed on " << allKeys.size() << " nodes" << (newCuts ? ", with new cuts." : ".") << endl;
+#endif
+};
+
+
+/* Buffer thickness around each local node of grid 0, in cells. A halo of catalog 0 and one of catalog 1 can only share 
+ * particles if their distance is below the sum of their virial radii plus the distance covered by the particles between 
+ * the two snapshots, at most the halo velocity plus its maximum circular velocity. The thickness of a node is the largest 
+ * one of its halos with localBuffer, of all the halos otherwise. A fixed number of bufferCells overrides it. */
+vector<int> Communication::BufferCells(Cosmology &Cosmo, float a0, float a1)
+{
+	Grid &thisGrid = GlobalGrid[0];
+
+	/* Grid::Index only wraps one box length, and half of it on each side already covers the whole box */
+	int maxCells = thisGrid.N / 2;
+	vector<int> nodeCells(thisGrid.locNodes.size(), min(bufferCells, maxCells));
+	vector<float> nodeDist(thisGrid.locNodes.size(), 0.0);
+	float locRVir = 0.0, totRVir = 0.0, locDist = 0.0, totDist = 0.0;
+	float kmToGrid = Cosmo.Displacement(1.0, a0, a1);
+
+	if (bufferCells > 0)
+		return nodeCells;
 
-	/* Now allocate the GLOBAL grid informations and assign the task/node connection on every task */
-	GlobalGrid[iUseCat].globalTaskOnGridNode.resize(gridSize);
+	for (auto const &thisHalo : locHalos[1])
+		locRVir = max(locRVir, thisHalo.rVir);
 
-	for (int i = 0; i < nNonZero; i++)
+	locVmax = 0.0;
+
+	for (int iN = 0; iN < thisGrid.locNodes.size(); iN++)
 	{
-		thisNode = allNonZeroNodes[i];
-		thisTask = allNonZeroTasks[i];
-		GlobalGrid[iUseCat].globalTaskOnGridNode[thisNode].push_back(thisTask);
+		int thisNode = thisGrid.locNodes[iN];
+
+		for (int iH = thisGrid.nodeStart[thisNode]; iH < thisGrid.nodeStart[thisNode + 1]; iH++)
+		{
+			Halo &thisHalo = locHalos[0][thisGrid.nodeHalos[iH]];
+			float vPart = VectorModule(thisHalo.V) + thisHalo.vMax;
+
+			locVmax = max(locVmax, vPart);
+			nodeDist[iN] = max(nodeDist[iN], thisHalo.rVir + vPart * kmToGrid);
+		}
+
+		locDist = max(locDist, nodeDist[iN]);
 	}
 
-	// Release some memory from the buffers 
-	allNonZeroNodes.clear();	allNonZeroNodes.shrink_to_fit();
-	allNonZeroTasks.clear();	allNonZeroTasks.shrink_to_fit();
+	MPI_Allreduce(&locRVir, &totRVir, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD);
+	MPI_Allreduce(&locVmax, &totVmax, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD);
+	MPI_Allreduce(&locDist, &totDist, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD);
+
+	for (int iN = 0; iN < nodeCells.size(); iN++)
+		nodeCells[iN] = min(ceil(((localBuffer ? nodeDist[iN] : totDist) + totRVir) / thisGrid.cellSize), (float) maxCells);
+
+	if (locTask == 0)
+		cout << "Buffer thickness " << totDist + totRVir << " kpc/h (" 
+			<< min(ceil((totDist + totRVir) / thisGrid.cellSize), (float) maxCells) << " cells), max velocity " << totVmax << " km/s, displacement " << totVmax * kmToGrid << " kpc/h." << endl;
+
+	return nodeCells;
 };
 
 
-/* This function communicates the list of nodes that each task needs to send (recv) from every other task
- * Every node keeps track of its nearby halos, these halos are then MPI_Packed and delivered to the tasks 
+/* This function communicates the list of nodes that each task needs to send (recv) from its neighbouring tasks.
+ * Every node keeps track of its nearby halos, these halos are then collected in buffIndexSendHalo for the tasks 
  * that request them. */
 void Communication::ExchangeBuffers()
 {
-	int sizeSendNode = 0, sizeRecvNode = 0, thisNode = 0, sizeSendHalo = 0;
-	int sendTask = 0, recvTask = 0;
-	vector<int> allIndex;
+	int nBuffTasks = buffTasks.size();
+	vector<int> sendNodeNum(nBuffTasks), recvNodeNum(nBuffTasks), sendNodeOff(nBuffTasks, 0), recvNodeOff(nBuffTasks, 0);
+	vector<int> sendNodes, recvNodes;
 	
 	if (locTask == 0)
 		cout << "Gathering buffer information..." << flush;
@@ -824,55 +1236,60 @@ void Communication::ExchangeBuffers()
 	buffIndexSendHalo.resize(totTask);
 	buffIndexNodeHalo.resize(totTask);
 
-	for (int iT = 0; iT < totTask-1; iT++ )
+	for (int iB = 0; iB < nBuffTasks; iB++)
 	{
-		sendTask = sendTasks[iT];
-		recvTask = recvTasks[iT];
+		vector<int> &taskNodes = GlobalGrid[1].buffNodes[buffTasks[iB]];
 
-		{
-			sizeSendNode = GlobalGrid[1].buffNodes[sendTask].size();
+		sendNodeNum[iB] = taskNodes.size();
+		sendNodes.insert(sendNodes.end(), taskNodes.begin(), taskNodes.end());
+	}
 
-			MPI_Sendrecv(&sizeSendNode, 1, MPI_INT, sendTask, 0, 
-			  	     &sizeRecvNode, 1, MPI_INT, recvTask, 0, MPI_COMM_WORLD, &status);
+	MPI_Neighbor_alltoall(NonNull(sendNodeNum), 1, MPI_INT, NonNull(recvNodeNum), 1, MPI_INT, commBuffer);
 
-			/* If a task is sending nodes to another task, then it must also receive some nodes 
-			 * (not the same number in general) */
-			{
-				buffIndexNodeHalo[recvTask].resize(sizeRecvNode);
-				MPI_Sendrecv(&GlobalGrid[1].buffNodes[sendTask][0], sizeSendNode, MPI_INT, sendTask, 0, 
-			                 &buffIndexNodeHalo[recvTask][0], sizeRecvNode, MPI_INT, recvTask, 0, MPI_COMM_WORLD, &status);
+	for (int iB = 1; iB < nBuffTasks; iB++)
+	{
+		sendNodeOff[iB] = sendNodeOff[iB-1] + sendNodeNum[iB-1];
+		recvNodeOff[iB] = recvNodeOff[iB-1] + recvNodeNum[iB-1];
+	}
+
+	if (nBuffTasks > 0)
+		recvNodes.resize(recvNodeOff[nBuffTasks-1] + recvNodeNum[nBuffTasks-1]);
+
+	MPI_Neighbor_alltoallv(NonNull(sendNodes), NonNull(sendNodeNum), NonNull(sendNodeOff), MPI_INT, 
+			NonNull(recvNodes), NonNull(recvNodeNum), NonNull(recvNodeOff), MPI_INT, commBuffer);
+
+	/* Now each task knows which nodes need to be sent and to which task.
+	 * We collect the halo indexes corresponding to all of these nodes */
+	for (int iB = 0; iB < nBuffTasks; iB++)
+	{
+		int recvTask = buffTasks[iB];
+
+		buffIndexNodeHalo[recvTask].assign(recvNodes.begin() + recvNodeOff[iB], 
+				recvNodes.begin() + recvNodeOff[iB] + recvNodeNum[iB]);
 
 #ifdef VERBOSE
-				cout << "Task=" << locTask << " is sending nodes list to=" << recvTask << ", send=" << 
-				 	sizeSendNode << ", recv= " << sizeRecvNode << endl;
+		cout << "Task=" << locTask << " is sending nodes list to=" << recvTask << ", send=" << 
+			sendNodeNum[iB] << ", recv= " << recvNodeNum[iB] << endl;
 #endif
-				/* Now each task knows which nodes need to be sent and to which task.
-				 * We collect the halo indexes corresponding to all of these nodes */
-				for (int iN = 0; iN < buffIndexNodeHalo[recvTask].size(); iN++)
-				{	
-					thisNode = buffIndexNodeHalo[recvTask][iN];
-					allIndex = GlobalGrid[1].haloOnGridNode[thisNode];
-					
-					for (int iH = 0; iH < allIndex.size(); iH++)
-					{
-						buffIndexSendHalo[recvTask].push_back(allIndex[iH]);
-
-						if (buffIndexSendHalo[recvTask][iH] > locHalos[iUseCat].size())
-							cout << "WARNING. On Task=" << locTask << ", toTask=" << recvTask
-								<< ", BuffSize=" << buffIndexSendHalo[iT].size() 
-								<< ", LocHSize=" << locHalos[iUseCat].size() 
-								<< ", IndexSend=" << buffIndexSendHalo[iT][iH] << endl;	
-					}
-				}
+		for (int iN = 0; iN < buffIndexNodeHalo[recvTask].size(); iN++)
+		{	
+			int thisNode = buffIndexNodeHalo[recvTask][iN];
+			
+			for (int iH = GlobalGrid[1].nodeStart[thisNode]; iH < GlobalGrid[1].nodeStart[thisNode + 1]; iH++)
+			{
+				int indexSend = GlobalGrid[1].nodeHalos[iH];
 
+				buffIndexSendHalo[recvTask].push_back(indexSend);
+
+				if (indexSend > locHalos[iUseCat].size())
+					cout << "WARNING. On Task=" << locTask << ", toTask=" << recvTask
+						<< ", BuffSize=" << buffIndexSendHalo[recvTask].size() 
+						<< ", LocHSize=" << locHalos[iUseCat].size() 
+						<< ", IndexSend=" << indexSend << endl;	
 			}
 		}
 	} 
 
-#ifdef VERBOSE
-	cout << "[ TASK = " << locTask << "] has " << buffIndexNodeHalo[recvTask].size() << " on the index list. " << endl;
-#endif
-
 	/* Now every task knows what to send and what to receive from/to every other task */
 	if (locTask == 0)
 		cout << "done." << endl;
@@ -880,6 +1297,48 @@ void Communication::ExchangeBuffers()
 };
 
 
+/* The tasks sharing a buffer region with the local one are those it requests nodes from, and those requesting nodes 
+ * from it. Each task only knows the first ones, a distributed graph with these edges gives it the second ones. 
+ * The buffer is then exchanged on a symmetric graph with the union of the two, built again at each step. */
+void Communication::SetBufferGraph()
+{
+	vector<int> reqTasks, fromTasks, toTasks;
+	MPI_Comm commRequest;
+	int nReq = 0, nFrom = 0, nTo = 0, isWeighted = 0;
+
+	for (int iT = 0; iT < totTask; iT++)
+		if (iT != locTask && GlobalGrid[1].buffNodes.size() > iT && GlobalGrid[1].buffNodes[iT].size() > 0)
+			reqTasks.push_back(iT);
+
+	nReq = reqTasks.size();
+
+	MPI_Dist_graph_create(MPI_COMM_WORLD, 1, &locTask, &nReq, NonNull(reqTasks), MPI_UNWEIGHTED, 
+			MPI_INFO_NULL, 0, &commRequest);
+	MPI_Dist_graph_neighbors_count(commRequest, &nFrom, &nTo, &isWeighted);
+
+	fromTasks.resize(nFrom);
+	toTasks.resize(nTo);
+
+	MPI_Dist_graph_neighbors(commRequest, nFrom, NonNull(fromTasks), MPI_UNWEIGHTED, nTo, NonNull(toTasks), MPI_UNWEIGHTED);
+	MPI_Comm_free(&commRequest);
+
+	buffTasks = reqTasks;
+	buffTasks.insert(buffTasks.end(), fromTasks.begin(), fromTasks.end());
+	sort(buffTasks.begin(), buffTasks.end());
+	buffTasks.erase(unique(buffTasks.begin(), buffTasks.end()), buffTasks.end());
+
+	if (commBuffer != MPI_COMM_NULL)
+		MPI_Comm_free(&commBuffer);
+
+	MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD, buffTasks.size(), NonNull(buffTasks), MPI_UNWEIGHTED, 
+			buffTasks.size(), NonNull(buffTasks), MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &commBuffer);
+
+#ifdef VERBOSE
+	cout << "Task=" << locTask << " exchanges buffers with " << buffTasks.size() << " tasks." << endl;
+#endif
+};
+
+
 /* Each task is sending and receiving to/from multiple task. 
  * Send/recv tasks need to be defined consistently everywhere to ensure correct communication. */
 void Communication::SetSendRecvTasks()
@@ -933,6 +1392,9 @@ void Communication::SetSendRecvTasks()
 
 void Communication::CleanBuffer()
 {
+	if (commBuffer != MPI_COMM_NULL)
+		MPI_Comm_free(&commBuffer);
+
 	if (buffIndexNodeHalo.size() > 0)
 		for (int iN = 0; iN < buffIndexNodeHalo.size(); iN++)
 		{
@@ -17,25 +17,49 @@
 #ifndef COMMUNICATION_H
 #define COMMUNICATION_H
 #include <mpi.h>
+#include <vector>
+#include "Cosmology.h"
+
+/* Largest point-to-point message, well below the 2^31 elements of an int count even for single bytes */
+#define MAX_MSG_BYTES (1 << 30)
 
 
 class Communication {
 
 public:
-	Communication() {};
+	Communication();
 	~Communication();	
 
 #ifndef ZOOM
 	void BroadcastAndGatherGrid(void);
+	void RedistributeHalos(void);
+	vector<int> BufferCells(Cosmology &, float, float);
 	void SyncMergerTreeBuffer(void);
 	void SyncOrphanHalos(void);
 	void GatherMergerTrees(int);
 #endif
 
+	/* The buffer exchange is started by BufferSendRecv and completed by BufferWait */
 	void BufferSendRecv(void);	
+	void BufferWait(void);
 	
 	void CleanBuffer(void);
 
+	/* Transfers of any size. Counts and offsets are in elements of the datatype, the data is sent in point-to-point 
+	 * messages of at most MAX_MSG_BYTES and only between tasks that have something to exchange. 
+	 * PostExchange appends its requests to the list, Exchange also waits for them. */
+	static void PostExchange(const void *, const vector<size_t> &, const vector<size_t> &, void *, const vector<size_t> &, 
+		const vector<size_t> &, const vector<int> &, MPI_Datatype, int, vector<MPI_Request> &);
+	static void Exchange(const void *, const vector<size_t> &, const vector<size_t> &, void *, const vector<size_t> &, 
+		const vector<size_t> &, const vector<int> &, MPI_Datatype, int);
+	static void Bcast(void *, size_t, MPI_Datatype, int);
+
+	// Offsets of a list of counts
+	static vector<size_t> Offsets(const vector<size_t> &);
+
+	// Whole Halo objects, committed on first use
+	static MPI_Datatype HaloType(void);
+
 private:
 	/* Store the send and recv tasks consistently */
 	vector<int> sendTasks;
@@ -43,11 +67,26 @@ private:
 
 #ifndef ZOOM
 	void SetSendRecvTasks(void);
+	void SetBufferGraph(void);
 
 	void ExchangeBuffers(void);
 #endif
 	/* Which nodes lie on which tasks, and which halo they contain */
 	vector<vector<int>> buffIndexNodeHalo;
 	vector<vector<int>> buffIndexSendHalo;
+
+	/* Symmetric graph of the tasks sharing a buffer region at this step */
+	MPI_Comm commBuffer;
+	vector<int> buffTasks;
+
+	/* Buffers of the exchange in progress, the particle IDs of all the requested halos are sent as a single vector */
+	vector<Halo> buffSendHalos, buffRecvHalos;
+	vector<uint64_t> buffSendParts, buffRecvParts;
+	vector<char> buffRecvWanted;
+	vector<MPI_Request> buffRequests;
+	bool isBuffPending;
+
+	/* First Hilbert key of the segment of each task but the first one, kept from one catalog to the next */
+	vector<uint64_t> curveCuts;
 };
 #endif
@@ -127,13 +127,17 @@ float Cosmology::H2t(float t)
 {};
 
 
+/* The a spline gives the age of the universe in Gyr */
 float Cosmology::A2Sec(float a0, float a1)
 {
-	float time;
+	return fabs(a(a1) - a(a0)) * 1.e+3 * Myr2s;
+};
 
-	// function a0, a1
 
-	return time;
+/* Peculiar velocities are converted to comoving coordinates at the mean expansion factor */
+float Cosmology::Displacement(float v, float a0, float a1)
+{
+	return v * A2Sec(a0, a1) / (Mpc2km * 1.e-3) * h / (0.5 * (a0 + a1));
 };
 
 
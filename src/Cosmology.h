@@ -37,6 +37,9 @@ public:
 	void SetArbitrary();	// TODO	
 	
 	float A2Sec(float, float);
+
+	// Comoving distance (kpc/h) covered at a given peculiar velocity (km/s) between two expansion factors
+	float Displacement(float, float, float);
 	float Rho0(float, int);
 	float RhoC(float, int);
 	
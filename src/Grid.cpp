@@ -58,48 +58,13 @@ void Grid::Clean()
 		locNodes.shrink_to_fit();
 	}
 
-	if (taskOnGridNode.size() > 0)
-	{
-		taskOnGridNode.clear();
-		taskOnGridNode.shrink_to_fit();
-	}
+	vector<int>().swap(globalNodes);
+	vector<int>().swap(globalTasks);
 
-	if (globalTaskOnGridNode.size() > 0)
-	{
-
-		for (int iN = 0; iN < globalTaskOnGridNode.size(); iN++)
-		{
-			globalTaskOnGridNode[iN].clear();
-			globalTaskOnGridNode[iN].shrink_to_fit();
-		}
-
-		globalTaskOnGridNode.clear();
-		globalTaskOnGridNode.shrink_to_fit();
-	}
-
-	if (haloOnGridNode.size() > 0)
-	{
-		for (int iN = 0; iN < haloOnGridNode.size(); iN++)
-		{
-			haloOnGridNode[iN].clear();
-			haloOnGridNode[iN].shrink_to_fit();
-		}
-
-		haloOnGridNode.clear();
-		haloOnGridNode.shrink_to_fit();
-	}
-
-	if (buffOnGridNode.size() > 0)
-	{
-		for (int iN = 0; iN < buffOnGridNode.size(); iN++)
-		{
-			buffOnGridNode[iN].clear();
-			buffOnGridNode[iN].shrink_to_fit();
-		}
-
-		buffOnGridNode.clear();
-		buffOnGridNode.shrink_to_fit();
-	}
+	vector<int>().swap(nodeStart);
+	vector<int>().swap(nodeHalos);
+	vector<int>().swap(pointNodes);
+	vector<int>().swap(pointIndex);
 
 	if (buffNodes.size() > 0)
 	{
@@ -127,97 +92,99 @@ void Grid::Init(int n, float size)
 
 	nNodes = N * N * N;
 
-	/* This N^3 vector matrix keeps track on which task holds which part of the grid */
-	taskOnGridNode.resize(nNodes);
-
-	/* This vector holds a list of all halos within a given grid cell */
-	haloOnGridNode.resize(nNodes);
-};
-
-
-int * Grid::Index2Grid(int index)
-{
-	int *iX; iX = new int[3];
-
-	iX[2] = floor(index / (N * N));
-	iX[1] = floor((index - iX[2] * N * N) / N);
-	iX[0] = floor((index - iX[2] * N * N - iX[1] * N));
-
-	return iX;	
+	/* Halos are sorted by cell only once they have all been assigned, start from an empty grid */
+	pointNodes.clear();
+	pointIndex.clear();
+	nodeHalos.clear();
+	nodeStart.assign(nNodes + 1, 0);
 };
 
 
-int Grid::Index(int i, int j, int k)
+void Grid::ListNearbyHalos(float *X, float R, vector<int> &haloIndex)
 {
-	int ii, jj, kk;
-
-	// Add periodic boundary conditions:
-	ii = (i + N) % N; 	jj = (j + N) % N; 	kk = (k + N) % N;
-
-	return (ii + N * jj + N * N * kk);
-};
-
-
-
-vector<int> Grid::ListNearbyHalos(float *X, float R)
-{
-	vector<int> haloIndex;
-
 	float xMax[3], xMin[3];
-	int nHalos, thisNode, indHalo, *ixMax, *ixMin;
+
+	haloIndex.clear();
 
 	for (int iX = 0; iX < 3; iX++)
 	{
 		xMax[iX] = (X[iX] + R);
 		xMin[iX] = (X[iX] - R);
-		//cout << iX << "] max= " << xMax[iX] << ", min= " << xMin[iX] << endl;
 	}
 
-	ixMax = GridCoord(xMax);	
-	ixMin = GridCoord(xMin);	
+	array<int, 3> ixMax = GridCoord(xMax);	
+	array<int, 3> ixMin = GridCoord(xMin);	
 
 	for (int iX = ixMin[0]; iX <= ixMax[0]; iX++)
 		for (int iY = ixMin[1]; iY <= ixMax[1]; iY++)
 			for (int iZ = ixMin[2]; iZ <= ixMax[2]; iZ++)
 			{
-				thisNode = Index(iX, iY, iZ);		
-				nHalos = haloOnGridNode[thisNode].size();
-			
-				for (int iH = 0; iH < nHalos; iH++)
-				{
-					indHalo = haloOnGridNode[thisNode][iH];
+				int thisNode = Index(iX, iY, iZ);		
 
-					/* Beware: indHalo can be positive (halos on the local grid) or negative (halos on the buffer) */
-					haloIndex.push_back(indHalo);
-				
-					//if (indHalo < 0) 
-					//	cout << iH << ", IndHalo: " << indHalo << endl;
-				}
+				/* Beware: indHalo can be positive (halos on the local grid) or negative (halos on the buffer) */
+				haloIndex.insert(haloIndex.end(), nodeHalos.begin() + nodeStart[thisNode], 
+						nodeHalos.begin() + nodeStart[thisNode + 1]);
 			}
-
-	return haloIndex;
 };
 
 
 
-int * Grid::GridCoord(float *X)
+/* Skilling's algorithm (AIP Conf. Proc. 707, 381, 2004): the grid coordinates are transformed in place into the 
+ * transposed Hilbert index, whose bits are then interleaved into a single key */
+uint64_t Grid::HilbertKey(int index) const
 {
-	int * iX; iX = new int[3]; 
-	
-	for (int i = 0; i<3; i++)
-		iX[i] = floor(X[i] / cellSize);
+	array<int, 3> iX = Index2Grid(index);
+	uint32_t X[3] = { (uint32_t) iX[0], (uint32_t) iX[1], (uint32_t) iX[2] };
+	uint32_t M, P, Q, T;
+	uint64_t thisKey = 0;
+	int nBits = 1;
 
-	return iX;
-};
+	while ((1 << nBits) < N)
+		nBits++;
+
+	M = 1u << (nBits - 1);
+
+	/* Inverse undo */
+	for (Q = M; Q > 1; Q >>= 1)
+	{
+		P = Q - 1;
+
+		for (int i = 0; i < 3; i++)
+			if (X[i] & Q)
+				X[0] ^= P;
+			else
+			{
+				T = (X[0] ^ X[i]) & P;
+				X[0] ^= T;
+				X[i] ^= T;
+			}
+	}
+
+	/* Gray encode */
+	for (int i = 1; i < 3; i++)
+		X[i] ^= X[i-1];
+
+	T = 0;
 
+	for (Q = M; Q > 1; Q >>= 1)
+		if (X[2] & Q)
+			T ^= Q - 1;
+
+	for (int i = 0; i < 3; i++)
+		X[i] ^= T;
+
+	for (int iB = nBits - 1; iB >= 0; iB--)
+		for (int i = 0; i < 3; i++)
+			thisKey = (thisKey << 1) | ((X[i] >> iB) & 1);
+
+	return thisKey;
+};
 
 
 void Grid::FindNearbyNodes(int index, int nCells)
 {
 	int thisIndex, thisTask;
-	int *iX, *jX; jX = new int[3]; 
-
-	iX = Index2Grid(index);
+	array<int, 3> iX = Index2Grid(index), jX;
 
 	/* Periodic boundary conditions are taken care of by the Index() function, no need to implement them here */
 	for (int i = -nCells; i < nCells+1; i++)
@@ -234,13 +201,15 @@ void Grid::FindNearbyNodes(int index, int nCells)
 				thisIndex = Index(jX[0], jX[1], jX[2]);
 
 				/* There might be nodes shared among several tasks, so we have to loop here */
-				for (int l = 0; l < globalTaskOnGridNode[thisIndex].size(); l++)
+				int iFirst = lower_bound(globalNodes.begin(), globalNodes.end(), thisIndex) - globalNodes.begin();
+
+				for (int l = iFirst; l < globalNodes.size() && globalNodes[l] == thisIndex; l++)
 				{
-						thisTask = globalTaskOnGridNode[thisIndex][l] -1;
+					thisTask = globalTasks[l];
 
 					// Only add the task to the communication buffer if the node is not already there
-					if (thisTask != locTask && thisTask > -1)
-							buffNodes[thisTask].push_back(thisIndex);	
+					if (thisTask != locTask)
+						buffNodes[thisTask].push_back(thisIndex);	
 				}
 			}
 		}
@@ -257,16 +226,37 @@ void Grid::SortLocNodes()
 
 void Grid::AssignToGrid(float *X, int index)
 {
-	int *iX, thisNode = 0;
-	iX = new int[3];	
+	array<int, 3> iX = GridCoord(X);
+	int thisNode = Index(iX[0], iX[1], iX[2]);
 
-	iX = GridCoord(X);
-	thisNode = Index(iX[0], iX[1], iX[2]);
-	haloOnGridNode[thisNode].push_back(index);	// index is positive for locHalos and negative for locBuffHalos
-	taskOnGridNode[thisNode] = locTask + 1;		// Add one to distinguish from empty node (locTask = 0 has to be one, so that taskOnGridNode[] = 0 means no task is readin that)
+	pointNodes.push_back(thisNode);
+	pointIndex.push_back(index);			// index is positive for locHalos and negative for locBuffHalos
 
 	locNodes.push_back(thisNode);
-	free(iX);
+};
+
+
+/* Counting sort of all the halos assigned so far: count the halos per node, turn the counts into offsets, then place 
+ * each index at its offset. The order of AssignToGrid is kept within each node, and the offsets used as cursors are 
+ * shifted back at the end so that no other array is needed */
+void Grid::SortHalos()
+{
+	nodeStart.assign(nNodes + 1, 0);
+	nodeHalos.resize(pointNodes.size());
+
+	for (int iP = 0; iP < pointNodes.size(); iP++)
+		nodeStart[pointNodes[iP] + 1]++;
+
+	for (int iN = 0; iN < nNodes; iN++)
+		nodeStart[iN + 1] += nodeStart[iN];
+
+	for (int iP = 0; iP < pointNodes.size(); iP++)
+		nodeHalos[nodeStart[pointNodes[iP]]++] = pointIndex[iP];
+
+	for (int iN = nNodes; iN > 0; iN--)
+		nodeStart[iN] = nodeStart[iN - 1];
+
+	nodeStart[0] = 0;
 };
 
 
@@ -276,19 +266,17 @@ void Grid::AssignToGrid(float *X, int index)
  * It loops on all the nodes already allocated and identifies all the neighbouring nodes within 
  * a radius of maxBufferThick size.
  * useNodes is a collection of nodes at a different snapshot. The grid might be allocated differently 
- * among the tasks at each snapshot so we compare e.g. the local nodes at 0 with those at 1 to find the buffer
+ * among the tasks at each snapshot so we compare e.g. the local nodes at 0 with those at 1 to find the buffer.
+ * useCells is the buffer thickness around each of them, see Communication::BufferCells
  */
-void Grid::FindBufferNodes(vector<int> useNodes)
+void Grid::FindBufferNodes(const vector<int> &useNodes, const vector<int> &useCells)
 {
-	int nCells = 1;		// TODO find a way to select the number of buffer cells!!!!!	FIXME TODO 
-				// Edit: test with 1,2 or 3 seem to give the same results...
-
 	if (buffNodes.size() == 0)
 		buffNodes.resize(totTask);
 
 	// Do a loop on all the nodes contained in this task to find out which nodes need to be communicated
 	for (int i = 0; i < useNodes.size(); i++)
-		FindNearbyNodes(useNodes[i], nCells);		
+		FindNearbyNodes(useNodes[i], useCells[i]);		
 
 	/*	Clean Buffer Nodes	*/
 	for (int i = 0; i < totTask; i++)
@@ -303,7 +291,7 @@ void Grid::FindBufferNodes(vector<int> useNodes)
 void Grid::Info()
 {
 
-	cout << "Task=" << locTask << " has " << locNodes.size() << " loc nodes, out of " << globalTaskOnGridNode.size() << endl;	
+	cout << "Task=" << locTask << " has " << locNodes.size() << " loc nodes, out of " << globalNodes.size() << " occupied" << endl;	
 //	int *ixMax, *ixMin;
 //	ixMax = new int[3];	ixMin = new int[3];	
 /*
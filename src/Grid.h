@@ -20,6 +20,8 @@
 
 #include <math.h>
 #include <vector>
+#include <array>
+#include <cstdint>
 
 using namespace std;
 
@@ -44,28 +46,48 @@ public:
 	// Sort and clean the nodes number assigned locally to each task
 	void SortLocNodes(void);
 
-	// This function determines the nodes placed on different tasks required for the buffer region
-	void FindBufferNodes(vector<int>);	
+	// This function determines the nodes placed on different tasks required for the buffer region, given the number of
+	// buffer cells around each node
+	void FindBufferNodes(const vector<int> &, const vector<int> &);	
 
 	// This assigns a coordinate to the grid, and stores the id associated to the point in the node
 	void AssignToGrid(float *, int);	
 
+	// Once all the halos have been assigned, sort their indexes by node into nodeStart and nodeHalos
+	void SortHalos(void);
+
 	// Given a node index find all the neighbouring nodes
 	void FindNearbyNodes(int, int); 	
 
-	int Index(int, int, int);	// Given i, j, k determine their position in the array
-	int * Index2Grid(int);		// Given and index, i, j, k it position in grid coordinates
-	int * GridCoord(float *);	// Given x, y, z determine their position in the array in grid coordinates
+	// Given i, j, k determine their position in the array, with periodic boundary conditions
+	inline int Index(int i, int j, int k) const
+	{
+		return ((i + N) % N) + N * ((j + N) % N) + N * N * ((k + N) % N);
+	};
+
+	// Given an index, its i, j, k position in grid coordinates
+	inline array<int, 3> Index2Grid(int index) const
+	{
+		return {{index % N, (index / N) % N, index / (N * N)}};
+	};
+
+	// Given x, y, z determine their position in grid coordinates
+	inline array<int, 3> GridCoord(const float *X) const
+	{
+		return {{(int) floor(X[0] / cellSize), (int) floor(X[1] / cellSize), (int) floor(X[2] / cellSize)}};
+	};
 
-	/* This functions returns a list of the haloes contained within a given volume around a point inside the box */
-	vector<int> ListNearbyHalos(float *, float);
+	// Position of a node along a Hilbert curve covering the grid, neighbouring keys are neighbouring nodes
+	uint64_t HilbertKey(int) const;
 
-	// Some tasks may share parts of the same node, so take care of them separately in a vector of vectors
-	// This variable tracks the task number that is storing halos on a given grid node
-	vector<vector<int>> globalTaskOnGridNode;	
+	/* List the haloes contained within a given volume around a point inside the box. The vector is cleared first, 
+	 * so that it can be reused across calls without reallocating */
+	void ListNearbyHalos(float *, float, vector<int> &);
 
-	// This variable tracks the task number that is storing halos on a given grid node
-	vector<int> taskOnGridNode;	
+	/* Tasks storing halos on each occupied grid node, as (globalNodes[i], globalTasks[i]) pairs sorted by node and task.
+	 * Some tasks may share parts of the same node, in that case the node appears once per task */
+	vector<int> globalNodes;
+	vector<int> globalTasks;
 
 	// This variable keeps track of the grid nodes stored on the local task - it only stores the index
 	vector<int> locNodes;
@@ -73,11 +95,15 @@ public:
 	// Contains a list of all tasks, for each task saves a vector containing all the indexes	
 	vector<vector<int>> buffNodes;	
 
-	// For each grid node, store the (local) list of halos (indexes of locHalos)
-	vector<vector<int>> haloOnGridNode;	
+	/* Halos sorted by grid node, after SortHalos(): the halos of node iN are nodeHalos[nodeStart[iN]] up to 
+	 * nodeHalos[nodeStart[iN+1]-1]. Indexes are positive for locHalos and negative for the buffer halos */
+	vector<int> nodeStart;
+	vector<int> nodeHalos;
 
-	// For each grid node, store the list of halos in the buffer (indexes of buffHalos)
-	vector<vector<int>> buffOnGridNode;	
+private:
+	// Node and index of each assigned halo, in the order of AssignToGrid
+	vector<int> pointNodes;
+	vector<int> pointIndex;
 };
 
 #endif
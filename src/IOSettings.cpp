@@ -32,27 +32,37 @@
 #include <memory>
 #include <stdexcept>
 #include <map>
+#include <functional>
+#include <cstring>
 
 #include "Cosmology.h"
+#include "CatalogReader.h"
+#include "TreeFile.h"
+#include "TreeDatabase.h"
+#include "TreeForest.h"
+#include "LinkCache.h"
+#include "Communication.h"
 #include "IOSettings.h"
 #include "utils.h"
 #include "spline.h"
 #include "global_vars.h"
 
-#ifdef IDADD
-#define idADD 1000000000
-#endif
-
 using namespace std;
 
 
 IOSettings::IOSettings() 
 {
+	catBuffer.Clean();
+	writeStop = false;
+	lastCheckpoint = 0;
+	linkKey = 0;
 };
 
 
 IOSettings::~IOSettings() 
 {
+	WaitPrefetch();
+	FlushTrees();
 };
 
 
@@ -154,6 +164,24 @@ void IOSettings::InitFromCfgFile(vector<string> arg)
 	else if (arg[0] == "haloSuffix") 	haloSuffix = arg[1];
 	else if (arg[0] == "partSuffix") 	partSuffix = arg[1];
 	else if (arg[0] == "outSuffix")		outSuffix = arg[1];
+	else if (arg[0] == "outFormat")		outFormat = arg[1];
+	else if (arg[0] == "writeQueue")	writeQueue = stoi(arg[1]);
+	else if (arg[0] == "outSingleFile")	outSingleFile = stoi(arg[1]);
+	else if (arg[0] == "outDatabase")	outDatabase = arg[1];
+	else if (arg[0] == "simuCode")		simuCode = arg[1];
+	else if (arg[0] == "pathCache")		pathCache = arg[1];
+	else if (arg[0] == "minPartDatabase")	minPartDatabase = stoi(arg[1]);
+	else if (arg[0] == "minPartHistory")	minPartHistory = stoi(arg[1]);
+	else if (arg[0] == "smoothHistory")	smoothHistory = stoi(arg[1]);
+	else if (arg[0] == "outForest")		outForest = stoi(arg[1]);
+	else if (arg[0] == "minPartForest")	minPartForest = stoi(arg[1]);
+	else if (arg[0] == "checkpointStep")	checkpointStep = stoi(arg[1]);
+	else if (arg[0] == "restartStep")	restartStep = stoi(arg[1]);
+	else if (arg[0] == "compressCheckpoint")	compressCheckpoint = stoi(arg[1]);
+	else if (arg[0] == "redistributeHalos")	redistributeHalos = stoi(arg[1]);
+	else if (arg[0] == "bufferCells")	bufferCells = stoi(arg[1]);
+	else if (arg[0] == "localBuffer")	localBuffer = stoi(arg[1]);
+	else if (arg[0] == "nBufferRanges")	nBufferRanges = stoi(arg[1]);
 	else if (arg[0] == "haloPrefix") 	haloPrefix = arg[1];
 	else if (arg[0] == "partPrefix") 	partPrefix = arg[1];
 	else if (arg[0] == "outPrefix")		outPrefix = arg[1];
@@ -172,6 +200,15 @@ void IOSettings::InitFromCfgFile(vector<string> arg)
 	else if (arg[0] == "pathOutput")	pathOutput = arg[1];
 	else if (arg[0] == "nTreeChunks")	nTreeChunks = stoi(arg[1]);
 	else if (arg[0] == "cosmologicalModel")	cosmologicalModel = arg[1];
+	else if (arg[0] == "prefetchMemory")	prefetchMemory = stoi(arg[1]);
+	else if (arg[0] == "minPartRead")	minPartRead = stoi(arg[1]);
+	else if (arg[0] == "minMhiresRead")	minMhiresRead = stof(arg[1]);
+	else if (arg[0] == "minMassRead")	minMassRead = stof(arg[1]);
+	else if (arg[0] == "partIndex")		partIndex = stoi(arg[1]);
+	else if (arg[0] == "nReadThreads")	nReadThreads = stoi(arg[1]);
+	else if (arg[0] == "nMatchThreads")	nMatchThreads = stoi(arg[1]);
+	else if (arg[0] == "runMode")		runMode = stoi(arg[1]);
+	else if (arg[0] == "pathTree")		pathTree = arg[1];
 	else cout << "Arg= " << arg[0] << " is useless or redundant and will be ignored." << endl;
 
 	/* Just issue a warning here, in case some parameter has not been set correctly. */
@@ -405,28 +442,144 @@ void IOSettings::Init()
 	MPI_Bcast(&aFactors[0], nSnaps, MPI_FLOAT, 0, MPI_COMM_WORLD);
 	MPI_Bcast(&numSnaps[0], nSnaps, MPI_INT, 0, MPI_COMM_WORLD);
 
-	if (inputFormat == "AHF")
+	CatalogReader *testReader = CatalogReader::New(inputFormat);
+
+	if (testReader != nullptr)
 	{
 		if (locTask == 0)
 			cout << "Using " << inputFormat << " file format." << endl;
 
-	} else if (inputFormat == "FoF") {
+		delete testReader;
+
+	} else {
 
 		if (locTask == 0)
 			cout << "Format " << inputFormat << " is not supported yet. Exiting..." << endl;
 
 		MPI_Finalize();
 		exit(0);
+	};
 
-	} else {
-
+	if (outFormat != "" && outFormat != "ascii" && outFormat != "binary")
+	{
 		if (locTask == 0)
-			cout << "Format " << inputFormat << " is not supported yet. Exiting..." << endl;
+			cout << "Output format " << outFormat << " is not supported. Exiting..." << endl;
 
 		MPI_Finalize();
 		exit(0);
 	};
 
+	/* The trees are read from pathOutput unless a different folder is given */
+	if (pathTree == "" || pathTree == "pathOutput")
+		pathTree = pathOutput;
+
+	if (runMode != 0 && runMode != 1)
+	{
+		if (locTask == 0)
+			cout << "runMode = " << runMode << " is not supported, use 0 (build the trees) or 1 (post-process them). Exiting..." 
+				<< endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+
+	/* The trees read back are rewritten to pathOutput, and are spread over the tasks by main halo ID */
+	if (runMode == 1)
+	{
+		if (pathTree == pathOutput)
+		{
+			if (locTask == 0)
+				cout << "runMode = 1 writes the trees to pathOutput, which has to differ from pathTree. Exiting..." << endl;
+
+			MPI_Finalize();
+			exit(0);
+		}
+
+		if ((minPartHistory > 0 || outForest || outDatabase != "") && totTask > 1)
+		{
+			if (locTask == 0)
+				cout << "minPartHistory, outForest and outDatabase require a single task with runMode = 1. Exiting..." << endl;
+
+			MPI_Finalize();
+			exit(0);
+		}
+
+		if ((minPartHistory > 0 || outForest || outDatabase != "") && locTask == 0)
+			cout << "WARNING: tree files only store halo IDs, particle numbers and links, the masses, positions and velocities "
+				<< "of the histories, forest and database are not set with runMode = 1." << endl;
+	}
+
+	/* The main branches and the forests are followed across snapshots, so all the trees of a snapshot have to be on the same task */
+#if !defined(ZOOM) && !defined(GATHER_TREES)
+	if ((minPartHistory > 0 || outForest || outDatabase != "") && totTask > 1)
+	{
+		if (locTask == 0)
+			cout << "minPartHistory, outForest and outDatabase require the GATHER_TREES option when running on more than one task. Exiting..." << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+#endif
+
+	if (outDatabase != "")
+	{
+#ifndef SQLITE_OUTPUT
+		if (locTask == 0)
+			cout << "outDatabase requires compiling with -DSQLITE_OUTPUT. Exiting..." << endl;
+
+		MPI_Finalize();
+		exit(0);
+#endif
+		if (locTask == 0)
+			treeDatabase.Init(pathOutput + outDatabase, simuCode, nSnapsUse - 1, minPartDatabase);
+	}
+
+	/* The cached connections replace the buffer exchange, which the non-gathered trees still need afterwards */
+#if !defined(ZOOM) && !defined(GATHER_TREES)
+	if (pathCache != "")
+	{
+		if (locTask == 0)
+			cout << "pathCache requires the ZOOM or GATHER_TREES options. Exiting..." << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+#endif
+
+#ifdef ZOOM
+	if (redistributeHalos)
+	{
+		if (locTask == 0)
+			cout << "redistributeHalos cannot be used with the ZOOM option. Exiting..." << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+#endif
+
+	if (restartStep < 0 || restartStep >= nSnapsUse)
+	{
+		if (locTask == 0)
+			cout << "restartStep has to be between 1 and nSnapsUse - 1. Exiting..." << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+
+#ifndef GZIP_INPUT
+	if (compressCheckpoint)
+	{
+		if (locTask == 0)
+			cout << "compressCheckpoint requires compiling with -DGZIP_INPUT. Exiting..." << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+#endif
+
+	if (outForest && locTask == 0)
+		treeForest.Init(pathOutput + outPrefix + "trees.forest", numSnaps, minPartForest);
+
 	// Convert integerts to snapshot strings on each task, it is easier than MPI_Bcast all those chars
 	if (locTask != 0)
 	{
@@ -550,20 +703,10 @@ void IOSettings::DistributeFilesAmongTasks(void)
 /* Particle sizes have already been allocated in the ReadHalos() routines, do a safety check for the size */
 void IOSettings::ReadParticles(void)
 {
-	int iTmpParts = 0, iLocParts = 0, iLine = 0, nPartHalo = 0, partType = 0, iPartMulti = 0;
-	unsigned int nFileHalos = 0, iLocHalos = 0, iTmpHalos = 0;
-	uint64_t locHaloID = 0, partID = 0;
-	vector<vector<uint64_t>> tmpParts;
-	string tmpStrUrlPart, lineIn;
-	const char *tmpUrlPart;
-
 #ifdef VERBOSE
 	cout << "onTask=" << locTask << " part size: " << locParts[iUseCat].size() << endl;
 #endif
 
-	tmpParts.resize(nPTypes);
-
-	locParts[iUseCat].resize(nLocHalos[iUseCat]);
 	nLocChunks = haloFiles[iNumCat].size();
 
 	//cout << locTask << ") Reading particles for n halos = " << nLocHalos[iUseCat] << " nP: " << locParts[iUseCat].size() << endl;
@@ -576,118 +719,33 @@ void IOSettings::ReadParticles(void)
 	if (locTask == 0)
 	{
 #endif
+	/* The halos have already been moved to locHalos by ReadHalos(), the buffer might still hold prefetched particles */
+	if (catBuffer.iCat != iNumCat)
+		catBuffer.Clean();
 
-	for (int iChunk = 0; iChunk < nLocChunks; iChunk++)
-	{
-		tmpUrlPart = partFiles[iNumCat][iChunk].c_str();
-		ifstream fileIn(tmpUrlPart);
-
-		/* Reset temporary variables */
-		iTmpParts = 0;
-		iTmpHalos = 0;
-		iLine = 0;
-
-		if (!fileIn.good())
-		{
-			cout << "ERROR: File " << tmpUrlPart << " not found on task=" << locTask << endl;
-			exit(0);
-		} else {
-			if (locTask == 0 && iChunk == 0)
-	        		cout << "Reading particle file: " << tmpUrlPart << endl;
-		}
-
-		while (getline(fileIn, lineIn))
-		{
-			const char *lineRead = lineIn.c_str();		
-			
-			if (iLine == 0)
-			{
-		         	sscanf(lineRead, "%d", &nFileHalos);
-				iLine++;
+	catBuffer.iCat = iNumCat;
+	catBuffer.parts.resize(nLocHalos[iUseCat]);
 
-			} else if (iLine == 1) {
-
-		        	sscanf(lineRead, "%u %lu", &nPartHalo, &locHaloID);
-#ifdef IDADD
-				if (locHaloID < idADD)
-					locHaloID += idADD;
-#endif
-
-#ifdef ZOOM
-			if (locHalos[iUseCat][iLocHalos].ID == locHaloID)
-#endif
-				locParts[iUseCat][iLocHalos].resize(nPTypes);
-				iLine++;
-			} else {
-#ifdef NOPTYPE
-	        	        sscanf(lineRead, "%lu", &partID);
-				partType = 1;
-#else	
-	        	        sscanf(lineRead, "%lu %d", &partID, &partType);
-#endif
-				Particle thisParticle;
-				thisParticle.haloID = locHaloID;
-				thisParticle.type   = partType;
-		
-				locMapParts[iUseCat][partID].push_back(thisParticle);
-		
-				if (locMapParts[iUseCat][partID].size() > 1)
-					iPartMulti++;
+	for (int iChunk = catBuffer.nPartChunks; iChunk < nLocChunks; iChunk++)
+		ReadParticleChunk(iNumCat, iChunk, locHalos[iUseCat], catBuffer);
 
-				tmpParts[partType].push_back(partID);
-				iTmpParts++;
-				iLocParts++;
+	locParts[iUseCat].swap(catBuffer.parts);
 
-				if (iTmpParts == nPartHalo)
-				{	
+	if (locMapParts[iUseCat].size() == 0)
+	{
+		locMapParts[iUseCat].swap(catBuffer.mapParts);
+	} else {
+		for (auto &thisMap : catBuffer.mapParts)
+			locMapParts[iUseCat][thisMap.first].insert(locMapParts[iUseCat][thisMap.first].end(), 
+					thisMap.second.begin(), thisMap.second.end());
+	}
 
-					/* Sort the ordered IDs */
-					for (int iT = 0; iT < nPTypes; iT++)
-					{
-						if (tmpParts[iT].size() > 0)
-						{
-#ifdef ZOOM
-							if (locHalos[iUseCat][iLocHalos].ID == locHaloID)
-							{
-#endif
-								//cout << locTask << " " << tmpParts[iT].size() << endl;
-								sort(tmpParts[iT].begin(), tmpParts[iT].end());
-						
-								locParts[iUseCat][iLocHalos][iT].insert(
-										locParts[iUseCat][iLocHalos][iT].end(), 
-											tmpParts[iT].begin(), tmpParts[iT].end());
-
-								//cout << locTask << " " << locParts[iUseCat][iLocHalos][iT][0] << endl;
-#ifdef ZOOM
-							} // Zoom mode, making sure the current halo is in the list of the high-res ones
+#ifdef VERBOSE
+	cout << " N particles: " << locMapParts[iUseCat].size() << " iLocParts: " << catBuffer.nParts << " Duplicates: " 
+		<< catBuffer.nPartMulti << " total: " << locMapParts[iUseCat].size() + catBuffer.nPartMulti << endl;
 #endif
-							// Clean the temporary read-in buffer
-							tmpParts[iT].clear();
-							tmpParts[iT].shrink_to_fit();
-						}
-					}
 
-#ifdef ZOOM
-					if (locHalos[iUseCat][iLocHalos].ID == locHaloID)
-#endif
-						iLocHalos++;
-
-					// Set/reset some counters
-					iTmpParts = 0;
-					iTmpHalos++;
-
-					// Check if all of the halos in the current file chunk have been read in
-					if (iTmpHalos == nFileHalos)
-					{
-						iTmpHalos = 0;
-						iLine = 0;	
-					} else {
-						iLine = 1;	
-					}
-				}
-			} // else iLine not 0 or 1
-		} // end while
-	} // End for loop on file chunks
+	catBuffer.Clean();
 
 #ifdef ZOOM
 	/* There is no actual loop but we close the reading of the file on task 0 */
@@ -698,386 +756,717 @@ void IOSettings::ReadParticles(void)
 #endif
 	}	
 #endif
-
-//cout << iUseCat << " N particles: " << locMapParts[iUseCat].size() << " iLocParts: " << iLocParts << " Duplicates: " << iPartMulti
-//		<< " total: " << locMapParts[iUseCat].size() + iPartMulti << endl;
-#ifdef VERBOSE
-	cout << " N particles: " << locMapParts[iUseCat].size() << " iLocParts: " << iLocParts << " Duplicates: " << iPartMulti
-		<< " total: " << locMapParts[iUseCat].size() + iPartMulti << endl;
-#endif
 };
- 
 
-/* Using AHF by default */
-void IOSettings::ReadHalos()
+
+/* Read one particle file chunk into the buffer. 
+ * The halos of the chunk must be already in the halos vector, in the same order as in the particle file.
+ * If the file has a block index, it is split at halo boundaries among nReadThreads threads, each parsing its own range
+ * of blocks; the blocks are then stored in the same order as in the file */
+void IOSettings::ReadParticleChunk(int iCat, int iChunk, vector<Halo> &halos, CatalogBuffer &buffer)
 {
-	unsigned int nPartHalo = 0, nPTypes = 0, iTmpHalos = 0, nTmpHalos = 0, iChunk = 0, iLocHalos = 0; 
-	const char *tmpUrlHalo, *lineHead = "#";
-	string tmpStrUrlHalo, lineIn;
-	vector<Halo> tmpHalos;
+	int nPartHalo = 0;
+	uint64_t locHaloID = 0;
+	vector<uint64_t> blockIDs;
+	vector<int> blockTypes;
+	const char *tmpUrlPart;
 
-#ifdef ZOOM	/* Only read on one task */
-	if (locTask == 0)
-	{
-#endif
+	tmpUrlPart = partFiles[iCat][iChunk].c_str();
+	CatalogReader *fileIn = CatalogReader::New(inputFormat);
 
-#ifdef VERBOSE
-	cout << "onTask=" << locTask << " halo size: " << locHalos[iUseCat].size() << endl;
-#endif
+	if (!fileIn->OpenParticles(tmpUrlPart))
+	{
+		cout << "ERROR: File " << tmpUrlPart << " not found on task=" << locTask << endl;
+		exit(0);
+	} else {
+		if (locTask == 0 && iChunk == 0)
+	        	cout << "Reading particle file: " << tmpUrlPart << endl;
+	}
 
-	nLocChunks = haloFiles[iNumCat].size();
-	//cout << locTask << ", " << iNumCat << ", " << nLocChunks << endl;
+	PartIndex *index = fileIn->Index();
 
-	for (int iChunk = 0; iChunk < nLocChunks; iChunk++)
+	if (nReadThreads > 1 && index != nullptr && index->Size() > 1)
 	{
-		tmpUrlHalo = haloFiles[iNumCat][iChunk].c_str();
-		nTmpHalos = NumLines(tmpUrlHalo);	
-		tmpHalos.resize(nTmpHalos); 
-		iTmpHalos = 0;
+		int nThreads = min(nReadThreads, (int) index->Size()), iThread = 1;
+		size_t nAllParts = 0, nSumParts = 0;
+		vector<size_t> firstBlock(nThreads + 1, index->Size());
+		vector<vector<ParticleBlock>> threadBlocks(nThreads);
+		vector<thread> readThreads;
 
-		ifstream fileIn(tmpUrlHalo);
-	
-		if (!fileIn.good())
+		/* Split the blocks so that each thread reads roughly the same number of particles */
+		for (size_t iB = 0; iB < index->Size(); iB++)
+			nAllParts += index->nParts[iB];
+
+		firstBlock[0] = 0;
+
+		for (size_t iB = 0; iB < index->Size() && iThread < nThreads; iB++)
 		{
-			cout << "File: " << tmpUrlHalo << " not found on task=" << locTask << endl;
-			exit(0);
-		} else { 
-			if (locTask == 0 && iChunk == 0)
-	       			cout << "Reading " << nTmpHalos << " halos from file: " << tmpUrlHalo << endl;
+			nSumParts += index->nParts[iB];
+
+			if (nSumParts * nThreads >= nAllParts * iThread)
+				firstBlock[iThread++] = iB + 1;
 		}
 
-		while (getline(fileIn, lineIn))
-		{
-			const char *lineRead = lineIn.c_str();		
-		
-			if (lineRead[0] != lineHead[0])
-			{
-#ifdef AHF_CB
-				ReadLineAHF_CB(lineRead, &tmpHalos[iTmpHalos]);
-#else
-				ReadLineAHF(lineRead, &tmpHalos[iTmpHalos]);
-#endif
+		fileIn->Close();
 
-				nPartHalo = tmpHalos[iTmpHalos].nPart[nPTypes];	// All particle types!
-#ifndef ZOOM
-				// Assign halo to its nearest grid point - assign the absolute local index number
-				// Halos on the local chunk have POSITIVE index, halos on the buffer NEGATIVE 
-				GlobalGrid[iUseCat].AssignToGrid(tmpHalos[iTmpHalos].X, iLocHalos);
-#endif
-				iLocHalos++;
-				iTmpHalos++;
-			}
-		}	/* While Read Line */
+		for (int iT = 0; iT < nThreads; iT++)
+			readThreads.push_back(thread(&IOSettings::ReadBlockRange, this, partFiles[iCat][iChunk], 
+						firstBlock[iT], firstBlock[iT+1], ref(buffer.skipIDs), ref(threadBlocks[iT])));
 
-		fileIn.close();
+		for (int iT = 0; iT < nThreads; iT++)
+			readThreads[iT].join();
+
+		for (int iT = 0; iT < nThreads; iT++)
+		{
+			for (auto &thisBlock : threadBlocks[iT])
+				if (!StoreParticleBlock(thisBlock.haloID, thisBlock.partIDs, thisBlock.partTypes, halos, buffer))
+				{
+					cout << "ERROR: particle type out of range (nPTypes=" << nPTypes << ") in " << tmpUrlPart 
+						<< " on task=" << locTask << endl;
+					exit(0);
+				}
 
-#ifdef ZOOM	/* When in ZOOM mode ONLY! store the high density region halos */
-		iLocHalos = 0;
+			threadBlocks[iT].clear();
+			threadBlocks[iT].shrink_to_fit();
+		}
+
+	} else {
 
-		for (int iH = 0; iH < tmpHalos.size(); iH++)
+		while (fileIn->NextBlock(locHaloID, nPartHalo))
 		{
-			locHalos[iUseCat].push_back(tmpHalos[iH]);
-			iLocHalos++;
+			/* The halo has been rejected when reading the catalog: jump over its particles without parsing them */
+			if (binary_search(buffer.skipIDs.begin(), buffer.skipIDs.end(), locHaloID))
+			{
+				fileIn->SkipBlock();
+				continue;
+			}
+
+			if (!fileIn->ReadBlock(blockIDs, blockTypes))
+			{
+				cout << "ERROR: truncated particle block in " << tmpUrlPart << " on task=" << locTask << endl;
+				exit(0);
+			}
+
+			if (!StoreParticleBlock(locHaloID, blockIDs, blockTypes, halos, buffer))
+			{
+				cout << "ERROR: particle type out of range (nPTypes=" << nPTypes << ") in " << tmpUrlPart 
+					<< " on task=" << locTask << endl;
+				exit(0);
+			}
 		}
 
-		tmpHalos.clear();
-		tmpHalos.shrink_to_fit();
-#else
-	
-#ifdef VERBOSE
-		cout << "NHalos: " << tmpHalos.size() << " on task=" << locTask << endl;
-#endif
-		/* Append to the locHalo file */
-		//locHalos[iUseCat].insert(locHalos[iUseCat].end(), tmpHalos.begin(), tmpHalos.end()); // TODO maybe this works but
-												       // let's stick to the safe side
-		for (int iH = 0; iH < tmpHalos.size(); iH++)
-			locHalos[iUseCat].push_back(tmpHalos[iH]);
-
-		tmpHalos.clear();
-		tmpHalos.shrink_to_fit();
-#endif
-	} // Loop on files per task
-	
-#ifdef ZOOM
+		fileIn->Close();
 	}
-#endif
 
-	nLocHalos[iUseCat] = iLocHalos;
+	delete fileIn;
 
-#ifndef ZOOM
-	// After reading in all the catalogs, find out, sort and remove duplicates of nodes being allocated to the task
-	GlobalGrid[iUseCat].SortLocNodes();
-#endif
+	buffer.nPartChunks++;
 };
+ 
 
-
-/* Read a set of previously computed merger trees, these will be post processed and smoothed */
-void IOSettings::ReadTrees()
+/* Parse the blocks [firstBlock, lastBlock) of an indexed particle file, running on a separate thread */
+void IOSettings::ReadBlockRange(string urlPart, size_t firstBlock, size_t lastBlock, vector<uint64_t> &skipIDs, 
+		vector<ParticleBlock> &blocks)
 {
-	uint64_t hostHaloID = 0, progHaloID = 0;
-	int hostPart = 0, progPart = 0, orphanHalo = 0; 
-	int iLine = 0, thisNumCat = 0, nProgHalo = 0;
-	int commPart = 0;
-
-	char charChunk[2], charSnap[4];
-	const char *lineHead;
-	string urlTree, lineIn;
+	int nPartHalo = 0;
+	ParticleBlock thisBlock;
+	CatalogReader *fileIn = CatalogReader::New(inputFormat);
 
-	thisNumCat = iNumCat-1; 
-	sprintf(charSnap, "%03d", thisNumCat);	
-	sprintf(charChunk, "%d", locTask);	
+	fileIn->OpenParticles(urlPart);
+	fileIn->SetBlockRange(firstBlock, lastBlock);
 
-	lineHead = "#";
-
-	if (nTreeChunks != totTask)
+	while (fileIn->NextBlock(thisBlock.haloID, nPartHalo))
 	{
-		if (locTask == 0) 
-			cout << "ERROR: nTreeChunks in the .cfg file has to be equal to the number of MPI Tasks in use. " << endl;
-
-		MPI_Finalize();
-		exit(0);
-		
-	} else {
-		urlTree = pathTree + outPrefix + charSnap + "." + charChunk + ".mtree";
-		ifstream fileIn(urlTree);
-
-		if (!fileIn.good())
+		if (binary_search(skipIDs.begin(), skipIDs.end(), thisBlock.haloID))
 		{
-			cout << "ERROR: File " << urlTree << " not found on task=" << locTask << endl;
-			MPI_Finalize();
-			exit(0);
-		} else {
-			if (locTask == 0)
-	       			cout << "Reading tree file: " << urlTree << endl;
-		}	
-
-		MergerTree mergerTree;
+			fileIn->SkipBlock();
+			continue;
+		}
 
-		while (getline(fileIn, lineIn))
+		if (!fileIn->ReadBlock(thisBlock.partIDs, thisBlock.partTypes))
 		{
-			const char *lineRead = lineIn.c_str();
-
-			if (lineRead[0] != lineHead[0])
-			{
-				if (iLine == 0)
-				{
-		        		sscanf(lineRead, "%lu  %d  %d  %d", &hostHaloID, &hostPart, &nProgHalo, &orphanHalo);
-
-					mergerTree.mainHalo.ID = hostHaloID;
-					mergerTree.mainHalo.nPart[1] = hostPart;	//TODO this assumes n tot particles = n DM
-
-					mergerTree.nCommon.resize(nPTypes);
-					
-					for (int iC = 0; iC < nPTypes; iC++)
-						mergerTree.nCommon[iC].resize(nProgHalo);
-
-					mergerTree.progHalo.resize(nProgHalo);
-					mergerTree.idProgenitor.resize(nProgHalo);
-
-					if (orphanHalo == 1)
-					{
-						mergerTree.isOrphan = true;
-						mergerTree.progHalo[0].isToken = true;
-					} else {
-						mergerTree.isOrphan = false;
-						mergerTree.progHalo[0].isToken = false;
-					}
-
-					iLine++;
-				} 
-				else if (iLine > 0 && iLine < nProgHalo+1)	/* Read-in properties of progenitors */
-				{
-		        		sscanf(lineRead, "%d  %lu  %d", &commPart, &progHaloID, &progPart);
-
-					mergerTree.idProgenitor[iLine-1] = progHaloID;
-					mergerTree.nCommon[1][iLine-1] = commPart;
-					mergerTree.progHalo[iLine-1].ID = progHaloID;
-					mergerTree.progHalo[iLine-1].nPart[1] = progPart;
-					iLine++;
-				}
-
-				/* Finished reading in progenitor halos */
-				if (iLine == nProgHalo+1)
-				{
-					locCleanTrees[iNumCat-1].push_back(mergerTree);
-					mergerTree.Clean();
-					iLine = 0;
-				}
-			}
+			cout << "ERROR: truncated particle block in " << urlPart << " on task=" << locTask << endl;
+			exit(0);
 		}
-	}	/* End if using the correct number of tasks */
 
-};
+		blocks.push_back(move(thisBlock));
+	}
 
+	fileIn->Close();
+	delete fileIn;
+};
 
 
-void IOSettings::ReadLineAHF(const char * lineRead, Halo *halo)
+/* Add the particles of one halo to the particle map and, sorted by type and ID, to the halo particle list. 
+ * Returns false, storing nothing, if a particle type is not below nPTypes */
+bool IOSettings::StoreParticleBlock(uint64_t locHaloID, vector<uint64_t> &blockIDs, vector<int> &blockTypes, 
+		vector<Halo> &halos, CatalogBuffer &buffer)
 {
-	float dummy, vHalo;
-	unsigned int tmpNpart = 0, nGas = 0, nStar = 0;
-	//uint64_t dummyID;
-	int dummyID;
-
-	/* AHF file structure:
-	   ID(1)  hostHalo(2)     numSubStruct(3) Mvir(4) npart(5)        Xc(6)   Yc(7)   Zc(8)   VXc(9)  VYc(10) VZc(11) 
-	   Rvir(12)        Rmax(13)        r2(14)  mbp_offset(15)  com_offset(16)  Vmax(17)        v_esc(18)       sigV(19)
-           lambda(20)      lambdaE(21)     Lx(22)  Ly(23)  Lz(24)  b(25)   c(26)   Eax(27) Eay(28) Eaz(29) Ebx(30) Eby(31) 
-	   Ebz(32) Ecx(33) Ecy(34) Ecz(35) ovdens(36)      nbins(37)       fMhires(38)     Ekin(39)        Epot(40)        
-	   SurfP(41)       Phi0(42)        cNFW(43)        n_gas(44)       M_gas(45)       lambda_gas(46)  lambdaE_gas(47) 
-	   Lx_gas(48)      Ly_gas(49)      Lz_gas(50)      b_gas(51)       c_gas(52)       Eax_gas(53)     Eay_gas(54)     
-	   Eaz_gas(55)     Ebx_gas(56)     Eby_gas(57)     Ebz_gas(58)     Ecx_gas(59)     Ecy_gas(60)     Ecz_gas(61)     
-	   Ekin_gas(62)    Epot_gas(63)    n_star(64)      M_star(65)      lambda_star(66) lambdaE_star(67)        
-           Lx_star(68)     Ly_star(69)     Lz_star(70)     b_star(71)      c_star(72)      Eax_star(73)    Eay_star(74) Eaz_star(75)    
-	   Ebx_star(76)    Eby_star(77)    Ebz_star(78)    Ecx_star(79)    Ecy_star(80)    Ecz_star(81)    Ekin_star(82)Epot_star(83) */
-
-	/* Col:		    1   2    3  4  5  6  7  8  9 10 11 */
-	sscanf(lineRead, "%lu  %d   %d %f %d \
-			  %f   %f   %f %f %f %f \
-			  %f   %f   %f %f %f %f %f %f %f %f \
-			  %f   %f   %f \
-			  %f   %f   %f %f %f %f %f %f %f %f \
-			  %f   %f   %f %f %f %f %f %f %f %f ",
- 
-			&halo->ID,   &dummyID, &halo->nSub, &halo->mTot, &tmpNpart, 
-			&halo->X[0], &halo->X[1], &halo->X[2], &halo->V[0], &halo->V[1], &halo->V[2], 				// 11
-			&halo->rVir, &dummy, &halo->rsNFW, &dummy, &dummy, &halo->vMax, &dummy, &halo->sigV, &halo->lambda, &dummy, // 21
-			&halo->L[0], &halo->L[1], &halo->L[2],									// 24
-			&dummy, &dummy, &dummy, &dummy,   &dummy, &dummy, &dummy, &dummy, &dummy, &dummy,			// 34
-			&dummy, &dummy, &dummy, &halo->fMhires, &dummy, &dummy, &dummy, &dummy, &halo->cNFW, &dummy);		 // 44
+	unsigned int iLocHalos = buffer.iPartHalo;
+	bool isLocHalo = true;
+	size_t nPartHalo = blockIDs.size();
 
-	/* Particle numbers were not allocated correctly sometimes, so let's reset them carefully */
-	nGas = 0; nStar = 0;
+	for (auto const& partType : blockTypes)
+		if (partType < 0 || partType >= nPTypes)
+			return false;
 
-/*
-#ifdef IDADD
-	if (dummyID < idADD)
-		dummyID = dummyID + idADD;
+#ifdef ZOOM
+	/* Zoom mode, making sure the current halo is in the list of the high-res ones */
+	isLocHalo = (iLocHalos < halos.size() && halos[iLocHalos].ID == locHaloID);
 #endif
 
-	halo->ID = dummyID;
-*/
-
-#ifdef NOPTYPE
-	halo->nPart[0] = 0;
-	halo->nPart[1] = tmpNpart;
-	
-	/*if (tmpNpart > 10000)
-	{ cout << lineRead << endl;
-		cout << halo->ID << " " << tmpNpart << endl;}*/
-#else
-	halo->nPart[0] = nGas;
-	halo->nPart[1] = tmpNpart - nGas - nStar;
+	if (isLocHalo)
+		buffer.parts[iLocHalos].resize(nPTypes);
 
-	if (nPTypes > 2)
+	for (size_t iP = 0; iP < nPartHalo; iP++)
 	{
-		halo->nPart[2] = 0;
-		
-		if (nPTypes > 3)
-		{
-			halo->nPart[3] = 0;
-		
-			if (nPTypes > 4)
-			{
-				halo->nPart[4] = nStar;
-					
-					if (nPTypes > 5)
-					{
-						halo->nPart[5] = 0;
-					}
-			}
-		}
-	}
-#endif
-	/* Compute max velocity and sub box edges while reading the halo file ---> this is used to compute the buffer zones */
-	vHalo = VectorModule(halo->V);
+		Particle thisParticle;
+		thisParticle.haloID = locHaloID;
+		thisParticle.type   = blockTypes[iP];
 
-	if (vHalo > locVmax)
-		locVmax = vHalo;
-};
+		vector<Particle> &thisMap = buffer.mapParts[blockIDs[iP]];
+		thisMap.push_back(thisParticle);
+	
+		if (thisMap.size() > 1)
+			buffer.nPartMulti++;
 
-#ifdef AHF_CB
-// TODO!!!!!! Enable a different output format --> CB format does not have halo IDs, which is problematic for the MergerTree algorithm
-void IOSettings::ReadLineAHF_CB(const char * lineRead, Halo *halo, int lineID)
-{
-	float dummy, vHalo, dummyID;
-	unsigned int tmpNpart, nGas = 0, nStar = 0;
-
-	/* AHF file structure:
-	 npart(1)       fMhires(2)      Xc(3)   Yc(4)   Zc(5)   VXc(6)  VYc(7)  VZc(8)  Mvir(9) Rvir(10)        Vmax(11)        Rmax(12)
-  	 sigV(13)        lambda(14)      Lx(15)  Ly(16)  Lz(17)  a(18)   Eax(19) Eay(20) Eaz(21) b(22)   
-	 Ebx(23) Eby(24) Ebz(25) c(26)   Ecx(27) Ecy(28) Ecz(29) ovdens(30)      Redge(31)       
-	 nbins(32)       Ekin(33)        Epot(34)        mbp_offset(35)  com_offset(36)  r2(37)  lambdaE(38)     
-	 v_esc(39)       Phi0(40)        n_gas(41)       M_gas(42)       lambda_gas(43)  Lx_gas(44)      Ly_gas(45)      Lz_gas(46)      
-	a_gas(47)       Eax_gas(48)     Eay_gas(49)     Eaz_gas(50)     b_gas(51)       Ebx_gas(52)     Eby_gas(53)     Ebz_gas(54)     
-	 c_gas(55)       Ecx_gas(56)     Ecy_gas(57)     Ecz_gas(58)     Ekin_gas(59)    Epot_gas(60)    lambdaE_gas(61) 
-	 n_star(62)      M_star(63)      lambda_star(64) Lx_star(65)     Ly_star(66)     Lz_star(67)     a_star(68)      
-	Eax_star(69)    Eay_star(70)    Eaz_star(71)    b_star(72)      Ebx_star(73)    Eby_star(74)    Ebz_star(75)    c_star(76)      
-	 Ecx_star(77)    Ecy_star(78)    Ecz_star(79)    Ekin_star(80)   Epot_star(81)   lambdaE_star(82) */
-
-	/* Col:		    1   2    3  4  5  6  7  8  9 10 11 */
-	sscanf(lineRead, "%d  %d  %d %f %d \
-			  %f   %f   %f %f %f %f \
-			  %f   %f   %f %f %f %f %f %f %f %f \
-			  %f   %f   %f \
-			  %f   %f   %f %f %f %f %f %f %f %f \
-			  %f   %f   %f %f %f %f %f %f %f %f ",
- 
-			&dummyID, &halo->hostID, &halo->nSub, &halo->mTot, &tmpNpart, 
-			&halo->X[0], &halo->X[1], &halo->X[2], &halo->V[0], &halo->V[1], &halo->V[2], 				// 11
-			&halo->rVir, &dummy, &halo->rsNFW, &dummy, &dummy, &halo->vMax, &dummy, &halo->sigV, &halo->lambda, &dummy, // 21
-			&halo->L[0], &halo->L[1], &halo->L[2],									// 24
-			&dummy, &dummy, &dummy, &dummy,   &dummy, &dummy, &dummy, &dummy, &dummy, &dummy,			// 34
-			&dummy, &dummy, &dummy, &halo->fMhires, &dummy, &dummy, &dummy, &dummy, &halo->cNFW, &dummy);		 // 44
-
-	/* Particle numbers were not allocated correctly sometimes, so let's reset them carefully */
-	nGas = 0; nStar = 0;
-
-#ifdef IDADD
-	if (dummyID < idADD)
-		dummyID += dummyID;
-#endif
+		if (isLocHalo)
+			buffer.parts[iLocHalos][blockTypes[iP]].push_back(blockIDs[iP]);
+	}
 
-	halo->ID = dummyID;
-	halo->nPart[0] = nGas;
-	halo->nPart[1] = tmpNpart - nGas - nStar;
+	buffer.nParts += nPartHalo;
 
-	if (nPTypes > 2)
+	if (isLocHalo)
 	{
-		halo->nPart[2] = 0;
-		
-		if (nPTypes > 3)
-		{
-			halo->nPart[3] = 0;
-		
-			if (nPTypes > 4)
-			{
-				halo->nPart[4] = nStar;
-					
-					if (nPTypes > 5)
-					{
-						halo->nPart[5] = 0;
-					}
-			}
-		}
-	}
+		/* Sort the ordered IDs */
+		for (int iT = 0; iT < nPTypes; iT++)
+			sort(buffer.parts[iLocHalos][iT].begin(), buffer.parts[iLocHalos][iT].end());
 
-	/* Compute max velocity and sub box edges while reading the halo file ---> this is used to compute the buffer zones */
-	vHalo = VectorModule(halo->V);
+		buffer.iPartHalo++;
+	}
 
-	if (vHalo > locVmax)
-		locVmax = vHalo;
+	return true;
 };
-#endif
 
 
-
-void IOSettings::WriteTree(int iThisCat)
+/* Using AHF by default */
+void IOSettings::ReadHalos()
+{
+	/* If the snapshot is being prefetched, wait for the reading thread to finish and take over what it has read */
+	WaitPrefetch();
+
+#ifdef ZOOM	/* Only read on one task */
+	if (locTask == 0)
+	{
+#endif
+
+#ifdef VERBOSE
+	cout << "onTask=" << locTask << " halo size: " << locHalos[iUseCat].size() << endl;
+#endif
+
+	nLocChunks = haloFiles[iNumCat].size();
+	//cout << locTask << ", " << iNumCat << ", " << nLocChunks << endl;
+
+	if (catBuffer.iCat != iNumCat)
+		catBuffer.Clean();
+
+	catBuffer.iCat = iNumCat;
+
+	for (int iChunk = catBuffer.nHaloChunks; iChunk < nLocChunks; iChunk++)
+		ReadHaloChunk(iNumCat, iChunk, catBuffer);
+
+	/* Append to the locHalo file */
+	locHalos[iUseCat].insert(locHalos[iUseCat].end(), catBuffer.halos.begin(), catBuffer.halos.end());
+
+	catBuffer.nHaloChunks = nLocChunks;
+	catBuffer.halos.clear();
+	catBuffer.halos.shrink_to_fit();
+
+#ifdef ZOOM
+	}
+#endif
+
+	nLocHalos[iUseCat] = locHalos[iUseCat].size();
+
+#ifndef ZOOM
+	// Assign halo to its nearest grid point - assign the absolute local index number
+	// Halos on the local chunk have POSITIVE index, halos on the buffer NEGATIVE 
+	for (int iH = 0; iH < nLocHalos[iUseCat]; iH++)
+		GlobalGrid[iUseCat].AssignToGrid(locHalos[iUseCat][iH].X, iH);
+
+	// After reading in all the catalogs, find out, sort and remove duplicates of nodes being allocated to the task
+	GlobalGrid[iUseCat].SortLocNodes();
+	GlobalGrid[iUseCat].SortHalos();
+#endif
+};
+
+
+/* Read one halo catalog chunk and append its halos to the buffer. 
+ * Halos below the read thresholds are not stored, but their IDs are kept so that their particle blocks can be skipped */
+void IOSettings::ReadHaloChunk(int iCat, int iChunk, CatalogBuffer &buffer)
+{
+	unsigned int iTmpHalos = 0, iSkipHalos = 0; 
+	const char *tmpUrlHalo;
+
+	tmpUrlHalo = haloFiles[iCat][iChunk].c_str();
+
+	/* Compressed files cannot be cheaply pre-scanned with NumLines(), so the halo buffer grows while reading */
+	CatalogReader *fileIn = CatalogReader::New(inputFormat);
+
+	if (!fileIn->OpenHalos(tmpUrlHalo))
+	{
+		cout << "File: " << tmpUrlHalo << " not found on task=" << locTask << endl;
+		exit(0);
+	}
+
+	Halo thisHalo;
+
+	while (fileIn->NextHalo(thisHalo))
+	{
+		if (KeepHalo(thisHalo))
+		{
+			buffer.halos.push_back(thisHalo);
+			iTmpHalos++;
+		} else {
+			buffer.skipIDs.push_back(thisHalo.ID);
+			iSkipHalos++;
+		}
+	}
+
+	fileIn->Close();
+	delete fileIn;
+
+	/* Particle blocks are looked up by halo ID */
+	sort(buffer.skipIDs.begin(), buffer.skipIDs.end());
+
+#ifdef VERBOSE
+	cout << "NHalos: " << iTmpHalos << " skipped: " << iSkipHalos << " on task=" << locTask << endl;
+#endif
+
+	if (locTask == 0 && iChunk == 0)
+       		cout << "Read " << iTmpHalos << " halos (" << iSkipHalos << " below threshold) from file: " << tmpUrlHalo << endl;
+};
+
+
+/* Read-time selection: halos that are too small or too contaminated by low-resolution particles are never loaded */
+bool IOSettings::KeepHalo(Halo &halo)
+{
+	if (halo.nAllPart() < minPartRead)
+		return false;
+
+	if (halo.fMhires < minMhiresRead)
+		return false;
+
+	if (halo.mTot < minMassRead)
+		return false;
+
+	return true;
+};
+
+
+/* Start reading the halo and particle chunks of catalog iCat on a separate thread, while the current step is being computed.
+ * Chunks are read in order, and the thread stops once the estimated size of the buffer would exceed prefetchMemory (in MB).
+ * Whatever has not been prefetched is read by ReadHalos() / ReadParticles() as usual. */
+void IOSettings::PrefetchCatalog(int iCat)
+{
+	if (prefetchMemory <= 0 || iCat >= nSnapsUse)
+		return;
+
+#ifdef ZOOM
+	if (locTask != 0)
+		return;
+#endif
+
+	WaitPrefetch();
+
+	catBuffer.Clean();
+	catBuffer.iCat = iCat;
+
+	prefetchThread = thread(&IOSettings::PrefetchChunks, this, iCat);
+};
+
+
+void IOSettings::WaitPrefetch()
+{
+	if (prefetchThread.joinable())
+		prefetchThread.join();
+};
+
+
+void IOSettings::PrefetchChunks(int iCat)
+{
+	size_t maxBytes = (size_t) prefetchMemory * 1024 * 1024;
+	size_t fileBytes = 0, thisFileBytes = 0, thisBytes = 0;
+	float bytesRatio = 10.0;	// First guess of the memory needed for each byte of the input files
+	int nCatChunks = haloFiles[iCat].size();
+
+	for (int iChunk = 0; iChunk < nCatChunks; iChunk++)
+	{
+		thisFileBytes = FileSize(haloFiles[iCat][iChunk]) + FileSize(partFiles[iCat][iChunk]);
+
+		/* After the first chunk, use the actual memory-to-file size ratio */
+		if (fileBytes > 0)
+			bytesRatio = (float) catBuffer.Size() / (float) fileBytes;
+
+		thisBytes = (size_t) (bytesRatio * thisFileBytes);
+
+		if (catBuffer.Size() + thisBytes > maxBytes)
+			break;
+
+		ReadHaloChunk(iCat, iChunk, catBuffer);
+		catBuffer.nHaloChunks++;
+
+		catBuffer.parts.resize(catBuffer.halos.size());
+		ReadParticleChunk(iCat, iChunk, catBuffer.halos, catBuffer);
+
+		fileBytes += thisFileBytes;
+	}
+};
+
+
+/* Rough estimate of the memory held by the buffer, particles are stored both in the vectors and the map */
+size_t IOSettings::CatalogBuffer::Size()
+{
+	return halos.size() * sizeof(Halo) + nParts * (sizeof(uint64_t) + sizeof(Particle)) + mapParts.size() * 64;
+};
+
+
+void IOSettings::CatalogBuffer::Clean()
+{
+	iCat = -1;
+	nHaloChunks = 0; nPartChunks = 0;
+	iPartHalo = 0; nParts = 0; nPartMulti = 0;
+
+	halos.clear();
+	halos.shrink_to_fit();
+	parts.clear();
+	parts.shrink_to_fit();
+	skipIDs.clear();
+	skipIDs.shrink_to_fit();
+	mapParts.clear();
+};
+
+
+/* Read a set of previously computed merger trees, these will be post processed and smoothed.
+ * The tree files (or the sections of a shared file) are assigned to the tasks by size, whatever the number of tasks 
+ * used to compute them; the trees are then sent to the task owning their main halo ID (ID % totTask) */
+void IOSettings::ReadTrees()
+{
+	int nChunks = 0;
+	string urlShared, urlBase;
+	vector<TreeChunk> treeChunks;
+
+	/* Same names as in WriteTree */
+	urlShared = pathTree + outPrefix + strSnaps[iNumCat-1] + "." + outSuffix;
+	urlBase = pathTree + outPrefix + strSnaps[iNumCat-1] + ".";
+
+	/* Only the master task looks for the files */
+	if (locTask == 0)
+	{
+		vector<uint64_t> secOffsets;
+
+		if (TreeFile::ReadSections(urlShared, secOffsets))
+		{
+			cout << "Reading shared tree file: " << urlShared << " with " << secOffsets.size() - 1 << " sections." << endl;
+
+			for (size_t iS = 0; iS + 1 < secOffsets.size(); iS++)
+				treeChunks.push_back({-1, secOffsets[iS], secOffsets[iS+1]});
+		} else {
+			/* One file per task of the run that computed the trees, numbered from zero */
+			for (int iF = 0; ; iF++)
+			{
+				string urlTree = urlBase + to_string(iF) + "." + outSuffix;
+				ifstream fileTest(urlTree);
+
+				if (!fileTest.good())
+					break;
+
+				treeChunks.push_back({iF, 0, FileSize(urlTree)});
+			}
+
+			cout << "Reading " << treeChunks.size() << " tree files: " << urlBase << "*." << outSuffix << endl;
+		}
+
+		nChunks = treeChunks.size();
+	}
+
+	MPI_Bcast(&nChunks, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+	if (nChunks == 0)
+	{
+		if (locTask == 0)
+			cout << "ERROR: no tree files found for " << urlBase << "*." << outSuffix << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+
+	treeChunks.resize(nChunks);
+	MPI_Bcast(&treeChunks[0], nChunks * sizeof(TreeChunk), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+	/* Largest chunks first, each one to the task with the smallest amount of data so far */
+	vector<int> chunkOrder(nChunks), chunkTask(nChunks);
+	vector<uint64_t> taskSize(totTask, 0);
+
+	for (int iC = 0; iC < nChunks; iC++)
+		chunkOrder[iC] = iC;
+
+	sort(chunkOrder.begin(), chunkOrder.end(), [&treeChunks](int a, int b) 
+		{ return treeChunks[a].end - treeChunks[a].start > treeChunks[b].end - treeChunks[b].start; });
+
+	for (int iC = 0; iC < nChunks; iC++)
+	{
+		TreeChunk &thisChunk = treeChunks[chunkOrder[iC]];
+		int iT = min_element(taskSize.begin(), taskSize.end()) - taskSize.begin();
+
+		chunkTask[chunkOrder[iC]] = iT;
+		taskSize[iT] += thisChunk.end - thisChunk.start;
+	}
+
+	for (int iC = 0; iC < nChunks; iC++)
+		if (chunkTask[iC] == locTask)
+		{
+			TreeChunk &thisChunk = treeChunks[iC];
+
+			if (thisChunk.iFile < 0)
+				ReadTreeSection(urlShared, thisChunk.start, thisChunk.end);
+			else
+				ReadTreeSection(urlBase + to_string(thisChunk.iFile) + "." + outSuffix, thisChunk.start, thisChunk.end);
+		}
+
+	if (totTask > 1)
+		SendTreesToOwner(locCleanTrees[iNumCat-1]);
+};
+
+
+/* Read the trees stored between two byte offsets of a file, either a whole .mtree file or a section of a shared one */
+void IOSettings::ReadTreeSection(string urlTree, uint64_t secStart, uint64_t secEnd)
+{
+	char secMagic[8] = { 0 };
+	ifstream fileIn(urlTree, ios::binary);
+
+	/* Only the magic is read first, binary sections are mapped in memory instead of being read */
+	fileIn.seekg(secStart);
+
+	if (secEnd - secStart >= 8)
+		fileIn.read(secMagic, 8);
+
+	if (!fileIn.good())
+	{
+		cout << "ERROR: File " << urlTree << " could not be read on task=" << locTask << endl;
+		MPI_Finalize();
+		exit(0);
+	}
+
+	/* Binary trees are copied tree by tree */
+	if (strncmp(secMagic, "MCPPTREE", 8) == 0)
+	{
+		TreeFile treeFile;
+		MergerTree mergerTree;
+
+		fileIn.close();
+
+		if (!treeFile.Open(urlTree, secStart))
+		{
+			cout << "ERROR: File " << urlTree << " could not be read on task=" << locTask << endl;
+			MPI_Finalize();
+			exit(0);
+		}
+
+		locCleanTrees[iNumCat-1].reserve(locCleanTrees[iNumCat-1].size() + treeFile.NTrees());
+
+		for (uint64_t iTree = 0; iTree < treeFile.NTrees(); iTree++)
+		{
+			treeFile.GetTree(iTree, mergerTree);
+			locCleanTrees[iNumCat-1].push_back(mergerTree);
+			mergerTree.Clean();
+		}
+
+		return;
+	}
+
+	/* ASCII trees are read whole and parsed in memory */
+	string secData(secEnd - secStart, ' ');
+
+	fileIn.seekg(secStart);
+	fileIn.read(&secData[0], secData.size());
+
+	if (!fileIn.good())
+	{
+		cout << "ERROR: File " << urlTree << " could not be read on task=" << locTask << endl;
+		MPI_Finalize();
+		exit(0);
+	}
+
+	fileIn.close();
+
+	ReadTreeAscii(secData.data(), secData.data() + secData.size());
+};
+
+
+/* Unsigned integer at the current position, skipping blanks; pos is moved past the number */
+static inline uint64_t ParseUInt(const char *&pos, const char *end)
+{
+	uint64_t value = 0;
+
+	while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r'))
+		pos++;
+
+	while (pos < end && *pos >= '0' && *pos <= '9')
+	{
+		value = value * 10 + (*pos - '0');
+		pos++;
+	}
+
+	return value;
+};
+
+
+/* ASCII trees held in memory, the lines are tokenized in place instead of going through getline and sscanf */
+void IOSettings::ReadTreeAscii(const char *secBegin, const char *secEnd)
+{
+	uint64_t hostHaloID = 0, progHaloID = 0;
+	int hostPart = 0, progPart = 0, orphanHalo = 0; 
+	int iLine = 0, nProgHalo = 0;
+	int commPart = 0;
+
+	const char *lineBegin = secBegin;
+
+	MergerTree mergerTree;
+
+	while (lineBegin < secEnd)
+	{
+		const char *lineEnd = (const char *) memchr(lineBegin, '\n', secEnd - lineBegin);
+
+		if (lineEnd == nullptr)
+			lineEnd = secEnd;
+
+		const char *pos = lineBegin;
+		lineBegin = lineEnd + 1;
+
+		if (pos == lineEnd || *pos == '#')
+			continue;
+
+		if (iLine == 0)
+		{
+			hostHaloID = ParseUInt(pos, lineEnd);
+			hostPart = ParseUInt(pos, lineEnd);
+			nProgHalo = ParseUInt(pos, lineEnd);
+			orphanHalo = ParseUInt(pos, lineEnd);
+
+			mergerTree.mainHalo.ID = hostHaloID;
+			mergerTree.mainHalo.nPart[1] = hostPart;	//TODO this assumes n tot particles = n DM
+
+			mergerTree.nCommon.resize(nPTypes);
+			
+			for (int iC = 0; iC < nPTypes; iC++)
+				mergerTree.nCommon[iC].resize(nProgHalo);
+
+			mergerTree.progHalo.resize(nProgHalo);
+			mergerTree.idProgenitor.resize(nProgHalo);
+
+			mergerTree.isOrphan = (orphanHalo == 1);
+
+			if (nProgHalo > 0)
+				mergerTree.progHalo[0].isToken = mergerTree.isOrphan;
+
+			iLine++;
+		} 
+		else if (iLine > 0 && iLine < nProgHalo+1)	/* Read-in properties of progenitors, in the order of WriteTreeAscii */
+		{
+			progPart = ParseUInt(pos, lineEnd);
+			progHaloID = ParseUInt(pos, lineEnd);
+			commPart = ParseUInt(pos, lineEnd);
+
+			mergerTree.idProgenitor[iLine-1] = progHaloID;
+			mergerTree.nCommon[1][iLine-1] = commPart;
+			mergerTree.progHalo[iLine-1].ID = progHaloID;
+			mergerTree.progHalo[iLine-1].nPart[1] = progPart;
+			iLine++;
+		}
+
+		/* Finished reading in progenitor halos */
+		if (iLine == nProgHalo+1)
+		{
+			locCleanTrees[iNumCat-1].push_back(mergerTree);
+			mergerTree.Clean();
+			iLine = 0;
+		}
+	}
+};
+
+
+/* One all-to-all exchange: the trees are packed as binary tree and progenitor records, see TreeFile.h */
+void IOSettings::SendTreesToOwner(vector<MergerTree> &mergerTrees)
+{
+	vector<vector<TreeRecord>> sendTrees(totTask);
+	vector<vector<ProgRecord>> sendProgs(totTask);
+	vector<TreeRecord> allSendTrees, recvTrees;
+	vector<ProgRecord> allSendProgs, recvProgs;
+	vector<int> sendCounts(2 * totTask), recvCounts(2 * totTask), allTasks(totTask);
+	vector<size_t> sendTreeBytes(totTask), recvTreeBytes(totTask), sendProgBytes(totTask), recvProgBytes(totTask);
+
+	for (size_t iM = 0; iM < mergerTrees.size(); iM++)
+	{
+		int iT = mergerTrees[iM].mainHalo.ID % totTask;
+
+		sendTrees[iT].emplace_back();
+		TreeFile::ToRecords(mergerTrees[iM], sendTrees[iT].back(), sendProgs[iT]);
+	}
+
+	mergerTrees.clear();
+
+	for (int iT = 0; iT < totTask; iT++)
+	{
+		sendCounts[2 * iT] = sendTrees[iT].size();
+		sendCounts[2 * iT + 1] = sendProgs[iT].size();
+	}
+
+	MPI_Alltoall(&sendCounts[0], 2, MPI_INT, &recvCounts[0], 2, MPI_INT, MPI_COMM_WORLD);
+
+	for (int iT = 0; iT < totTask; iT++)
+	{
+		allTasks[iT] = iT;
+		sendTreeBytes[iT] = (size_t) sendCounts[2 * iT] * sizeof(TreeRecord);
+		sendProgBytes[iT] = (size_t) sendCounts[2 * iT + 1] * sizeof(ProgRecord);
+		recvTreeBytes[iT] = (size_t) recvCounts[2 * iT] * sizeof(TreeRecord);
+		recvProgBytes[iT] = (size_t) recvCounts[2 * iT + 1] * sizeof(ProgRecord);
+
+		allSendTrees.insert(allSendTrees.end(), sendTrees[iT].begin(), sendTrees[iT].end());
+		allSendProgs.insert(allSendProgs.end(), sendProgs[iT].begin(), sendProgs[iT].end());
+		sendTrees[iT].clear();
+		sendProgs[iT].clear();
+	}
+
+	vector<size_t> sendTreeOff = Communication::Offsets(sendTreeBytes), recvTreeOff = Communication::Offsets(recvTreeBytes);
+	vector<size_t> sendProgOff = Communication::Offsets(sendProgBytes), recvProgOff = Communication::Offsets(recvProgBytes);
+
+	recvTrees.resize((recvTreeOff[totTask-1] + recvTreeBytes[totTask-1]) / sizeof(TreeRecord));
+	recvProgs.resize((recvProgOff[totTask-1] + recvProgBytes[totTask-1]) / sizeof(ProgRecord));
+
+	/* The records are sent as bytes, the total size on a task can exceed the range of an int */
+	Communication::Exchange(allSendTrees.data(), sendTreeBytes, sendTreeOff, recvTrees.data(), recvTreeBytes, recvTreeOff, 
+			allTasks, MPI_BYTE, 1);
+	Communication::Exchange(allSendProgs.data(), sendProgBytes, sendProgOff, recvProgs.data(), recvProgBytes, recvProgOff, 
+			allTasks, MPI_BYTE, 2);
+
+	/* firstProg is relative to the progenitors sent by the same task */
+	mergerTrees.resize(recvTrees.size());
+
+	for (int iT = 0, iM = 0; iT < totTask; iT++)
+	{
+		const ProgRecord *taskProgs = recvProgs.data() + recvProgOff[iT] / sizeof(ProgRecord);
+
+		for (int iR = 0; iR < recvCounts[2 * iT]; iR++, iM++)
+			TreeFile::FromRecords(recvTrees[iM], taskProgs + recvTrees[iM].firstProg, mergerTrees[iM]);
+	}
+};
+
+
+void IOSettings::WriteTree(int iThisCat)
 {
 	string outName;
         string strCpu = to_string(locTask);
-	int orphan, iType = 0;
-
-	iType = 1;
 
         for (int iC = iThisCat-1; iC < iThisCat; iC++)
         {
@@ -1085,56 +1474,558 @@ void IOSettings::WriteTree(int iThisCat)
 		strFnm = strSnaps[iC].c_str();
 		outName = pathOutput + outPrefix + strFnm + "." + strCpu + "." + outSuffix;
 
-		ofstream fileOut;
-		fileOut.open(outName);
+		/* The database only keeps the main branches, the trees are then written (or queued) as usual */
+		treeDatabase.AddStep(locCleanTrees[iC]);
+
+		/* All tasks write to the same file, this needs MPI so it cannot be done on the writer thread */
+		if (outSingleFile)
+		{
+			outName = pathOutput + outPrefix + strFnm + "." + outSuffix;
+
+			if (locTask == 0)
+				cout << "Printing trees to shared file " << outName << endl;
+
+			WriteTreeShared(outName, numSnaps[iC], locCleanTrees[iC]);
+			continue;
+		}
 
                 if (locTask == 0)
                         cout << "Printing trees to file " << outName << endl;
 
-		if (locTask == 0)
+		if (writeQueue > 0)
+			QueueTree(outName, numSnaps[iC], locCleanTrees[iC]);
+		else
+			WriteTreeFile(outName, numSnaps[iC], locCleanTrees[iC]);
+        }	// loop on iCatalog
+};
+
+
+/* Lines are not flushed one by one, the stream is written in large blocks */
+void IOSettings::WriteTreeFile(string outName, int snapshot, vector<MergerTree> &mergerTrees)
+{
+	if (outFormat == "binary")
+	{
+		TreeFile::Write(outName, snapshot, mergerTrees);
+	} else {
+		vector<char> fileBuffer(4 * 1024 * 1024);
+
+		ofstream fileOut;
+		fileOut.rdbuf()->pubsetbuf(&fileBuffer[0], fileBuffer.size());
+		fileOut.open(outName);
+
+		WriteTreeAscii(fileOut, mergerTrees);
+
+		fileOut.close();
+	}
+};
+
+
+/* Collective write of a single file per snapshot. Each task serializes its trees in memory and gets its offset in the 
+ * file from an exclusive scan of the section sizes; the header with the offset table is written by the first task. 
+ * The sections are written with collective calls, so that MPI-IO can aggregate them into large aligned blocks */
+void IOSettings::WriteTreeShared(string outName, int snapshot, vector<MergerTree> &mergerTrees)
+{
+	int nWrite = 0, iWrite = 0, nCalls = 0, thisCalls = 0;
+	uint64_t secSize = 0, secOffset = 0, dataStart = 0, headSize = 0;
+	const uint64_t maxCall = 1 << 30;	// Keep the count of each call well below 2^31
+	const uint64_t sizeAlign = 4096;
+	vector<char> secData;
+	vector<uint64_t> allSizes;
+	MPI_File fileOut;
+	MPI_Info fileInfo;
+
+#ifdef GATHER_TREES
+	/* The trees are cleaned on the master task after being gathered, so it holds (and writes) all of them: the file has 
+	 * a single section and the collective calls only involve this task. Trees read back with runMode = 1 are on all tasks */
+	MPI_Comm commWrite = (runMode == 1) ? MPI_COMM_WORLD : MPI_COMM_SELF;
+#else
+	MPI_Comm commWrite = MPI_COMM_WORLD;
+#endif
+
+	MPI_Comm_size(commWrite, &nWrite);
+	MPI_Comm_rank(commWrite, &iWrite);
+
+	if (outFormat == "binary")
+	{
+		TreeFile::Serialize(snapshot, mergerTrees, secData);
+	} else {
+		ostringstream secOut;
+		WriteTreeAscii(secOut, mergerTrees);
+
+		string secString = secOut.str();
+		secData.assign(secString.begin(), secString.end());
+	}
+
+	secSize = secData.size();
+	MPI_Exscan(&secSize, &secOffset, 1, MPI_UINT64_T, MPI_SUM, commWrite);
+
+	if (iWrite == 0)
+		secOffset = 0;
+
+	allSizes.resize(nWrite);
+	MPI_Gather(&secSize, 1, MPI_UINT64_T, &allSizes[0], 1, MPI_UINT64_T, 0, commWrite);
+
+	headSize = sizeof(SharedTreeHeader) + (nWrite + 1) * sizeof(uint64_t);
+	dataStart = ((headSize + sizeAlign - 1) / sizeAlign) * sizeAlign;
+
+	MPI_Info_create(&fileInfo);
+	MPI_Info_set(fileInfo, "romio_cb_write", "enable");
+	MPI_Info_set(fileInfo, "cb_buffer_size", "16777216");
+	MPI_Info_set(fileInfo, "striping_unit", "4194304");
+
+	if (MPI_File_open(commWrite, outName.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, fileInfo, &fileOut) != MPI_SUCCESS)
+	{
+		cout << "ERROR: could not open " << outName << " on task=" << locTask << endl;
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	MPI_File_set_size(fileOut, 0);
+
+	if (iWrite == 0)
+	{
+		vector<char> headData(dataStart, 0);
+		SharedTreeHeader thisHeader;
+		uint64_t *secTable = (uint64_t *) &headData[sizeof(SharedTreeHeader)];
+
+		memcpy(thisHeader.magic, "MCPPMTRS", 8);
+		thisHeader.version = 1;
+		thisHeader.nSections = nWrite;
+		memcpy(&headData[0], &thisHeader, sizeof(SharedTreeHeader));
+
+		secTable[0] = dataStart;
+
+		for (int iS = 0; iS < nWrite; iS++)
+			secTable[iS+1] = secTable[iS] + allSizes[iS];
+
+		MPI_File_write_at(fileOut, 0, &headData[0], dataStart, MPI_CHAR, MPI_STATUS_IGNORE);
+	}
+
+	/* All the tasks have to take part in the same number of collective calls */
+	thisCalls = (secSize + maxCall - 1) / maxCall;
+	MPI_Allreduce(&thisCalls, &nCalls, 1, MPI_INT, MPI_MAX, commWrite);
+
+	for (int iC = 0; iC < nCalls; iC++)
+	{
+		uint64_t callStart = min(iC * maxCall, secSize);
+		uint64_t callSize = min(maxCall, secSize - callStart);
+
+		MPI_File_write_at_all(fileOut, dataStart + secOffset + callStart, secData.data() + callStart, 
+				(int) callSize, MPI_CHAR, MPI_STATUS_IGNORE);
+	}
+
+	MPI_File_close(&fileOut);
+	MPI_Info_free(&fileInfo);
+};
+
+
+/* Hand the trees of one snapshot over to the writer thread, which writes them while the next step is computed.
+ * A step stays in the queue until it has been written: if writeQueue steps are pending, wait for the oldest one */
+void IOSettings::QueueTree(string outName, int snapshot, vector<MergerTree> &mergerTrees)
+{
+	unique_lock<mutex> lock(writeMutex);
+
+	if (!writeThread.joinable())
+	{
+		writeStop = false;
+		writeThread = thread(&IOSettings::WriteTreeLoop, this);
+	}
+
+	writeDone.wait(lock, [this]{ return (int) writeJobs.size() < writeQueue; });
+
+	writeJobs.emplace_back();
+	TreeJob &thisJob = writeJobs.back();
+	thisJob.outName = outName;
+	thisJob.snapshot = snapshot;
+	thisJob.trees.swap(mergerTrees);
+
+	lock.unlock();
+	writeReady.notify_one();
+};
+
+
+/* Writer thread: the job being written stays at the front of the queue, references to deque elements survive push_back */
+void IOSettings::WriteTreeLoop()
+{
+	while (true)
+	{
+		unique_lock<mutex> lock(writeMutex);
+		writeReady.wait(lock, [this]{ return !writeJobs.empty() || writeStop; });
+
+		if (writeJobs.empty())
+			return;
+
+		TreeJob &thisJob = writeJobs.front();
+		lock.unlock();
+
+		WriteTreeFile(thisJob.outName, thisJob.snapshot, thisJob.trees);
+
+		lock.lock();
+		writeJobs.pop_front();
+		lock.unlock();
+		writeDone.notify_all();
+	}
+};
+
+
+/* Wait until all the queued trees have been written, the writer thread is started again by the next QueueTree */
+void IOSettings::WaitTrees()
+{
+	{
+		lock_guard<mutex> lock(writeMutex);
+		writeStop = true;
+	}
+
+	writeReady.notify_all();
+
+	if (writeThread.joinable())
+		writeThread.join();
+
+	writeStop = false;
+};
+
+
+/* Write all the outputs that are only complete at the end of the run */
+void IOSettings::FlushTrees()
+{
+	WaitTrees();
+
+	if (treeDatabase.IsActive())
+		treeDatabase.Write();
+
+	if (treeForest.IsActive())
+		treeForest.Write(locTreeGraph);
+};
+
+
+/* Called after ShiftHalosPartsGrids, once the trees of step iThisCat have been written: the run can then be restarted 
+ * from step iThisCat + 1. The file is renamed only once it is complete, and the previous one is then removed */
+void IOSettings::WriteCheckpoint(int iThisCat)
+{
+	CheckpointHeader thisHeader;
+	Checkpoint thisCheckpoint;
+	vector<uint64_t> nHaloParts, haloParts;
+	int isGood = 1, allGood = 0;
+
+	string outName = pathOutput + outPrefix + "restart_" + to_string(iThisCat + 1) + "." + to_string(locTask);
+
+	/* The restart files have to be consistent with the tree files already on disk */
+	WaitTrees();
+
+	memset(&thisHeader, 0, sizeof(CheckpointHeader));
+	memcpy(thisHeader.magic, "MCPPCKPT", 8);
+	thisHeader.version = 1;
+	thisHeader.iNumCat = iThisCat + 1;
+	thisHeader.locTask = locTask;
+	thisHeader.totTask = totTask;
+	thisHeader.nPTypes = nPTypes;
+	thisHeader.sizeHalo = sizeof(Halo);
+	thisHeader.nLocHalos = nLocHalos[0];
+	thisHeader.nLocParts = nLocParts[0];
+	thisHeader.hasTrees = (locTreeGraph.NSteps() > 0 || treeDatabase.IsActive());
+
+	for (int iH = 0; iH < locHalos[0].size(); iH++)
+		for (int iT = 0; iT < nPTypes; iT++)
 		{
-			fileOut << "# ID host(1)   N particles host(2)   Num. progenitors(3)  Orphan[0=no, 1=yes](4)" << endl;
-			fileOut << "# Total particles (1)   ID progenitor(2)   Particles in common (3)" << endl;
-		} 
+			if (iH < locParts[0].size() && iT < locParts[0][iH].size())
+			{
+				nHaloParts.push_back(locParts[0][iH][iT].size());
+				haloParts.insert(haloParts.end(), locParts[0][iH][iT].begin(), locParts[0][iH][iT].end());
+			} else {
+				nHaloParts.push_back(0);
+			}
+		}
 
-                for (int iM = 0; iM < locCleanTrees[iC].size(); iM++)
-                {
-			MergerTree thisTree = locCleanTrees[iC][iM];
+	if (thisCheckpoint.Open(outName + ".tmp", true, compressCheckpoint))
+	{
+		thisCheckpoint.Write(&thisHeader, sizeof(CheckpointHeader));
+		thisCheckpoint.WriteVector(locHalos[0]);
+		thisCheckpoint.WriteVector(nHaloParts);
+		thisCheckpoint.WriteVector(haloParts);
 
-			if (thisTree.isOrphan)
-				orphan = 1;	
-			else
-				orphan = 0;
+		if (thisHeader.hasTrees)
+		{
+			locTreeGraph.Save(thisCheckpoint);
 
-			int nTotPt = 0;
-			for (int iA = 0; iA < nPTypes; iA++)
-				nTotPt += thisTree.mainHalo.nPart[iA];
+			if (treeDatabase.IsActive())
+				treeDatabase.Save(thisCheckpoint);
+		}
+	}
+
+	isGood = thisCheckpoint.Close() && rename((outName + ".tmp").c_str(), outName.c_str()) == 0;
+
+	if (!isGood)
+		cout << "ERROR: could not write " << outName << " on task=" << locTask << endl;
+
+	MPI_Allreduce(&isGood, &allGood, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+
+	/* Keep the older file if any task failed */
+	if (!allGood)
+		return;
+
+	if (lastCheckpoint > 0)
+		remove((pathOutput + outPrefix + "restart_" + to_string(lastCheckpoint) + "." + to_string(locTask)).c_str());
+
+	lastCheckpoint = iThisCat + 1;
+
+	if (locTask == 0)
+		cout << "Restart files for step " << lastCheckpoint << " written to " << pathOutput << endl;
+};
+
+
+/* Replaces the reading of the first catalog when restarting: halos, particles and grid are set as after ShiftHalosPartsGrids */
+void IOSettings::ReadCheckpoint(int iThisCat)
+{
+	CheckpointHeader thisHeader;
+	Checkpoint thisCheckpoint;
+	vector<uint64_t> nHaloParts, haloParts;
+	int isGood = 1, allGood = 0;
 
-			fileOut << thisTree.mainHalo.ID 	<< " " 
-				<< nTotPt 			<< " " 
-				<< thisTree.idProgenitor.size() << " "
-				<< orphan << endl;
+	string inName = pathOutput + outPrefix + "restart_" + to_string(iThisCat) + "." + to_string(locTask);
 
-                        for (int iP = 0; iP < thisTree.idProgenitor.size(); iP++)
+	if (locTask == 0)
+		cout << "Restarting from step " << iThisCat << "..." << endl;
+
+	isGood = thisCheckpoint.Open(inName, false) && thisCheckpoint.Read(&thisHeader, sizeof(CheckpointHeader))
+		&& strncmp(thisHeader.magic, "MCPPCKPT", 8) == 0 && thisHeader.version == 1 && thisHeader.iNumCat == iThisCat
+		&& thisHeader.totTask == totTask && thisHeader.nPTypes == nPTypes && thisHeader.sizeHalo == sizeof(Halo);
+
+	isGood = isGood && thisCheckpoint.ReadVector(locHalos[0]) && thisCheckpoint.ReadVector(nHaloParts) 
+		&& thisCheckpoint.ReadVector(haloParts) && nHaloParts.size() == locHalos[0].size() * nPTypes;
+
+	if (isGood && thisHeader.hasTrees)
+	{
+		isGood = locTreeGraph.Load(thisCheckpoint);
+
+		if (treeDatabase.IsActive())
+			isGood = isGood && treeDatabase.Load(thisCheckpoint);
+	}
+
+	thisCheckpoint.Close();
+
+	/* The task building the graph must have the snapshots up to this step, the next one is added with AddStep(iThisCat - 1) */
+#ifdef GATHER_TREES
+	bool hasGraph = (locTask == 0);
+#else
+	bool hasGraph = true;
+#endif
+
+	if (hasGraph && (minPartHistory > 0 || outForest))
+		isGood = isGood && (locTreeGraph.NSteps() == iThisCat);
+
+	if (!isGood)
+		cout << "ERROR: " << inName << " is not a valid restart file for step " << iThisCat << " on " << totTask << " tasks." << endl;
+
+	MPI_Allreduce(&isGood, &allGood, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+
+	if (!allGood)
+	{
+		MPI_Finalize();
+		exit(0);
+	}
+
+	nLocHalos[0] = thisHeader.nLocHalos;
+	nLocParts[0] = thisHeader.nLocParts;
+
+	locParts[0].resize(locHalos[0].size());
+	size_t iPart = 0;
+
+	for (int iH = 0; iH < locHalos[0].size(); iH++)
+	{
+		locParts[0][iH].resize(nPTypes);
+
+		for (int iT = 0; iT < nPTypes; iT++)
+		{
+			size_t nPart = nHaloParts[iH * nPTypes + iT];
+
+			locParts[0][iH][iT].assign(haloParts.begin() + iPart, haloParts.begin() + iPart + nPart);
+			iPart += nPart;
+
+			for (auto const& partID : locParts[0][iH][iT])
 			{
-				Halo progHalo = thisTree.progHalo[iP];
+				Particle thisParticle;
+				thisParticle.haloID = locHalos[0][iH].ID;
+				thisParticle.type = iT;
+				locMapParts[0][partID].push_back(thisParticle);
+			}
+		}
+	}
+
+#ifndef ZOOM
+	GlobalGrid[0].Init(nGrid, boxSize);
+
+	for (int iH = 0; iH < nLocHalos[0]; iH++)
+		GlobalGrid[0].AssignToGrid(locHalos[0][iH].X, iH);
+
+	GlobalGrid[0].SortHalos();
+	GlobalGrid[1].Init(nGrid, boxSize);
+#endif
+
+	lastCheckpoint = iThisCat;
+};
 
-				int nTotPt = 0, nTotComm = 0;
-		
-				for (int iA = 0; iA < nPTypes; iA++)
-					nTotPt += progHalo.nPart[iA];
 
-				for (int iA = 0; iA < nPTypes; iA++)
-					nTotComm += thisTree.nCommon[iA][iP];
+/* The connections of catalogs iThisCat - 1 and iThisCat only depend on the content of the input files of the two catalogs,
+ * on the settings used to read and compare them, and on the orphan halos carried over from the previous steps, which are 
+ * hashed with their particles. Moving or touching the input files does not invalidate the cache. */
+uint64_t IOSettings::LinkKey(int iThisCat)
+{
+	uint64_t thisKey = LinkCache::Hash(nullptr, 0);
+	int intSettings[11] = { 1, NPTYPES, nPTypes, totTask, locTask, nGrid, minPartCmp, minPartRead, bufferCells, localBuffer, 0 };
+	float floatSettings[3] = { boxSize, minMhiresRead, minMassRead };
+
+#ifdef ZOOM
+	intSettings[10] += 1;
+#endif
+#ifdef NOPTYPE
+	intSettings[10] += 2;
+#endif
+#ifdef GATHER_TREES
+	intSettings[10] += 4;
+#endif
+	/* The halos of a task then come from the files of all tasks: a change in any of them is a miss on its reader, and
+	 * thus for all tasks. The subvolume depends on the earlier catalogs too, so the halos held are part of the key */
+	if (redistributeHalos)
+		intSettings[10] += 8;
+
+	thisKey = LinkCache::Hash(intSettings, sizeof(intSettings), thisKey);
+	thisKey = LinkCache::Hash(floatSettings, sizeof(floatSettings), thisKey);
+	thisKey = LinkCache::Hash(inputFormat.data(), inputFormat.size(), thisKey);
+
+	for (int iC = iThisCat - 1; iC <= iThisCat; iC++)
+		for (auto fileList : { &haloFiles[iC], &partFiles[iC] })
+			for (auto const &fileName : *fileList)
+			{
+				uint64_t fileHash = LinkCache::FileHash(fileName, DigestName(fileName));
 
-				fileOut	<< nTotPt 		<< " " 
-                                	<< progHalo.ID		<< " "
-					<< nTotComm	 	<< endl;
+				thisKey = LinkCache::Hash(&fileHash, sizeof(uint64_t), thisKey);
 			}
-                }	// loop on merger tree
-		
-		fileOut.close();
-        }	// loop on iCatalog
+
+	if (redistributeHalos)
+		for (int iC = 0; iC < 2; iC++)
+			for (auto const &thisHalo : locHalos[iC])
+				thisKey = LinkCache::Hash(&thisHalo.ID, sizeof(uint64_t), thisKey);
+
+	for (int iH = 0; iH < locHalos[0].size(); iH++)
+	{
+		Halo &thisHalo = locHalos[0][iH];
+
+		if (!thisHalo.isToken)
+			continue;
+
+		thisKey = LinkCache::Hash(&thisHalo.ID, sizeof(uint64_t), thisKey);
+		thisKey = LinkCache::Hash(&thisHalo.nOrphanSteps, sizeof(int), thisKey);
+		thisKey = LinkCache::Hash(thisHalo.nPart, sizeof(thisHalo.nPart), thisKey);
+		thisKey = LinkCache::Hash(thisHalo.X, sizeof(thisHalo.X), thisKey);
+		thisKey = LinkCache::Hash(thisHalo.V, sizeof(thisHalo.V), thisKey);
+
+		if (iH < locParts[0].size())
+			for (auto const &typeParts : locParts[0][iH])
+				thisKey = LinkCache::Hash(typeParts.data(), typeParts.size() * sizeof(uint64_t), thisKey);
+	}
+
+	return thisKey;
+};
+
+
+/* The digest of an input file is found through its path */
+string IOSettings::DigestName(string fileName)
+{
+	char strKey[17];
+
+	sprintf(strKey, "%016llx", (unsigned long long) LinkCache::Hash(fileName.data(), fileName.size()));
+
+	return pathCache + "digest_" + strKey;
+};
+
+
+string IOSettings::LinkName(uint64_t thisKey)
+{
+	char strKey[17];
+
+	sprintf(strKey, "%016llx", (unsigned long long) thisKey);
+
+	return pathCache + "links_" + strKey;
+};
+
+
+/* Called once both catalogs have been read. If any task misses its entry, all of them compute the connections again, 
+ * since the buffer exchange and the comparison have to be done together */
+bool IOSettings::ReadLinks(int iThisCat)
+{
+	int isFound = 0, allFound = 0;
+
+	if (pathCache == "")
+		return false;
+
+	linkKey = LinkKey(iThisCat);
+	isFound = LinkCache::Read(LinkName(linkKey), linkKey);
+
+	MPI_Allreduce(&isFound, &allFound, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+
+	if (locTask == 0)
+		cout << "Cached halo connections for step " << iThisCat << (allFound ? " found." : " not found.") << endl;
+
+	/* The connections found by some tasks are overwritten by FindProgenitors */
+	return allFound;
+};
+
+
+void IOSettings::WriteLinks(int iThisCat)
+{
+	if (pathCache == "")
+		return;
+
+	if (!LinkCache::Write(LinkName(linkKey), linkKey))
+		cout << "WARNING: could not write " << LinkName(linkKey) << " on task=" << locTask << endl;
+};
+
+
+void IOSettings::WriteTreeAscii(ostream &fileOut, vector<MergerTree> &mergerTrees)
+{
+	int orphan = 0;
+
+	if (locTask == 0)
+	{
+		fileOut << "# ID host(1)   N particles host(2)   Num. progenitors(3)  Orphan[0=no, 1=yes](4)\n";
+		fileOut << "# Total particles (1)   ID progenitor(2)   Particles in common (3)\n";
+	} 
+
+        for (int iM = 0; iM < mergerTrees.size(); iM++)
+        {
+		MergerTree &thisTree = mergerTrees[iM];
+
+		if (thisTree.isOrphan)
+			orphan = 1;	
+		else
+			orphan = 0;
+
+		int nTotPt = 0;
+		for (int iA = 0; iA < nPTypes; iA++)
+			nTotPt += thisTree.mainHalo.nPart[iA];
+
+		fileOut << thisTree.mainHalo.ID 	<< " " 
+			<< nTotPt 			<< " " 
+			<< thisTree.idProgenitor.size() << " "
+			<< orphan << "\n";
+
+                for (int iP = 0; iP < thisTree.idProgenitor.size(); iP++)
+		{
+			Halo &progHalo = thisTree.progHalo[iP];
+
+			int nTotPt = 0, nTotComm = 0;
+	
+			for (int iA = 0; iA < nPTypes; iA++)
+				nTotPt += progHalo.nPart[iA];
+
+			for (int iA = 0; iA < nPTypes; iA++)
+				nTotComm += thisTree.nCommon[iA][iP];
+
+			fileOut	<< nTotPt 		<< " " 
+                               	<< progHalo.ID		<< " "
+				<< nTotComm	 	<< "\n";
+		}
+        }	// loop on merger tree
+	
 };
 
 
@@ -1153,7 +2044,13 @@ void IOSettings::WriteLog(int iNum, float time)
 #endif
 
 		outLogName = pathOutput + "timing_log." + strCpu + "." + strChu + ".txt";
-		fileLogOut.open(outLogName);
+
+		/* A restarted run continues the log of the previous one */
+		if (restartStep > 0)
+			fileLogOut.open(outLogName, ios::app);
+		else
+			fileLogOut.open(outLogName);
+
 		fileLogOut << "# ReadFile (1) Communication (2) ForwardTree (3) BackwardTree (4) SyncBuffer(5) Memory (6)" << endl;
 	} else if (iNum > 0) {
 		logTime.push_back(time);
@@ -1257,5 +2154,34 @@ tk::spline IOSettings::ReadPk()
 };
 
 
+/* Full history of each HaloTree, in four files: mass accretion history, trajectory, main branch IDs and all progenitors */
 void IOSettings::WriteSmoothTrees()
-{};
+{
+	if (minPartHistory > 0)
+		InitHaloTrees();
+
+	if (locHaloTrees.size() == 0)
+		return;
+
+	cout << "Writing the history of " << locHaloTrees.size() << " halos to " << pathOutput << endl;
+
+	for (int iH = 0; iH < locHaloTrees.size(); iH++)
+	{
+		HaloTree &haloTree = locHaloTrees[iH];
+
+		if (haloTree.nStep == 0)
+			continue;
+
+		string outName = pathOutput + outPrefix + "halo_" + to_string(haloTree.mainHalo[0].ID);
+
+		haloTree.FixTree();
+
+		if (smoothHistory)
+			haloTree.SmoothTree();
+
+		haloTree.WriteMAH(outName + ".mah", numSnaps, redShift);
+		haloTree.WriteTrajectory(outName + ".traj", numSnaps, redShift);
+		haloTree.WriteIDs(outName + ".ids");
+		haloTree.WriteMergerTree(outName + ".full_tree", numSnaps, redShift);
+	}
+};
@@ -22,9 +22,17 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <thread>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 #include "spline.h"
 #include "Halo.h"
 #include "Cosmology.h"
+#include "TreeDatabase.h"
+#include "TreeForest.h"
+#include "global_vars.h"
 
 using namespace std;
 
@@ -51,6 +59,10 @@ public:
 	string partPrefix;
 	string outPrefix;
 	string outSuffix;
+	string outFormat;	// ascii (default) or binary
+	string outDatabase;	// SQLite file for the main branches, in pathOutput
+	string simuCode;	// Stored with each main branch in the database
+	string pathCache;	// Folder for the cached halo connections of each step, empty to disable the cache
 
 	string cpuString;	
 	string splitString;
@@ -61,7 +73,7 @@ public:
 	string pathOutput;	// Where to dump all the output data
 	string pathTree;
 
-	string inputFormat;	// AHF, FoF, or anything else	// TODO only working with AHF for the moment
+	string inputFormat;	// AHF, Rockstar or MetroCPP, see CatalogReader
 
 	void Init(void);
 	void DistributeFilesAmongTasks(void);
@@ -79,18 +91,105 @@ public:
 	void SetCosmology(Cosmology*);
 
 	/* Read input */
-	void ReadLineAHF(const char *, Halo *);
 	void ReadParticles();
 	void ReadHalos();
 	void ReadTrees();
+	void ReadTreeSection(string, uint64_t, uint64_t);
+	void ReadTreeAscii(const char *, const char *);
+
+	/* Read the halos and particles of a catalog in the background, while the current step is being computed */
+	void PrefetchCatalog(int);
+	void WaitPrefetch(void);
 
 	/* Write output */
 	void WriteLog(int, float);
 	void WriteTree(int);
+	void WriteTreeAscii(ostream &, vector<MergerTree> &);
+	void WriteTreeFile(string, int, vector<MergerTree> &);
+	void WriteTreeShared(string, int, vector<MergerTree> &);
+	void FlushTrees(void);
+	void WaitTrees(void);
+
+	/* Restart files, written at the end of a step and read instead of the first catalog */
+	void WriteCheckpoint(int);
+	void ReadCheckpoint(int);
+
+	/* Cached halo connections: ReadLinks returns true if all tasks found them for this step */
+	bool ReadLinks(int);
+	void WriteLinks(int);
 	//void WriteTrees();
 	void WriteSmoothTrees();
 
 private:
+	/* Halos and particles of one catalog, read chunk by chunk before being moved to locHalos, locParts and locMapParts */
+	struct CatalogBuffer {
+		int iCat;
+		int nHaloChunks, nPartChunks;	// Chunks read so far
+		int iPartHalo;			// Next halo to be assigned a particle block
+		size_t nParts, nPartMulti;
+
+		vector<Halo> halos;
+		vector<uint64_t> skipIDs;	// Halos rejected at read time, sorted
+		vector<vector<vector<uint64_t>>> parts;
+		map<uint64_t, vector<Particle>> mapParts;
+
+		size_t Size(void);
+		void Clean(void);
+	};
+
+	/* Particles of one halo, as parsed by a reading thread */
+	struct ParticleBlock {
+		uint64_t haloID;
+		vector<uint64_t> partIDs;
+		vector<int> partTypes;
+	};
+
+	CatalogBuffer catBuffer;
+	thread prefetchThread;
+
+	/* Part of a tree file read by one task: a whole per-task file (iFile >= 0) or a section of a shared file (iFile = -1) */
+	struct TreeChunk {
+		int iFile;
+		uint64_t start, end;
+	};
+
+	void SendTreesToOwner(vector<MergerTree> &);
+
+	/* Trees of one snapshot waiting to be written by the writer thread */
+	struct TreeJob {
+		string outName;
+		int snapshot;
+		vector<MergerTree> trees;
+	};
+
+	deque<TreeJob> writeJobs;
+	thread writeThread;
+	mutex writeMutex;
+	condition_variable writeReady, writeDone;
+	bool writeStop;
+
+	TreeDatabase treeDatabase;
+	TreeForest treeForest;
+
+	// Step of the last restart files written or read, they are removed once newer ones are complete
+	int lastCheckpoint;
+
+	// Key of the link cache for the current step
+	uint64_t linkKey;
+	uint64_t LinkKey(int);
+	string LinkName(uint64_t);
+	string DigestName(string);
+
+	void QueueTree(string, int, vector<MergerTree> &);
+	void WriteTreeLoop(void);
+
+	void ReadHaloChunk(int, int, CatalogBuffer &);
+	bool KeepHalo(Halo &);
+	void ReadParticleChunk(int, int, vector<Halo> &, CatalogBuffer &);
+	void ReadBlockRange(string, size_t, size_t, vector<uint64_t> &, vector<ParticleBlock> &);
+	bool StoreParticleBlock(uint64_t, vector<uint64_t> &, vector<int> &, vector<Halo> &, CatalogBuffer &);
+	void PrefetchChunks(int);
+
 	/* Log file properties */
 	int iLogStep;
 	string outLogName;
@@ -0,0 +1,390 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * InputStream.cpp:
+ * Reads halo and particle catalogs line by line. Compressed catalogs (.gz with -DGZIP_INPUT, .zst with -DZSTD_INPUT)
+ * are decompressed as a stream on a separate thread, so that the expanded files never need to be written to disk.
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+#ifdef GZIP_INPUT
+#include <zlib.h>
+#endif
+
+#ifdef ZSTD_INPUT
+#include <zstd.h>
+#endif
+
+#include <mpi.h>
+
+#include "global_vars.h"
+#include "InputStream.h"
+
+using namespace std;
+
+
+InputStream::InputStream()
+{
+	compression = kPlain;
+	ringHead = 0; ringTail = 0; ringCount = 0;
+	thisSize = 0; thisPos = 0;
+	streamEnd = false; streamStop = false; streamError = false;
+};
+
+
+InputStream::~InputStream()
+{
+	Close();
+};
+
+
+int InputStream::Compression(string fileName)
+{
+	size_t nName = fileName.size();
+
+	if (nName > 3 && fileName.compare(nName - 3, 3, ".gz") == 0)
+		return kGzip;
+	else if (nName > 4 && fileName.compare(nName - 4, 4, ".zst") == 0)
+		return kZstd;
+	else
+		return kPlain;
+};
+
+
+bool InputStream::Open(string fileName)
+{
+	Close();
+	compression = Compression(fileName);
+
+	if (compression == kPlain)
+	{
+		filePlain.open(fileName);
+		return filePlain.good();
+	}
+
+#ifndef GZIP_INPUT
+	if (compression == kGzip)
+	{
+		cout << "ERROR: " << fileName << " is gzip-compressed, recompile with -DGZIP_INPUT to read it." << endl;
+		return false;
+	}
+#endif
+
+#ifndef ZSTD_INPUT
+	if (compression == kZstd)
+	{
+		cout << "ERROR: " << fileName << " is zstd-compressed, recompile with -DZSTD_INPUT to read it." << endl;
+		return false;
+	}
+#endif
+
+	/* Check that the file is there before starting the decompression */
+	ifstream fileExists(fileName);
+	if (!fileExists.good())
+		return false;
+
+	fileExists.close();
+
+	ringBlocks.resize(nRingBlocks);
+	ringSizes.resize(nRingBlocks);
+	ringHead = 0; ringTail = 0; ringCount = 0;
+	thisSize = 0; thisPos = 0;
+	streamEnd = false; streamStop = false; streamError = false;
+	streamName = fileName;
+
+	decompressThread = thread(&InputStream::Decompress, this, fileName);
+
+	return true;
+};
+
+
+void InputStream::Close()
+{
+	if (decompressThread.joinable())
+	{
+		/* The parser might stop before the end of the file, so make sure the decompressing thread is not waiting */
+		{
+			lock_guard<mutex> lock(ringMutex);
+			streamStop = true;
+		}
+
+		ringNotFull.notify_all();
+		decompressThread.join();
+	}
+
+	if (filePlain.is_open())
+		filePlain.close();
+
+	ringBlocks.clear();
+	ringBlocks.shrink_to_fit();
+	thisBlock.clear();
+	thisBlock.shrink_to_fit();
+};
+
+
+bool InputStream::GetLine(string &lineIn)
+{
+	if (compression == kPlain)
+		return (bool) getline(filePlain, lineIn);
+
+	lineIn.clear();
+
+	/* Lines can be split across two (or more) blocks, keep appending until a newline is found */
+	while (true)
+	{
+		if (thisPos == thisSize)
+			if (!PopBlock())
+				return (lineIn.size() > 0);
+
+		const char *thisStart = &thisBlock[thisPos];
+		size_t nLeft = thisSize - thisPos;
+		const char *thisEnd = (const char *) memchr(thisStart, '\n', nLeft);
+
+		if (thisEnd != nullptr)
+		{
+			lineIn.append(thisStart, thisEnd - thisStart);
+			thisPos += thisEnd - thisStart + 1;
+			return true;
+		}
+
+		lineIn.append(thisStart, nLeft);
+		thisPos = thisSize;
+	}
+};
+
+
+/* Only uncompressed files can be positioned at an arbitrary byte offset */
+bool InputStream::Seek(size_t filePos)
+{
+	if (compression != kPlain)
+		return false;
+
+	filePlain.clear();
+	filePlain.seekg(filePos);
+
+	return filePlain.good();
+};
+
+
+/* Main thread: take the next decompressed block out of the ring */
+bool InputStream::PopBlock()
+{
+	unique_lock<mutex> lock(ringMutex);
+	ringNotEmpty.wait(lock, [this]{ return ringCount > 0 || streamEnd; });
+
+	/* A broken file must not be taken for a shorter catalog. This might run on a prefetching thread, which cannot 
+	 * make MPI calls. */
+	if (ringCount == 0 && streamError)
+	{
+		int isMain = 0;
+
+		cout << "ERROR: " << streamName << " is corrupted or truncated on task=" << locTask << endl;
+		MPI_Is_thread_main(&isMain);
+
+		if (isMain)
+			MPI_Finalize();
+
+		exit(0);
+	}
+
+	if (ringCount == 0)
+		return false;
+
+	thisBlock.swap(ringBlocks[ringTail]);
+	thisSize = ringSizes[ringTail];
+	thisPos = 0;
+
+	ringTail = (ringTail + 1) % nRingBlocks;
+	ringCount--;
+
+	lock.unlock();
+	ringNotFull.notify_one();
+
+	return true;
+};
+
+
+/* Decompressing thread: hand a full block over to the ring, waiting if the parser is lagging behind */
+bool InputStream::PushBlock(vector<char> &block, size_t blockSize)
+{
+	unique_lock<mutex> lock(ringMutex);
+	ringNotFull.wait(lock, [this]{ return ringCount < nRingBlocks || streamStop; });
+
+	if (streamStop)
+		return false;
+
+	ringBlocks[ringHead].swap(block);
+	ringSizes[ringHead] = blockSize;
+
+	ringHead = (ringHead + 1) % nRingBlocks;
+	ringCount++;
+
+	lock.unlock();
+	ringNotEmpty.notify_one();
+
+	/* The block we got back from the ring might have never been allocated */
+	block.resize(sizeBlock);
+
+	return true;
+};
+
+
+void InputStream::SetError()
+{
+	lock_guard<mutex> lock(ringMutex);
+	streamError = true;
+};
+
+
+void InputStream::Decompress(string fileName)
+{
+#ifdef GZIP_INPUT
+	if (compression == kGzip)
+		DecompressGzip(fileName);
+#endif
+
+#ifdef ZSTD_INPUT
+	if (compression == kZstd)
+		DecompressZstd(fileName);
+#endif
+
+	{
+		lock_guard<mutex> lock(ringMutex);
+		streamEnd = true;
+	}
+
+	ringNotEmpty.notify_all();
+};
+
+
+#ifdef GZIP_INPUT
+void InputStream::DecompressGzip(string fileName)
+{
+	vector<char> block(sizeBlock);
+	int nRead = 0;
+
+	gzFile fileGz = gzopen(fileName.c_str(), "rb");
+
+	if (fileGz == nullptr)
+	{
+		cout << "ERROR: could not open " << fileName << " on task=" << locTask << endl;
+		SetError();
+		return;
+	}
+
+	gzbuffer(fileGz, 1024 * 1024);
+
+	bool isStopped = false;
+
+	while ((nRead = gzread(fileGz, &block[0], sizeBlock)) > 0)
+		if (!PushBlock(block, nRead))
+		{
+			isStopped = true;
+			break;
+		}
+
+	/* A truncated file only sets Z_BUF_ERROR, gzread then returns 0 as at the end of the file */
+	int errNum = Z_OK;
+	const char *errMsg = gzerror(fileGz, &errNum);
+
+	if (!isStopped && (nRead < 0 || errNum != Z_OK))
+	{
+		cout << "ERROR: " << errMsg << " while decompressing " << fileName << " on task=" << locTask << endl;
+		SetError();
+	}
+
+	gzclose(fileGz);
+};
+#endif
+
+
+#ifdef ZSTD_INPUT
+void InputStream::DecompressZstd(string fileName)
+{
+	vector<char> block(sizeBlock);
+	vector<char> buffIn(ZSTD_DStreamInSize());
+	size_t nRead = 0, nFill = 0, zRet = 0;
+	bool isFull = false, isBroken = false, isStopped = false;
+
+	FILE *fileZst = fopen(fileName.c_str(), "rb");
+
+	if (fileZst == nullptr)
+	{
+		cout << "ERROR: could not open " << fileName << " on task=" << locTask << endl;
+		SetError();
+		return;
+	}
+
+	ZSTD_DStream *streamZst = ZSTD_createDStream();
+	ZSTD_initDStream(streamZst);
+
+	while (!isBroken && (nRead = fread(&buffIn[0], 1, buffIn.size(), fileZst)) > 0)
+	{
+		ZSTD_inBuffer zIn = { &buffIn[0], nRead, 0 };
+
+		/* A full output block might leave some data inside the zstd stream, so keep going until it is flushed */
+		do {
+			ZSTD_outBuffer zOut = { &block[nFill], sizeBlock - nFill, 0 };
+			zRet = ZSTD_decompressStream(streamZst, &zOut, &zIn);
+
+			if (ZSTD_isError(zRet))
+			{
+				cout << "ERROR: " << ZSTD_getErrorName(zRet) << " while decompressing " << fileName
+					<< " on task=" << locTask << endl;
+				SetError();
+				isBroken = true;
+				break;
+			}
+
+			nFill += zOut.pos;
+			isFull = (nFill == sizeBlock);
+
+			if (isFull)
+			{
+				if (!PushBlock(block, nFill))
+				{
+					isStopped = isBroken = true;
+					break;
+				}
+
+				nFill = 0;
+			}
+
+		} while (zIn.pos < zIn.size || isFull);
+	}
+
+	if (!isBroken && nFill > 0)
+		isStopped = !PushBlock(block, nFill);
+
+	/* The last frame has not been completed if the file is truncated */
+	if (!isBroken && !isStopped && zRet != 0)
+	{
+		cout << "ERROR: " << fileName << " ends inside a zstd frame on task=" << locTask << endl;
+		SetError();
+	}
+
+	ZSTD_freeDStream(streamZst);
+	fclose(fileZst);
+};
+#endif
@@ -0,0 +1,85 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INPUTSTREAM_H
+#define INPUTSTREAM_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+
+/* Line-by-line reader for (possibly compressed) halo and particle files.
+ * Plain files are read with getline, .gz / .zst files are decompressed on a background thread which
+ * fills a bounded ring of blocks, so that the decompression overlaps the parsing on the main thread. */
+class InputStream {
+
+public:
+	InputStream();
+	~InputStream();
+
+	bool Open(string);
+	bool GetLine(string &);
+	bool Seek(size_t);
+	void Close(void);
+
+	// Compression type of the file, determined by its extension
+	enum { kPlain = 0, kGzip = 1, kZstd = 2 };
+	static int Compression(string);
+
+private:
+	int compression;
+	ifstream filePlain;
+
+	/* Ring buffer shared between the decompressing thread and the parser */
+	thread decompressThread;
+	mutex ringMutex;
+	condition_variable ringNotFull;
+	condition_variable ringNotEmpty;
+
+	vector<vector<char>> ringBlocks;
+	vector<size_t> ringSizes;
+	int ringHead, ringTail, ringCount;
+	bool streamEnd, streamStop;
+
+	/* Set by the decompressing thread if the file is corrupted or truncated, the parser stops at the end of the ring */
+	bool streamError;
+	string streamName;
+
+	/* Block currently being parsed on the main thread */
+	vector<char> thisBlock;
+	size_t thisSize, thisPos;
+
+	/* Size and number of the decompressed blocks in the ring */
+	static const size_t sizeBlock = 4 * 1024 * 1024;
+	static const int nRingBlocks = 8;
+
+	void Decompress(string);
+	void DecompressGzip(string);
+	void DecompressZstd(string);
+
+	bool PushBlock(vector<char> &, size_t);
+	void SetError(void);
+	bool PopBlock(void);
+};
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * LinkCache.cpp:
+ * On-disk cache of the halo connections of a pair of catalogs. The key is computed by IOSettings from the input files
+ * and the settings, the content is written and read with the same Checkpoint files used for restarting.
+ */
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+#include "global_vars.h"
+#include "Checkpoint.h"
+#include "LinkCache.h"
+
+#define LINK_VERSION 1
+
+using namespace std;
+
+
+static_assert(sizeof(LinkHeader) == 48, "Link cache header must be 48 bytes");
+static_assert(sizeof(FileDigest) == 40, "File digest must be 40 bytes");
+
+
+uint64_t LinkCache::Hash(const void *thisData, size_t nBytes, uint64_t thisHash)
+{
+	const unsigned char *thisBytes = (const unsigned char *) thisData;
+
+	for (size_t iB = 0; iB < nBytes; iB++)
+	{
+		thisHash ^= thisBytes[iB];
+		thisHash *= 1099511628211ULL;
+	}
+
+	return thisHash;
+};
+
+
+/* Hashing a whole catalog takes about as long as reading it, so the hash is only computed again when the size or the
+ * modification time of the file change. A missing or unreadable file gets the hash of no content at all. */
+uint64_t LinkCache::FileHash(string fileName, string digestName)
+{
+	struct stat info;
+	FileDigest thisDigest, oldDigest;
+	vector<char> fileBuffer(1 << 22);
+	size_t nRead = 0;
+
+	memset(&thisDigest, 0, sizeof(FileDigest));
+	memcpy(thisDigest.magic, "MCPPDIGS", 8);
+	thisDigest.hash = Hash(nullptr, 0);
+
+	if (stat(fileName.c_str(), &info) != 0)
+		return thisDigest.hash;
+
+	thisDigest.size = info.st_size;
+	thisDigest.mSec = info.st_mtim.tv_sec;
+	thisDigest.mNsec = info.st_mtim.tv_nsec;
+
+	FILE *fileDigest = fopen(digestName.c_str(), "rb");
+
+	if (fileDigest != nullptr)
+	{
+		bool isGood = (fread(&oldDigest, sizeof(FileDigest), 1, fileDigest) == 1);
+		fclose(fileDigest);
+
+		if (isGood && memcmp(oldDigest.magic, thisDigest.magic, 8) == 0 && oldDigest.size == thisDigest.size 
+			&& oldDigest.mSec == thisDigest.mSec && oldDigest.mNsec == thisDigest.mNsec)
+			return oldDigest.hash;
+	}
+
+	FILE *fileIn = fopen(fileName.c_str(), "rb");
+
+	if (fileIn == nullptr)
+		return thisDigest.hash;
+
+	while ((nRead = fread(fileBuffer.data(), 1, fileBuffer.size(), fileIn)) > 0)
+		thisDigest.hash = Hash(fileBuffer.data(), nRead, thisDigest.hash);
+
+	fclose(fileIn);
+
+	/* The digest is only an optimization, the hash is returned even if it cannot be stored */
+	fileDigest = fopen((digestName + ".tmp").c_str(), "wb");
+
+	if (fileDigest != nullptr)
+	{
+		bool isGood = (fwrite(&thisDigest, sizeof(FileDigest), 1, fileDigest) == 1);
+
+		if (fclose(fileDigest) == 0 && isGood)
+			rename((digestName + ".tmp").c_str(), digestName.c_str());
+		else
+			remove((digestName + ".tmp").c_str());
+	}
+
+	return thisDigest.hash;
+};
+
+
+/* The file is renamed once complete, so that an interrupted run never leaves a truncated cache entry */
+bool LinkCache::Write(string fileName, uint64_t thisKey)
+{
+	LinkHeader thisHeader;
+	Checkpoint thisFile;
+
+	memset(&thisHeader, 0, sizeof(LinkHeader));
+	memcpy(thisHeader.magic, "MCPPLINK", 8);
+	thisHeader.version = LINK_VERSION;
+	thisHeader.nPTypes = nPTypes;
+	thisHeader.sizeHalo = sizeof(Halo);
+	thisHeader.key = thisKey;
+	thisHeader.nTrees[0] = locMTrees[0].size();
+	thisHeader.nTrees[1] = locMTrees[1].size();
+
+	if (!thisFile.Open(fileName + ".tmp", true))
+		return false;
+
+	thisFile.Write(&thisHeader, sizeof(LinkHeader));
+
+	for (int iM = 0; iM < 2; iM++)
+	{
+		vector<Halo> mainHalos, progHalos;
+		vector<int32_t> isOrphan, nProgs, nCands, progCommon, candCommon;
+		vector<uint64_t> progIDs, candIDs;
+
+		for (auto &thisTree : locMTrees[iM])
+		{
+			mainHalos.push_back(thisTree.mainHalo);
+			isOrphan.push_back(thisTree.isOrphan);
+			nProgs.push_back(thisTree.progHalo.size());
+			nCands.push_back(thisTree.indexCommon.size());
+
+			for (int iP = 0; iP < thisTree.progHalo.size(); iP++)
+			{
+				progHalos.push_back(thisTree.progHalo[iP]);
+				progIDs.push_back(thisTree.idProgenitor[iP]);
+
+				for (int iT = 0; iT < nPTypes; iT++)
+					progCommon.push_back(thisTree.nCommon[iT][iP]);
+			}
+
+			for (auto const &thisCand : thisTree.indexCommon)
+			{
+				candIDs.push_back(thisCand.first);
+
+				for (int iT = 0; iT < nPTypes; iT++)
+					candCommon.push_back(thisCand.second[iT]);
+			}
+		}
+
+		thisFile.WriteVector(mainHalos);
+		thisFile.WriteVector(isOrphan);
+		thisFile.WriteVector(nProgs);
+		thisFile.WriteVector(nCands);
+		thisFile.WriteVector(progHalos);
+		thisFile.WriteVector(progIDs);
+		thisFile.WriteVector(progCommon);
+		thisFile.WriteVector(candIDs);
+		thisFile.WriteVector(candCommon);
+	}
+
+	if (!thisFile.Close())
+	{
+		remove((fileName + ".tmp").c_str());
+		return false;
+	}
+
+	return (rename((fileName + ".tmp").c_str(), fileName.c_str()) == 0);
+};
+
+
+bool LinkCache::Read(string fileName, uint64_t thisKey)
+{
+	LinkHeader thisHeader;
+	Checkpoint thisFile;
+
+	if (!thisFile.Open(fileName, false) || !thisFile.Read(&thisHeader, sizeof(LinkHeader)))
+		return false;
+
+	if (strncmp(thisHeader.magic, "MCPPLINK", 8) != 0 || thisHeader.version != LINK_VERSION || thisHeader.key != thisKey
+		|| thisHeader.nPTypes != nPTypes || thisHeader.sizeHalo != sizeof(Halo))
+		return false;
+
+	for (int iM = 0; iM < 2; iM++)
+	{
+		vector<Halo> mainHalos, progHalos;
+		vector<int32_t> isOrphan, nProgs, nCands, progCommon, candCommon;
+		vector<uint64_t> progIDs, candIDs;
+
+		bool isGood = thisFile.ReadVector(mainHalos) && thisFile.ReadVector(isOrphan) && thisFile.ReadVector(nProgs)
+			&& thisFile.ReadVector(nCands) && thisFile.ReadVector(progHalos) && thisFile.ReadVector(progIDs)
+			&& thisFile.ReadVector(progCommon) && thisFile.ReadVector(candIDs) && thisFile.ReadVector(candCommon);
+
+		if (!isGood || mainHalos.size() != thisHeader.nTrees[iM])
+			return false;
+
+		locMTrees[iM].clear();
+		locMTrees[iM].shrink_to_fit();
+		locMTrees[iM].resize(mainHalos.size());
+
+		size_t iProg = 0, iCand = 0;
+
+		for (size_t iL = 0; iL < mainHalos.size(); iL++)
+		{
+			MergerTree &thisTree = locMTrees[iM][iL];
+
+			thisTree.mainHalo = mainHalos[iL];
+			thisTree.isOrphan = isOrphan[iL];
+
+			for (int iP = 0; iP < nProgs[iL]; iP++, iProg++)
+			{
+				thisTree.progHalo.push_back(progHalos[iProg]);
+				thisTree.idProgenitor.push_back(progIDs[iProg]);
+
+				for (int iT = 0; iT < nPTypes; iT++)
+					thisTree.nCommon[iT].push_back(progCommon[iProg * nPTypes + iT]);
+			}
+
+			for (int iC = 0; iC < nCands[iL]; iC++, iCand++)
+				thisTree.indexCommon[candIDs[iCand]].assign(candCommon.begin() + iCand * nPTypes,
+						candCommon.begin() + (iCand + 1) * nPTypes);
+		}
+	}
+
+	/* After the backward comparison thisMap refers to 1 (including the buffer) and nextMap to 0 */
+	thisMapTrees.clear();
+	nextMapTrees.clear();
+
+	for (int iL = 0; iL < locMTrees[1].size(); iL++)
+		thisMapTrees[locMTrees[1][iL].mainHalo.ID] = iL;
+
+	for (int iL = 0; iL < locMTrees[0].size(); iL++)
+		nextMapTrees[locMTrees[0][iL].mainHalo.ID] = iL;
+
+	return true;
+};
@@ -0,0 +1,66 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LINKCACHE_H
+#define LINKCACHE_H
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+
+/* Link cache layout, one file per task and step, named after the key:
+ *	LinkHeader			magic, version, settings, key and number of forward and backward trees
+ *	for locMTrees[0] and [1]:	main halos, orphan flags, number of progenitors and of candidates of each tree,
+ *					progenitor halos, IDs and common particles (after AssignMap and SortByMerit),
+ *					then all the candidate IDs with their common particles by type (indexCommon) */
+struct LinkHeader {
+	char magic[8];			// "MCPPLINK"
+	int32_t version, nPTypes;
+	int32_t sizeHalo, unused;
+	uint64_t key;
+	uint64_t nTrees[2];
+};
+
+
+/* Content hash of an input file, valid as long as its size and modification time do not change */
+struct FileDigest {
+	char magic[8];			// "MCPPDIGS"
+	int64_t size, mSec, mNsec;
+	uint64_t hash;
+};
+
+
+/* Raw results of FindProgenitors in both directions, stored before the trees are gathered and cleaned so that
+ * they can be reused by runs that only change the later stages */
+class LinkCache {
+
+public:
+	// FNV-1a, can be chained passing the previous value
+	static uint64_t Hash(const void *, size_t, uint64_t = 14695981039346656037ULL);
+
+	// Hash of the content of a file, remembered in a small file together with the size and modification time
+	static uint64_t FileHash(string, string);
+
+	static bool Write(string, uint64_t);
+
+	// Fill locMTrees and the tree maps as FindProgenitors(0, 1) followed by FindProgenitors(1, 0) would
+	static bool Read(string, uint64_t);
+};
+
+#endif
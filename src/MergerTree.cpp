@@ -26,6 +26,9 @@
 #include <vector>
 #include <math.h>
 #include <map>
+#include <fstream>
+#include <thread>
+#include <functional>
 
 #include "MergerTree.h"
 #include "Halo.h"
@@ -39,6 +42,7 @@ using namespace std;
 
 HaloTree::HaloTree()
 {
+	nStep = 0;
 };
 
 
@@ -57,6 +61,156 @@ void HaloTree::Clean()
 	
 	mainHalo.clear();
 	progHalo.clear();
+	nStep = 0;
+};
+
+
+/* Token halos keep the position of their descendant: when the branch is found again at a later step, 
+ * positions and velocities are interpolated linearly (periodic box) between the two real halos */
+void HaloTree::FixTree()
+{
+	int iS = 1;
+
+	while (iS < nStep)
+	{
+		if (!mainHalo[iS].isToken)
+		{
+			iS++;
+			continue;
+		}
+
+		int iEnd = iS;
+
+		while (iEnd < nStep && mainHalo[iEnd].isToken)
+			iEnd++;
+
+		/* The branch ends with token halos, nothing to interpolate to */
+		if (iEnd == nStep)
+			break;
+
+		Halo &haloA = mainHalo[iS-1];
+		Halo &haloB = mainHalo[iEnd];
+
+		for (int iT = iS; iT < iEnd; iT++)
+		{
+			float fac = float(iT - iS + 1) / float(iEnd - iS + 1);
+
+			for (int iX = 0; iX < 3; iX++)
+			{
+				float dX = haloB.X[iX] - haloA.X[iX];
+
+				if (dX > 0.5 * boxSize)
+					dX -= boxSize;
+				else if (dX < -0.5 * boxSize)
+					dX += boxSize;
+
+				mainHalo[iT].X[iX] = fmod(haloA.X[iX] + fac * dX + boxSize, boxSize);
+				mainHalo[iT].V[iX] = haloA.V[iX] + fac * (haloB.V[iX] - haloA.V[iX]);
+			}
+		}
+
+		iS = iEnd;
+	}
+};
+
+
+/* A halo passing by (or through) the main branch halo can be temporarily counted in (or subtracted from) its mass. 
+ * Single-step jumps by more than facFlyBy with respect to both neighbours are replaced by their geometric mean */
+void HaloTree::SmoothTree()
+{
+	const float facFlyBy = 2.0;
+
+	for (int iS = 1; iS < nStep - 1; iS++)
+	{
+		Halo &thisHalo = mainHalo[iS];
+		float nPrev = mainHalo[iS-1].nAllPart();
+		float nNext = mainHalo[iS+1].nAllPart();
+		float nThis = thisHalo.nAllPart();
+
+		if (thisHalo.isToken || mainHalo[iS-1].isToken || mainHalo[iS+1].isToken || nThis == 0)
+			continue;
+
+		if (nThis > facFlyBy * max(nPrev, nNext) || nThis * facFlyBy < min(nPrev, nNext))
+		{
+			float fac = sqrt(nPrev * nNext) / nThis;
+
+			for (int iT = 0; iT < NPTYPES; iT++)
+				thisHalo.nPart[iT] = int(thisHalo.nPart[iT] * fac + 0.5);
+
+			thisHalo.mTot *= fac;
+		}
+	}
+};
+
+
+void HaloTree::WriteMAH(string fileName, vector<int> &snaps, vector<float> &zs)
+{
+	ofstream fileOut(fileName);
+
+	fileOut << "# snapshot(1) z(2) ID(3) nPart(4) mTot(5) rVir(6) vMax(7) token(8)\n";
+
+	for (int iS = 0; iS < nStep; iS++)
+	{
+		Halo &thisHalo = mainHalo[iS];
+
+		fileOut << snaps[iS] << " " << zs[iS] << " " << thisHalo.ID << " " << thisHalo.nAllPart() << " " 
+			<< thisHalo.mTot << " " << thisHalo.rVir << " " << thisHalo.vMax << " " << thisHalo.isToken << "\n";
+	}
+};
+
+
+void HaloTree::WriteTrajectory(string fileName, vector<int> &snaps, vector<float> &zs)
+{
+	ofstream fileOut(fileName);
+
+	fileOut << "# snapshot(1) z(2) ID(3) X(4) Y(5) Z(6) VX(7) VY(8) VZ(9) token(10)\n";
+
+	for (int iS = 0; iS < nStep; iS++)
+	{
+		Halo &thisHalo = mainHalo[iS];
+
+		fileOut << snaps[iS] << " " << zs[iS] << " " << thisHalo.ID;
+
+		for (int iX = 0; iX < 3; iX++)
+			fileOut << " " << thisHalo.X[iX];
+
+		for (int iX = 0; iX < 3; iX++)
+			fileOut << " " << thisHalo.V[iX];
+
+		fileOut << " " << thisHalo.isToken << "\n";
+	}
+};
+
+
+/* Same as MTree.dump_to_file_id in python/mtreelib */
+void HaloTree::WriteIDs(string fileName)
+{
+	ofstream fileOut(fileName);
+
+	for (int iS = 0; iS < nStep; iS++)
+		fileOut << mainHalo[iS].ID << "\n";
+};
+
+
+/* Main branch halo at each snapshot, followed by all its progenitors */
+void HaloTree::WriteMergerTree(string fileName, vector<int> &snaps, vector<float> &zs)
+{
+	ofstream fileOut(fileName);
+
+	fileOut << "# snapshot(1) z(2)\n";
+	fileOut << "# ID host(1)   N particles host(2)   Num. progenitors(3)  Token[0=no, 1=yes](4)\n";
+	fileOut << "# N particles (1)   ID progenitor(2)\n";
+
+	for (int iS = 0; iS < nStep; iS++)
+	{
+		Halo &thisHalo = mainHalo[iS];
+
+		fileOut << "# " << snaps[iS] << " " << zs[iS] << "\n";
+		fileOut << thisHalo.ID << " " << thisHalo.nAllPart() << " " << progHalo[iS].size() << " " << thisHalo.isToken << "\n";
+
+		for (int iP = 0; iP < progHalo[iS].size(); iP++)
+			fileOut << progHalo[iS][iP].nAllPart() << " " << progHalo[iS][iP].ID << "\n";
+	}
 };
 
 
@@ -247,24 +401,126 @@ void MergerTree::SortByMerit()
 		* These are general functions which do not belong to the class Merger Tree *
 		****************************************************************************/
 
+/* Tree of the halo holding a particle. Halos without a tree are counted on the first one, as the map would do when 
+ * accessed with [], and are recorded by the first thread so that they can be added to the map afterwards. */
+static int TreeIndex(uint64_t haloID, int iThread, vector<uint64_t> &lostIDs)
+{
+	auto thisTree = thisMapTrees.find(haloID);
+
+	if (thisTree != thisMapTrees.end())
+		return thisTree->second;
+
+	if (iThread == 0)
+		lostIDs.push_back(haloID);
+
+	return 0;
+};
+
+
+/* Split a loop on the particles among nMatchThreads threads (the calling one included). Each thread only updates the
+ * trees whose index modulo the number of threads is its own, so that no tree is written by two threads and the result 
+ * does not depend on the number of threads. The maps are only read in the meantime. */
+static void RunThreads(function<void(int, int, vector<uint64_t> &)> threadLoop)
+{
+	int nThreads = max(1, nMatchThreads);
+	vector<vector<uint64_t>> lostIDs(nThreads);
+	vector<thread> matchThreads;
+
+	for (int iT = 1; iT < nThreads; iT++)
+		matchThreads.push_back(thread(threadLoop, iT, nThreads, ref(lostIDs[iT])));
+
+	threadLoop(0, nThreads, lostIDs[0]);
+
+	for (auto &thisThread : matchThreads)
+		thisThread.join();
+
+	for (auto const& lostID : lostIDs[0])
+		thisMapTrees[lostID];
+};
+
+
+/* Here we loop on all the particles, each particle keeps track of the Halos it belongs to. 
+ * We match particle IDs in iOne with particle IDs in iTwo, and count the total number of 
+ * particles shared by their two host halos. */
+static void CountThreadParticles(int iOne, int iTwo, int iThread, int nThreads, vector<uint64_t> &lostIDs)
+{
+	static const vector<Particle> noParticle;
+
+	for (auto const& thisMap : locMapParts[iOne]) 
+	{
+		uint64_t thisID = thisMap.first;				// This particle ID
+		const vector<Particle> &thisParticle = thisMap.second;	 	// How many halos (halo IDs) share this particle
+		const vector<Particle> *nextParticle = nullptr;
+
+		/* Loop on the halos on iOne to which this particle belongs */
+		for (int iH = 0; iH < thisParticle.size(); iH++)
+		{
+			int thisTreeIndex = TreeIndex(thisParticle[iH].haloID, iThread, lostIDs);
+
+			if (thisTreeIndex % nThreads != iThread)
+				continue;
+
+			/* The halos of iTwo holding this particle are looked up once */
+			if (nextParticle == nullptr)
+			{
+				auto nextMap = locMapParts[iTwo].find(thisID);
+
+				nextParticle = (nextMap != locMapParts[iTwo].end()) ? &nextMap->second : &noParticle;
+			}
+	
+			/* This same particle on iTwo is also shared by some halos: do the match with the haloIDs on iOne. */
+			for (int iN = 0; iN < nextParticle->size(); iN++)
+			{
+				uint64_t nextHaloID = (*nextParticle)[iN].haloID;
+
+				/* If this ID is not in the list of progenitor IDs, then initialize the indexCommon 
+				   map and initialize the number of common particles */
+				if (locMTrees[iOne][thisTreeIndex].indexCommon.find(nextHaloID) == 
+					locMTrees[iOne][thisTreeIndex].indexCommon.end())
+				{
+					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID].resize(nPTypes);
+					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID][(*nextParticle)[iN].type] = 1;
+				} else {	/* If the Halo ID is already in the index of the halos with common particles,
+						   then add ++ to the particle type shared */ 
+					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID][(*nextParticle)[iN].type]++;
+				}
+			} // Loop on the halos in the iTwo particles
+		} // Loop on the halos in the iOne particles  
+	} // Loop on all the iOne particles
+};
+
+
+static void CountCommonParticles(int iOne, int iTwo)
+{
+	RunThreads([iOne, iTwo](int iThread, int nThreads, vector<uint64_t> &lostIDs) 
+		{ CountThreadParticles(iOne, iTwo, iThread, nThreads, lostIDs); });
+};
+
+
 #ifndef ZOOM		
 
 /* This is a very fast way of comparing particles content of halos across snapshots, that relies on maps 
  * and scales linearly with the number of particles on each task */
 
 void FindProgenitors(int iOne, int iTwo)
+{
+	MatchParticles(iOne, iTwo);
+	AssignProgenitors(iOne, iTwo);
+};
+
+
+/* Allocate the merger trees of iOne and count the particles they share with the halos of iTwo. 
+ * In the forward comparison the buffer only contributes halos of iTwo, so this can be done before it has been received
+ * and completed later by MatchBufferParticles. */
+void MatchParticles(int iOne, int iTwo)
 {
 	int nLoopHalos[2]; 
 
 	/* Loop also on the buffer halos, in the backward loop only! */
 	if (iOne == 1)
-	{
 		nLoopHalos[iOne] = nLocHalos[iOne] + locBuffHalos.size();
-		nLoopHalos[iTwo] = nLocHalos[iTwo]; 
-	} else {
+	else
 		nLoopHalos[iOne] = nLocHalos[iOne];
-		nLoopHalos[iTwo] = nLocHalos[iTwo] + locBuffHalos.size();
-	}
 
 	locMTrees[iOne].clear();
 	locMTrees[iOne].shrink_to_fit();
@@ -274,10 +530,7 @@ void FindProgenitors(int iOne, int iTwo)
 
 #ifdef VERBOSE
 	if (locTask == 0)
-	{
 		cout << iOne << ", Loop, " << nLocHalos[iOne] << ",  iTwo " << iTwo << " " << nLocHalos[iTwo] << endl;
-		cout << iOne << ", Loc , " << nLoopHalos[iOne] << ",  iTwo " << iTwo << " " << nLoopHalos[iTwo] << endl;
-	}
 #endif
 
 	/* Reset the tree maps for the inverse comparison */
@@ -308,6 +561,70 @@ void FindProgenitors(int iOne, int iTwo)
 		locMTrees[iOne][iL].mainHalo = thisHalo; 
 	}
 
+	/* Count the particles shared by the halos on iOne and iTwo */
+	CountCommonParticles(iOne, iTwo);
+};
+
+
+/* Add to the forward trees the particles shared with the buffer halos, once they have been received. 
+ * This is the same as running MatchParticles(0, 1) with the buffer already in locMapParts[1], as each pair of 
+ * particles sharing an ID is counted once either way. */
+static void MatchBufferThread(int iThread, int nThreads, vector<uint64_t> &lostIDs)
+{
+	for (int iB = 0; iB < locBuffHalos.size(); iB++)
+	{
+		uint64_t nextHaloID = locBuffHalos[iB].ID;
+
+		for (int iT = 0; iT < locBuffParts[iB].size(); iT++)
+			for (auto const& thisID : locBuffParts[iB][iT])
+			{
+				auto thisMap = locMapParts[0].find(thisID);
+
+				if (thisMap == locMapParts[0].end())
+					continue;
+
+				for (auto const& thisParticle : thisMap->second)
+				{
+					int thisTreeIndex = TreeIndex(thisParticle.haloID, iThread, lostIDs);
+
+					if (thisTreeIndex % nThreads != iThread)
+						continue;
+
+					vector<int> &thisCommon = locMTrees[0][thisTreeIndex].indexCommon[nextHaloID];
+
+					if (thisCommon.size() == 0)
+						thisCommon.resize(nPTypes);
+
+					thisCommon[iT]++;
+				}
+			}
+	}
+};
+
+
+void MatchBufferParticles()
+{
+	RunThreads(MatchBufferThread);
+};
+
+
+/* Select the progenitors among the halos sharing particles and sort them. The halos of iTwo, including the buffer
+ * in the forward comparison, are mapped here. */
+void AssignProgenitors(int iOne, int iTwo)
+{
+	int nLoopHalos[2]; 
+	Halo thisHalo;
+
+	if (iOne == 1)
+		nLoopHalos[iTwo] = nLocHalos[iTwo]; 
+	else
+		nLoopHalos[iTwo] = nLocHalos[iTwo] + locBuffHalos.size();
+
+#ifdef VERBOSE
+	if (locTask == 0)
+		cout << iOne << ", Loc , " << locMTrees[iOne].size() << ",  iTwo " << iTwo << " " << nLoopHalos[iTwo] << endl;
+#endif
+
 	/* Map the iTwo halo IDs to their indexes */
 	for (int iL = 0; iL < nLoopHalos[iTwo]; iL++)
 	{
@@ -326,42 +643,6 @@ void FindProgenitors(int iOne, int iTwo)
 		nextMapTrees[thisHalo.ID] = iL;
 	}
 
-	/* Here we loop on all the particles, each particle keeps track of the Halos it belongs to. 
-	 * We match particle IDs in iOne with particle IDs in iTwo, and count the total number of 
-	 * particles shared by their two host halos. */
-	for (auto const& thisMap : locMapParts[iOne]) 
-	{
-		uint64_t thisID = thisMap.first;		// This particle ID
-		vector<Particle> thisParticle = thisMap.second;	 	// How many halos (halo IDs) share this particle
-
-		/* Loop on the halos on iOne to which this particle belongs */
-		for (int iH = 0; iH < thisParticle.size(); iH++)
-		{
-			vector<Particle> nextParticle = locMapParts[iTwo][thisID];
-			int thisTreeIndex = thisMapTrees[thisParticle[iH].haloID];
-	
-			/* This same particle on iTwo is also shared by some halos: do the match with the haloIDs on iOne. */
-			for (int iN = 0; iN < nextParticle.size(); iN++)
-			{
-				uint64_t nextHaloID = nextParticle[iN].haloID;
-
-				/* If this ID is not in the list of progenitor IDs, then initialize the indexCommon 
-				   map and initialize the number of common particles */
-				if (locMTrees[iOne][thisTreeIndex].indexCommon.find(nextHaloID) == 
-					locMTrees[iOne][thisTreeIndex].indexCommon.end())
-				{
-					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID].resize(nPTypes);
-					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID][nextParticle[iN].type] = 1;
-				} else {	/* If the Halo ID is already in the index of the halos with common particles,
-						   then add ++ to the particle type shared */ 
-					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID][nextParticle[iN].type]++;
-				}
-			} // Loop on the halos in the iTwo particles
-		} // Loop on the halos in the iOne particles  
-	} // Loop on all the iOne particles
-
-	int iOrph = 0;
-
 	/* Once the first loop on the particles is done, we need to fix ALL merger trees
 	   moving all the data stored in the map to the "standard" index & id vectors */
 	for (int iM = 0; iM < locMTrees[iOne].size(); iM++)
@@ -389,7 +670,7 @@ void FindProgenitors(int iOne, int iTwo)
 		if (locMTrees[iOne][iM].progHalo.size() > 1)
 			locMTrees[iOne][iM].SortByMerit();
 	}
-};		/* End of the find progenitor function in full box mode */
+};		/* End of the find progenitor functions in full box mode */
 
 
 #else		 /* ---------> ZOOM MODE <------------ */
@@ -437,39 +718,8 @@ void FindProgenitors(int iOne, int iTwo)
 		nextMapTrees[thisHalo.ID] = iL;
 	}
 
-	/* Here we loop on all the particles, each particle keeps track of the Halos it belongs to. 
-	 * We match particle IDs in iOne with particle IDs in iTwo, and count the total number of 
-	 * particles shared by their two host halos. */
-	for (auto const& thisMap : locMapParts[iOne]) 
-	{
-		uint64_t thisID = thisMap.first;		// This particle ID
-		vector<Particle> thisParticle = thisMap.second;	 	// How many halos (halo IDs) share this particle
-
-		/* Loop on the halos on iOne to which this particle belongs */
-		for (int iH = 0; iH < thisParticle.size(); iH++)
-		{
-			vector<Particle> nextParticle = locMapParts[iTwo][thisID];
-			int thisTreeIndex = thisMapTrees[thisParticle[iH].haloID];
-	
-			/* This same particle on iTwo is also shared by some halos: do the match with the haloIDs on iOne. */
-			for (int iN = 0; iN < nextParticle.size(); iN++)
-			{
-				uint64_t nextHaloID = nextParticle[iN].haloID;
-
-				/* If this ID is not in the list of progenitor IDs, then initialize the indexCommon 
-				   map and initialize the number of common particles */
-				if (locMTrees[iOne][thisTreeIndex].indexCommon.find(nextHaloID) == 
-					locMTrees[iOne][thisTreeIndex].indexCommon.end())
-				{
-					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID].resize(nPTypes);
-					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID][nextParticle[iN].type] = 1;
-				} else {	/* If the Halo ID is already in the index of the halos with common particles,
-						   then add ++ to the particle type shared */ 
-					locMTrees[iOne][thisTreeIndex].indexCommon[nextHaloID][nextParticle[iN].type]++;
-				}
-			} // Loop on the halos in the iTwo particles
-		} // Loop on the halos in the iOne particles  
-	} // Loop on all the iOne particles
+	/* Count the particles shared by the halos on iOne and iTwo */
+	CountCommonParticles(iOne, iTwo);
 
 	int iOrph = 0;
 
@@ -719,78 +969,63 @@ void AssignProgenitor()
 };
 
 
-/* When re-loading the merger trees initialize for each halo at z = 0 the HaloTree, which will contain all its descendants */
+/* Each halo at z = 0 with at least minPartHistory particles has a HaloTree, filled walking its main branch in the tree graph */
 void InitHaloTrees()
 {
 	if (locTask == 0)
 		cout << "Initializing halo trees..." << endl;
 
-	id2Index.resize(2);
-	locHaloTrees.resize(nLocHalos[0]);
+	locHaloTrees.clear();
 
-	for (int iH = 0; iH < locCleanTrees[0].size(); iH++) 
+	for (int32_t iRoot = 0; iRoot < locTreeGraph.First(1); iRoot++) 
 	{
-		locHaloTrees[iH].mainHalo.resize(nSnapsUse); 
-		locHaloTrees[iH].progHalo.resize(nSnapsUse);
-		locHaloTrees[iH].mainHalo[0] = locCleanTrees[0][iH].mainHalo;
+		if (locTreeGraph.halos[iRoot].nPart < minPartHistory)
+			continue;
 
-		//if (locCleanTrees[0][iH].mainHalo.ID != locHalos[0][iH].ID)
-		//	locHalos[0][iH].Info();
-			//cout << iH << " " << locHalos[0][iH].ID << endl;
-	}
-};
+		locHaloTrees.emplace_back();
 
+		HaloTree &haloTree = locHaloTrees.back();
+		haloTree.nStep = 0;
+		haloTree.mainHalo.resize(nSnapsUse); 
+		haloTree.progHalo.resize(nSnapsUse);
 
-/* Starting from redshift zero we build the tree backwards */
-void BuildTrees()
-{
-	if (locTask == 0)
-		cout << "Building trees..." << endl;
-
-	map<uint64_t, int>::iterator it;
-
-	int iFound = 0, iNotFound = 0, iOrph = 0;
-	int nHaloTrees = locCleanTrees[iNumCat-1].size();
-
-	for (int iC = 0; iC < nHaloTrees; iC++)
-	{
-		uint64_t mainProgID = locCleanTrees[iNumCat-1][iC].progHalo[0].ID;
-	
-		it = id2Index[1].find(mainProgID);
-
-		/* If the main progenitor is found here, otherwise add it to the list of trees to be updated */
-		if (it != id2Index[1].end())
+		for (int32_t iNode = iRoot; iNode >= 0; iNode = locTreeGraph.mainProg[iNode])
 		{
-			//if (it->second > nLocHalos[1])
-			//	cout << "buffer halo: " << it-> second << endl;
+			int iStep = haloTree.nStep;
 
-			iFound++;	
-		} else {
+			locTreeGraph.GetHalo(iNode, haloTree.mainHalo[iStep]);
 
-			if (locCleanTrees[iNumCat-1][iC].isOrphan)
+			for (int32_t iProg = locTreeGraph.mainProg[iNode]; iProg >= 0; iProg = locTreeGraph.nextProg[iProg])
 			{
-				iOrph++;
-				// It's an orphan halo, just replicate it at the next step
-			} else {
-				// If this is not an orphan halo, we may need to look for it on another task
-				iNotFound++;
+				haloTree.progHalo[iStep].emplace_back();
+				locTreeGraph.GetHalo(iProg, haloTree.progHalo[iStep].back());
 			}
-				/*
-					cout << iC << ", Orphan halo " << locCleanTrees[iNumCat-1][iC].mainHalo.ID << endl;
-					if (locCleanTrees[iNumCat-1][iC].progHalos[0].isToken);
-					cout << iC << ", Token halo " << locCleanTrees[iNumCat-1][iC].progHalos[0].isToken << endl;
-				*/
-
-			//locCleanTrees[iNumCat-1][iC].mainHalo.Info();
-			//locCleanTrees[iNumCat-1][iC].progHalos[0].Info();
-			//cout << mainProgID << " " << it->second << " " << it->first << endl;
+
+			haloTree.nStep++;
 		}
+
+		/* Halos without progenitors are not part of any history */
+		if (haloTree.nStep == 1)
+			haloTree.nStep = 0;
 	}
-	
-	if (locTask == 0)
-		cout << "OnTask = " << locTask << " nHalos: " << nHaloTrees << " found: " << iFound 
-			<< " not found: " << iNotFound << " orphans: " << iOrph << endl; 
+};
 
+
+/* Starting from redshift zero we build the tree backwards, adding the clean trees of each step to the tree graph */
+void BuildTrees()
+{
+	int iStep = iNumCat - 1;
+	int minPartRoot = minPartHistory;
+
+	/* Trees are only needed for the histories and the forest file, the smallest of the enabled thresholds is kept */
+	if (outForest && (minPartHistory <= 0 || minPartForest < minPartHistory))
+		minPartRoot = minPartForest;
+
+	locTreeGraph.AddStep(locCleanTrees[iStep], iStep, minPartRoot);
+
+	if (locTask == 0)
+		cout << "OnTask = " << locTask << " tree graph halos: " << locTreeGraph.Size() << " steps: " 
+			<< locTreeGraph.NSteps() << endl; 
 };
 
 
@@ -20,6 +20,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "Halo.h"
 
@@ -58,9 +59,9 @@ public:
 	HaloTree();
 	~HaloTree();
 
-	int nStep;
+	int nStep;					// Number of snapshots along the main branch
 	
-	/* main descendant halo at z=0 */
+	/* main branch halo at each snapshot, starting from the z=0 halo */
 	vector<Halo> mainHalo;				
 
 	/* Vector of n steps, each step containing all progenitor halos */
@@ -71,10 +72,11 @@ public:
 	void FixTree(void);				// Looks for missing subhalos and fixes with token halos at the missing positions
 	void Clean(void);
 
-	void WriteMergerTree(void);			// Prints all the informations 
-	void WriteTrajectory(void);
-	void WriteMAH(void);
-	void WriteIDs(void);				// Only print the ID of each halo and its main progenitor
+	/* Output files, the snapshot numbers and redshifts are those of IOSettings (index 0 is z=0) */
+	void WriteMergerTree(string, vector<int> &, vector<float> &);	// Prints all the informations 
+	void WriteTrajectory(string, vector<int> &, vector<float> &);
+	void WriteMAH(string, vector<int> &, vector<float> &);
+	void WriteIDs(string);				// Only print the ID of each halo and its main progenitor
 };
 
 
@@ -91,12 +93,21 @@ void AssignDescendant(void);
 void AssignProgenitor(void);
 void InitHaloTrees(void);
 void SyncIndex(void);
+
+/* Add the clean trees of the current step to locTreeGraph */
 void BuildTrees(void);
 void FreeMergerTrees(int);
 
 // Pairwise comparison of halos
 void FindProgenitors(int, int);
 
+#ifndef ZOOM
+/* The two stages of FindProgenitors, the buffer particles can be added in between in the forward comparison */
+void MatchParticles(int, int);
+void MatchBufferParticles(void);
+void AssignProgenitors(int, int);
+#endif
+
 #ifdef ZOOM
 // Decide whether to compare two halos
 bool CompareHalos(int, int, int, int);
@@ -0,0 +1,234 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * TreeDatabase.cpp:
+ * Export of the main branches to SQLite (-DSQLITE_OUTPUT). The rows are inserted with a single prepared statement 
+ * within large transactions, with the journal in WAL mode; the index on haloID is created once all rows are in.
+ */
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#ifdef SQLITE_OUTPUT
+#include <sqlite3.h>
+#endif
+
+#include "global_vars.h"
+#include "TreeDatabase.h"
+
+#define DB_ROWS_TRANSACTION 100000
+
+using namespace std;
+
+
+TreeDatabase::TreeDatabase()
+{
+	nSteps = 0; iStep = 0; minPart = 0;
+};
+
+
+void TreeDatabase::Init(string thisName, string thisCode, int thisSteps, int thisMinPart)
+{
+	dbName = thisName;
+	simuCode = thisCode;
+	nSteps = thisSteps;
+	minPart = thisMinPart;
+	iStep = 0;
+
+	branchIDs.clear();
+	branchParts.clear();
+	progBranch.clear();
+};
+
+
+/* As in mtreelib.read_mtree.ReadSettings.read_trees: the first snapshot starts one branch per descendant with at least
+ * one progenitor, at the following ones a branch continues with the descendant whose ID is its last main progenitor */
+void TreeDatabase::AddStep(vector<MergerTree> &mergerTrees)
+{
+	unordered_map<uint64_t, size_t> nextBranch;
+
+	if (!IsActive() || iStep >= nSteps)
+		return;
+
+	nextBranch.reserve(progBranch.size());
+
+	for (size_t iM = 0; iM < mergerTrees.size(); iM++)
+	{
+		MergerTree &thisTree = mergerTrees[iM];
+		size_t iB = 0;
+
+		if (thisTree.progHalo.size() == 0)
+			continue;
+
+		if (iStep == 0)
+		{
+			iB = branchParts.size() / nSteps;
+			branchIDs.resize(branchIDs.size() + nSteps, 0);
+			branchParts.resize(branchParts.size() + nSteps, 0);
+		} else {
+			auto thisBranch = progBranch.find(thisTree.mainHalo.ID);
+
+			if (thisBranch == progBranch.end())
+				continue;
+
+			iB = thisBranch->second;
+		}
+
+		int nTotPt = 0;
+		for (int iA = 0; iA < nPTypes; iA++)
+			nTotPt += thisTree.mainHalo.nPart[iA];
+
+		branchIDs[iB * nSteps + iStep] = thisTree.mainHalo.ID;
+		branchParts[iB * nSteps + iStep] = nTotPt;
+		nextBranch[thisTree.progHalo[0].ID] = iB;
+	}
+
+	progBranch.swap(nextBranch);
+	iStep++;
+};
+
+
+bool TreeDatabase::Save(Checkpoint &thisCheckpoint)
+{
+	vector<uint64_t> progIDs, progIndex;
+
+	for (auto const &thisProg : progBranch)
+	{
+		progIDs.push_back(thisProg.first);
+		progIndex.push_back(thisProg.second);
+	}
+
+	return thisCheckpoint.Write(&iStep, sizeof(int)) && thisCheckpoint.WriteVector(branchIDs) 
+		&& thisCheckpoint.WriteVector(branchParts) && thisCheckpoint.WriteVector(progIDs) && thisCheckpoint.WriteVector(progIndex);
+};
+
+
+bool TreeDatabase::Load(Checkpoint &thisCheckpoint)
+{
+	vector<uint64_t> progIDs, progIndex;
+
+	if (!(thisCheckpoint.Read(&iStep, sizeof(int)) && thisCheckpoint.ReadVector(branchIDs) 
+		&& thisCheckpoint.ReadVector(branchParts) && thisCheckpoint.ReadVector(progIDs) && thisCheckpoint.ReadVector(progIndex)))
+		return false;
+
+	progBranch.clear();
+	progBranch.reserve(progIDs.size());
+
+	for (size_t iP = 0; iP < progIDs.size(); iP++)
+		progBranch[progIDs[iP]] = progIndex[iP];
+
+	return true;
+};
+
+
+#ifdef SQLITE_OUTPUT
+bool TreeDatabase::Write()
+{
+	sqlite3 *thisDb = nullptr;
+	sqlite3_stmt *insertHalo = nullptr;
+	size_t nBranches = 0, nRows = 0;
+	bool isGood = true;
+	string strSteps = to_string(nSteps);
+
+	/* Same table as SQL_IO.halo_table, the particle numbers and IDs along the main branch are comma-separated lists */
+	string createTable = "CREATE TABLE IF NOT EXISTS halo (haloID INT64, simuCode VARCHAR(10), "
+		"allNumPart INT ARRAY[" + strSteps + "], allHaloIDs INT64 ARRAY[" + strSteps + "], "
+		"X FLOAT ARRAY[" + strSteps + "], Y FLOAT ARRAY[" + strSteps + "], Z FLOAT ARRAY[" + strSteps + "], "
+		"VX FLOAT ARRAY[" + strSteps + "], VY FLOAT ARRAY[" + strSteps + "], VZ FLOAT ARRAY[" + strSteps + "])";
+
+	if (!IsActive())
+		return true;
+
+	if (sqlite3_open(dbName.c_str(), &thisDb) != SQLITE_OK)
+	{
+		cout << "ERROR: could not open database " << dbName << ": " << sqlite3_errmsg(thisDb) << endl;
+		sqlite3_close(thisDb);
+		return false;
+	}
+
+	isGood = sqlite3_exec(thisDb, "PRAGMA journal_mode = WAL", nullptr, nullptr, nullptr) == SQLITE_OK
+		&& sqlite3_exec(thisDb, "PRAGMA synchronous = NORMAL", nullptr, nullptr, nullptr) == SQLITE_OK
+		&& sqlite3_exec(thisDb, createTable.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK
+		&& sqlite3_prepare_v2(thisDb, "INSERT INTO halo (haloID, simuCode, allNumPart, allHaloIDs) VALUES (?, ?, ?, ?)", 
+				-1, &insertHalo, nullptr) == SQLITE_OK
+		&& sqlite3_exec(thisDb, "BEGIN TRANSACTION", nullptr, nullptr, nullptr) == SQLITE_OK;
+
+	if (nSteps > 0)
+		nBranches = branchParts.size() / nSteps;
+
+	for (size_t iB = 0; iB < nBranches && isGood; iB++)
+	{
+		string strParts, strIDs;
+		string strMainID = to_string(branchIDs[iB * nSteps]);
+
+		if (branchParts[iB * nSteps] < minPart)
+			continue;
+
+		/* Steps where the branch was not found are left empty for the IDs and zero for the particles, as in sqllib */
+		for (int iS = 0; iS < nSteps; iS++)
+		{
+			if (iS > 0)
+			{
+				strParts += ", ";
+				strIDs += ", ";
+			}
+
+			strParts += to_string(branchParts[iB * nSteps + iS]);
+
+			if (branchParts[iB * nSteps + iS] > 0)
+				strIDs += to_string(branchIDs[iB * nSteps + iS]);
+		}
+
+		/* The ID is bound as text and converted by the INT64 column affinity, as when inserted from python */
+		sqlite3_bind_text(insertHalo, 1, strMainID.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(insertHalo, 2, simuCode.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(insertHalo, 3, strParts.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(insertHalo, 4, strIDs.c_str(), -1, SQLITE_TRANSIENT);
+
+		isGood = (sqlite3_step(insertHalo) == SQLITE_DONE);
+		sqlite3_reset(insertHalo);
+		nRows++;
+
+		if (isGood && nRows % DB_ROWS_TRANSACTION == 0)
+			isGood = sqlite3_exec(thisDb, "COMMIT; BEGIN TRANSACTION", nullptr, nullptr, nullptr) == SQLITE_OK;
+	}
+
+	isGood = isGood && sqlite3_exec(thisDb, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK
+		&& sqlite3_exec(thisDb, "CREATE INDEX IF NOT EXISTS halo_haloID ON halo (haloID)", nullptr, nullptr, nullptr) == SQLITE_OK;
+
+	if (!isGood)
+		cout << "ERROR: could not write database " << dbName << ": " << sqlite3_errmsg(thisDb) << endl;
+	else
+		cout << "Main branches of " << nRows << " halos written to " << dbName << endl;
+
+	sqlite3_finalize(insertHalo);
+	sqlite3_close(thisDb);
+
+	/* The branches are written only once */
+	Init("", "", 0, 0);
+
+	return isGood;
+};
+
+#else
+bool TreeDatabase::Write()
+{
+	return !IsActive();
+};
+#endif
@@ -0,0 +1,64 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TREEDATABASE_H
+#define TREEDATABASE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include "MergerTree.h"
+#include "Checkpoint.h"
+
+using namespace std;
+
+
+/* Main branches of the halos of the first (z=0) snapshot, stored in a SQLite database with the same halo table used by 
+ * python/mtreelib/sqllib.py. The branches are assembled while the trees are computed, one snapshot at a time, 
+ * so that only the IDs and particle numbers along the main branches are kept in memory */
+class TreeDatabase {
+
+public:
+	TreeDatabase();
+
+	void Init(string, string, int, int);
+	bool IsActive(void) { return !dbName.empty(); };
+
+	// Follow the main progenitors of the trees of the next snapshot
+	void AddStep(vector<MergerTree> &);
+
+	// Bulk insert of all the branches, then the index on haloID is built
+	bool Write(void);
+
+	/* Restart files: the branches assembled so far */
+	bool Save(Checkpoint &);
+	bool Load(Checkpoint &);
+
+private:
+	string dbName, simuCode;
+	int nSteps, iStep, minPart;
+
+	// Main branch properties, nSteps values per branch
+	vector<uint64_t> branchIDs;
+	vector<int> branchParts;
+
+	// Branch of each main progenitor of the last snapshot added
+	unordered_map<uint64_t, size_t> progBranch;
+};
+
+#endif
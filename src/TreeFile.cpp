@@ -0,0 +1,331 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * TreeFile.cpp:
+ * Binary merger tree files. Each file is written with a few large writes, and read back through mmap so that
+ * single trees can be looked up by halo ID without parsing the whole file.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "global_vars.h"
+#include "TreeFile.h"
+
+#define TREE_BIN_VERSION 1
+
+using namespace std;
+
+
+static_assert(sizeof(TreeHeader) == 64, "Binary tree header must be 64 bytes");
+static_assert(sizeof(TreeRecord) == 32, "Binary tree record must be 32 bytes");
+static_assert(sizeof(ProgRecord) == 16, "Binary progenitor record must be 16 bytes");
+static_assert(sizeof(IndexRecord) == 16, "Binary index record must be 16 bytes");
+
+
+TreeFile::TreeFile()
+{
+	mapData = nullptr;
+	mapSize = 0;
+	header = nullptr; trees = nullptr; progs = nullptr; index = nullptr;
+};
+
+
+TreeFile::~TreeFile()
+{
+	Close();
+};
+
+
+bool TreeFile::IsBinary(string fileName)
+{
+	char magic[8];
+	bool isBinary = false;
+
+	FILE *fileIn = fopen(fileName.c_str(), "rb");
+
+	if (fileIn == nullptr)
+		return false;
+
+	if (fread(magic, 1, 8, fileIn) == 8)
+		isBinary = (strncmp(magic, "MCPPTREE", 8) == 0);
+
+	fclose(fileIn);
+
+	return isBinary;
+};
+
+
+/* All the records are assembled in memory first and written in one go */
+bool TreeFile::Write(string fileName, int snapshot, vector<MergerTree> &mergerTrees)
+{
+	vector<char> fileData;
+
+	Serialize(snapshot, mergerTrees, fileData);
+
+	FILE *fileOut = fopen(fileName.c_str(), "wb");
+
+	if (fileOut == nullptr)
+	{
+		cout << "ERROR: could not open " << fileName << " on task=" << locTask << endl;
+		return false;
+	}
+
+	bool isGood = (fwrite(fileData.data(), 1, fileData.size(), fileOut) == fileData.size());
+	isGood = (fclose(fileOut) == 0) && isGood;
+
+	if (!isGood)
+		cout << "ERROR: could not write " << fileName << " on task=" << locTask << endl;
+
+	return isGood;
+};
+
+
+void TreeFile::Serialize(int snapshot, vector<MergerTree> &mergerTrees, vector<char> &fileData)
+{
+	TreeHeader thisHeader;
+	vector<TreeRecord> treeRecords(mergerTrees.size());
+	vector<ProgRecord> progRecords;
+	vector<IndexRecord> indexRecords(mergerTrees.size());
+
+	for (size_t iM = 0; iM < mergerTrees.size(); iM++)
+	{
+		TreeRecord &thisRecord = treeRecords[iM];
+
+		ToRecords(mergerTrees[iM], thisRecord, progRecords);
+
+		indexRecords[iM].ID = thisRecord.ID;
+		indexRecords[iM].iTree = iM;
+	}
+
+	sort(indexRecords.begin(), indexRecords.end(),
+		[](const IndexRecord &a, const IndexRecord &b) { return a.ID < b.ID; });
+
+	memset(&thisHeader, 0, sizeof(TreeHeader));
+	memcpy(thisHeader.magic, "MCPPTREE", 8);
+	thisHeader.version = TREE_BIN_VERSION;
+	thisHeader.snapshot = snapshot;
+	thisHeader.nTrees = treeRecords.size();
+	thisHeader.nProgs = progRecords.size();
+	thisHeader.offTrees = sizeof(TreeHeader);
+	thisHeader.offProgs = thisHeader.offTrees + thisHeader.nTrees * sizeof(TreeRecord);
+	thisHeader.offIndex = thisHeader.offProgs + thisHeader.nProgs * sizeof(ProgRecord);
+
+	fileData.resize(thisHeader.offIndex + thisHeader.nTrees * sizeof(IndexRecord));
+
+	memcpy(&fileData[0], &thisHeader, sizeof(TreeHeader));
+	memcpy(&fileData[thisHeader.offTrees], treeRecords.data(), treeRecords.size() * sizeof(TreeRecord));
+	memcpy(&fileData[thisHeader.offProgs], progRecords.data(), progRecords.size() * sizeof(ProgRecord));
+	memcpy(&fileData[thisHeader.offIndex], indexRecords.data(), indexRecords.size() * sizeof(IndexRecord));
+};
+
+
+/* The progenitors are appended to progRecords, firstProg is their position there */
+void TreeFile::ToRecords(MergerTree &thisTree, TreeRecord &thisRecord, vector<ProgRecord> &progRecords)
+{
+	thisRecord.ID = thisTree.mainHalo.ID;
+	thisRecord.firstProg = progRecords.size();
+	thisRecord.nPart = 0;
+	thisRecord.nProg = thisTree.idProgenitor.size();
+	thisRecord.isOrphan = thisTree.isOrphan;
+	thisRecord.unused = 0;
+
+	for (int iA = 0; iA < nPTypes; iA++)
+		thisRecord.nPart += thisTree.mainHalo.nPart[iA];
+
+	for (int iP = 0; iP < thisRecord.nProg; iP++)
+	{
+		ProgRecord progRecord;
+
+		progRecord.ID = thisTree.progHalo[iP].ID;
+		progRecord.nPart = 0;
+		progRecord.nCommon = 0;
+
+		for (int iA = 0; iA < nPTypes; iA++)
+		{
+			progRecord.nPart += thisTree.progHalo[iP].nPart[iA];
+			progRecord.nCommon += thisTree.nCommon[iA][iP];
+		}
+
+		progRecords.push_back(progRecord);
+	}
+};
+
+
+/* Fill a MergerTree as it is read from an ASCII .mtree file, thisProgs points to the first progenitor of the tree */
+void TreeFile::FromRecords(const TreeRecord &thisRecord, const ProgRecord *thisProgs, MergerTree &mergerTree)
+{
+	int nProg = thisRecord.nProg;
+
+	mergerTree.mainHalo.ID = thisRecord.ID;
+	mergerTree.mainHalo.nPart[1] = thisRecord.nPart;	//TODO this assumes n tot particles = n DM
+	mergerTree.isOrphan = (thisRecord.isOrphan == 1);
+
+	mergerTree.nCommon.resize(nPTypes);
+
+	for (int iC = 0; iC < nPTypes; iC++)
+		mergerTree.nCommon[iC].resize(nProg);
+
+	mergerTree.progHalo.resize(nProg);
+	mergerTree.idProgenitor.resize(nProg);
+
+	for (int iP = 0; iP < nProg; iP++)
+	{
+		mergerTree.idProgenitor[iP] = thisProgs[iP].ID;
+		mergerTree.nCommon[1][iP] = thisProgs[iP].nCommon;
+		mergerTree.progHalo[iP].ID = thisProgs[iP].ID;
+		mergerTree.progHalo[iP].nPart[1] = thisProgs[iP].nPart;
+	}
+
+	if (nProg > 0)
+		mergerTree.progHalo[0].isToken = mergerTree.isOrphan;
+};
+
+
+bool TreeFile::IsShared(string fileName)
+{
+	vector<uint64_t> secOffsets;
+
+	return ReadSections(fileName, secOffsets);
+};
+
+
+bool TreeFile::ReadSections(string fileName, vector<uint64_t> &secOffsets)
+{
+	SharedTreeHeader thisHeader;
+	bool isShared = false;
+
+	FILE *fileIn = fopen(fileName.c_str(), "rb");
+
+	if (fileIn == nullptr)
+		return false;
+
+	if (fread(&thisHeader, sizeof(SharedTreeHeader), 1, fileIn) == 1 && strncmp(thisHeader.magic, "MCPPMTRS", 8) == 0)
+	{
+		secOffsets.resize(thisHeader.nSections + 1);
+		isShared = (fread(secOffsets.data(), sizeof(uint64_t), secOffsets.size(), fileIn) == secOffsets.size());
+	}
+
+	fclose(fileIn);
+
+	return isShared;
+};
+
+
+bool TreeFile::Open(string fileName, size_t fileOffset)
+{
+	struct stat info;
+
+	Close();
+
+	int fileDesc = open(fileName.c_str(), O_RDONLY);
+
+	if (fileDesc < 0)
+		return false;
+
+	if (fstat(fileDesc, &info) != 0 || (size_t) info.st_size < sizeof(TreeHeader))
+	{
+		close(fileDesc);
+		return false;
+	}
+
+	mapSize = info.st_size;
+	void *thisMap = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fileDesc, 0);
+	close(fileDesc);
+
+	if (thisMap == MAP_FAILED)
+	{
+		mapSize = 0;
+		return false;
+	}
+
+	mapData = (char *) thisMap;
+	header = (const TreeHeader *) (mapData + fileOffset);
+
+	if (fileOffset + sizeof(TreeHeader) > mapSize || strncmp(header->magic, "MCPPTREE", 8) != 0 
+		|| header->version != TREE_BIN_VERSION
+		|| fileOffset + header->offIndex + header->nTrees * sizeof(IndexRecord) > mapSize)
+	{
+		cout << "ERROR: " << fileName << " is not a valid binary tree file." << endl;
+		Close();
+		return false;
+	}
+
+	trees = (const TreeRecord *) (mapData + fileOffset + header->offTrees);
+	progs = (const ProgRecord *) (mapData + fileOffset + header->offProgs);
+	index = (const IndexRecord *) (mapData + fileOffset + header->offIndex);
+
+	return true;
+};
+
+
+void TreeFile::Close()
+{
+	if (mapData != nullptr)
+		munmap(mapData, mapSize);
+
+	mapData = nullptr;
+	mapSize = 0;
+	header = nullptr; trees = nullptr; progs = nullptr; index = nullptr;
+};
+
+
+uint64_t TreeFile::NTrees()
+{
+	return (header != nullptr) ? header->nTrees : 0;
+};
+
+
+const TreeRecord *TreeFile::Tree(uint64_t iTree)
+{
+	return &trees[iTree];
+};
+
+
+const ProgRecord *TreeFile::Progenitors(uint64_t iTree)
+{
+	return &progs[trees[iTree].firstProg];
+};
+
+
+int64_t TreeFile::Find(uint64_t haloID)
+{
+	const IndexRecord *indexEnd = index + NTrees();
+	const IndexRecord *thisIndex = lower_bound(index, indexEnd, haloID,
+			[](const IndexRecord &a, uint64_t ID) { return a.ID < ID; });
+
+	if (thisIndex == indexEnd || thisIndex->ID != haloID)
+		return -1;
+
+	return thisIndex->iTree;
+};
+
+
+void TreeFile::GetTree(uint64_t iTree, MergerTree &mergerTree)
+{
+	FromRecords(*Tree(iTree), Progenitors(iTree), mergerTree);
+};
@@ -0,0 +1,112 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TREEFILE_H
+#define TREEFILE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "MergerTree.h"
+
+using namespace std;
+
+
+/* Binary .mtree layout, all values little-endian:
+ *	TreeHeader			magic, version, snapshot, number of descendants and progenitors, section offsets
+ *	TreeRecord[nTrees]		descendant halos, with the position of their first progenitor (CSR layout)
+ *	ProgRecord[nProgs]		progenitors, grouped by descendant in the same order
+ *	IndexRecord[nTrees]		descendant IDs in ascending order, with their record number */
+struct TreeHeader {
+	char magic[8];			// "MCPPTREE"
+	int32_t version, snapshot;
+	uint64_t nTrees, nProgs;
+	uint64_t offTrees, offProgs, offIndex;
+	uint64_t unused;
+};
+
+struct TreeRecord {
+	uint64_t ID;
+	uint64_t firstProg;
+	int32_t nPart, nProg;
+	int32_t isOrphan, unused;
+};
+
+struct ProgRecord {
+	uint64_t ID;
+	int32_t nPart, nCommon;
+};
+
+struct IndexRecord {
+	uint64_t ID;
+	uint64_t iTree;
+};
+
+
+/* Single tree file per snapshot written by all tasks with MPI-IO: the header is followed by a table of nSections+1 
+ * absolute uint64 offsets, padded to 4096 bytes. Each section holds the trees of one task, in ASCII or binary format,
+ * exactly as they would be written to a separate file */
+struct SharedTreeHeader {
+	char magic[8];			// "MCPPMTRS"
+	int32_t version, nSections;
+};
+
+
+/* Writes the merger trees of one snapshot in the binary format, and reads them back through a read-only memory map */
+class TreeFile {
+
+public:
+	TreeFile();
+	~TreeFile();
+
+	static bool IsBinary(string);
+	static bool Write(string, int, vector<MergerTree> &);
+	static void Serialize(int, vector<MergerTree> &, vector<char> &);
+
+	/* Conversion of a single tree, also used to send trees among tasks */
+	static void ToRecords(MergerTree &, TreeRecord &, vector<ProgRecord> &);
+	static void FromRecords(const TreeRecord &, const ProgRecord *, MergerTree &);
+
+	/* Shared files: check the magic and read the section offsets */
+	static bool IsShared(string);
+	static bool ReadSections(string, vector<uint64_t> &);
+
+	// Map the whole file, the binary trees start at the given offset
+	bool Open(string, size_t = 0);
+	void Close(void);
+
+	uint64_t NTrees(void);
+	const TreeRecord *Tree(uint64_t);
+	const ProgRecord *Progenitors(uint64_t);
+
+	// Record number of a descendant ID, -1 if it is not in the file
+	int64_t Find(uint64_t);
+
+	// Fill a MergerTree as it is read from an ASCII .mtree file
+	void GetTree(uint64_t, MergerTree &);
+
+private:
+	char *mapData;
+	size_t mapSize;
+
+	const TreeHeader *header;
+	const TreeRecord *trees;
+	const ProgRecord *progs;
+	const IndexRecord *index;
+};
+
+#endif
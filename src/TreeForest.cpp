@@ -0,0 +1,163 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * TreeForest.cpp:
+ * Depth-first forest files: each tree can be read with a single pread using the offset table, 
+ * and walked with the first progenitor / next progenitor / descendant indices of its halos.
+ */
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+#include "global_vars.h"
+#include "TreeForest.h"
+
+#define FOREST_VERSION 1
+
+using namespace std;
+
+
+static_assert(sizeof(ForestHeader) == 64, "Forest header must be 64 bytes");
+static_assert(sizeof(ForestTree) == 24, "Forest tree record must be 24 bytes");
+static_assert(sizeof(ForestHalo) == 72, "Forest halo record must be 72 bytes");
+
+
+TreeForest::TreeForest()
+{
+	minPart = 0;
+};
+
+
+void TreeForest::Init(string thisName, vector<int> &thisSnaps, int thisMinPart)
+{
+	fileName = thisName;
+	snapshots = thisSnaps;
+	minPart = thisMinPart;
+};
+
+
+/* Append a halo and all its progenitors in depth-first order, return its index within the tree */
+int32_t TreeForest::AddSubtree(TreeGraph &treeGraph, int32_t iNode, int32_t iDesc, vector<ForestHalo> &treeHalos)
+{
+	GraphHalo &graphHalo = treeGraph.halos[iNode];
+	int32_t iThis = treeHalos.size();
+	int32_t iPrev = -1;
+
+	treeHalos.emplace_back();
+
+	ForestHalo &forestHalo = treeHalos.back();
+	forestHalo.ID = graphHalo.ID;
+	forestHalo.snapshot = snapshots[treeGraph.Step(iNode)];
+	forestHalo.nPart = graphHalo.nPart;
+	forestHalo.firstProg = forestHalo.nextProg = -1;
+	forestHalo.desc = iDesc;
+	forestHalo.isToken = graphHalo.isToken;
+	forestHalo.mTot = graphHalo.mTot;
+	forestHalo.rVir = graphHalo.rVir;
+	forestHalo.vMax = graphHalo.vMax;
+	forestHalo.unused = 0.0;
+
+	for (int iX = 0; iX < 3; iX++)
+	{
+		forestHalo.X[iX] = graphHalo.X[iX];
+		forestHalo.V[iX] = graphHalo.V[iX];
+	}
+
+	for (int32_t iNext = treeGraph.mainProg[iNode]; iNext >= 0; iNext = treeGraph.nextProg[iNext])
+	{
+		int32_t iProg = AddSubtree(treeGraph, iNext, iThis, treeHalos);
+
+		if (iPrev < 0)
+			treeHalos[iThis].firstProg = iProg;
+		else
+			treeHalos[iPrev].nextProg = iProg;
+
+		iPrev = iProg;
+	}
+
+	return iThis;
+};
+
+
+/* The halo records are written first, the tree table is filled in once all the offsets are known */
+bool TreeForest::Write(TreeGraph &treeGraph)
+{
+	ForestHeader thisHeader;
+	vector<ForestTree> forestTrees;
+	vector<ForestHalo> treeHalos;
+	vector<int32_t> rootNodes;
+	bool isGood = true;
+
+	if (!IsActive())
+		return true;
+
+	FILE *fileOut = fopen(fileName.c_str(), "wb");
+
+	if (fileOut == nullptr)
+	{
+		cout << "ERROR: could not open " << fileName << " on task=" << locTask << endl;
+		return false;
+	}
+
+	/* The roots are the halos of the first step */
+	for (int32_t iRoot = 0; iRoot < treeGraph.First(1); iRoot++)
+		if (treeGraph.halos[iRoot].nPart >= minPart)
+			rootNodes.push_back(iRoot);
+
+	forestTrees.resize(rootNodes.size());
+
+	memset(&thisHeader, 0, sizeof(ForestHeader));
+	memcpy(thisHeader.magic, "MCPPFRST", 8);
+	thisHeader.version = FOREST_VERSION;
+	thisHeader.nTrees = forestTrees.size();
+	thisHeader.offTrees = sizeof(ForestHeader);
+	thisHeader.offHalos = thisHeader.offTrees + thisHeader.nTrees * sizeof(ForestTree);
+
+	fseek(fileOut, thisHeader.offHalos, SEEK_SET);
+
+	for (size_t iT = 0; iT < forestTrees.size() && isGood; iT++)
+	{
+		treeHalos.clear();
+		AddSubtree(treeGraph, rootNodes[iT], -1, treeHalos);
+
+		forestTrees[iT].rootID = treeHalos[0].ID;
+		forestTrees[iT].offset = thisHeader.offHalos + thisHeader.nHalos * sizeof(ForestHalo);
+		forestTrees[iT].nHalos = treeHalos.size();
+		thisHeader.nHalos += treeHalos.size();
+
+		isGood = (fwrite(treeHalos.data(), sizeof(ForestHalo), treeHalos.size(), fileOut) == treeHalos.size());
+	}
+
+	fseek(fileOut, 0, SEEK_SET);
+	isGood = isGood && fwrite(&thisHeader, sizeof(ForestHeader), 1, fileOut) == 1;
+	isGood = isGood && fwrite(forestTrees.data(), sizeof(ForestTree), forestTrees.size(), fileOut) == forestTrees.size();
+	isGood = (fclose(fileOut) == 0) && isGood;
+
+	if (!isGood)
+		cout << "ERROR: could not write " << fileName << " on task=" << locTask << endl;
+	else
+		cout << thisHeader.nTrees << " trees with " << thisHeader.nHalos << " halos written to " << fileName << endl;
+
+	/* The forest is written only once */
+	Init("", snapshots, 0);
+
+	return isGood;
+};
@@ -0,0 +1,76 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TREEFOREST_H
+#define TREEFOREST_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "TreeGraph.h"
+
+using namespace std;
+
+
+/* Forest file layout, all values little-endian:
+ *	ForestHeader			magic, version, number of trees and halos, section offsets
+ *	ForestTree[nTrees]		z=0 halo ID, byte offset and number of halos of each tree
+ *	ForestHalo[nHalos]		halos of each tree in depth-first order, starting from the z=0 halo. 
+ *					Progenitor and descendant indices are relative to the first halo of the tree, -1 if none */
+struct ForestHeader {
+	char magic[8];			// "MCPPFRST"
+	int32_t version, unused;
+	uint64_t nTrees, nHalos;
+	uint64_t offTrees, offHalos;
+	uint64_t unused2[2];
+};
+
+struct ForestTree {
+	uint64_t rootID;
+	uint64_t offset;
+	uint64_t nHalos;
+};
+
+struct ForestHalo {
+	uint64_t ID;
+	int32_t snapshot, nPart;
+	int32_t firstProg, nextProg, desc, isToken;
+	float mTot, rVir, vMax, unused;
+	float X[3], V[3];
+};
+
+
+/* Complete trees of the halos at the first (z=0) snapshot, written from the tree graph once all the steps are done */
+class TreeForest {
+
+public:
+	TreeForest();
+
+	void Init(string, vector<int> &, int);
+	bool IsActive(void) { return !fileName.empty(); };
+
+	bool Write(TreeGraph &);
+
+private:
+	string fileName;
+	vector<int> snapshots;
+	int minPart;
+
+	int32_t AddSubtree(TreeGraph &, int32_t, int32_t, vector<ForestHalo> &);
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * TreeGraph.cpp:
+ * In-memory graph of the merger trees of all the snapshots. It is filled one step at a time from the clean trees,
+ * the halo histories and the forest file are then obtained by walking the integer links.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#include "global_vars.h"
+#include "TreeGraph.h"
+
+using namespace std;
+
+
+TreeGraph::TreeGraph()
+{
+};
+
+
+int32_t TreeGraph::First(int iStep)
+{
+	if (iStep < NSteps())
+		return stepStart[iStep];
+	else
+		return Size();
+};
+
+
+int TreeGraph::Step(int32_t iNode)
+{
+	return upper_bound(stepStart.begin(), stepStart.end(), iNode) - stepStart.begin() - 1;
+};
+
+
+int32_t TreeGraph::Find(int iStep, uint64_t haloID)
+{
+	if (iStep < 0 || iStep >= (int) sortIDs.size())
+		return -1;
+
+	vector<uint64_t> &thisIDs = sortIDs[iStep];
+	auto thisID = lower_bound(thisIDs.begin(), thisIDs.end(), haloID);
+
+	if (thisID == thisIDs.end() || *thisID != haloID)
+		return -1;
+
+	return sortNodes[iStep][thisID - thisIDs.begin()];
+};
+
+
+int32_t TreeGraph::AddNode(Halo &thisHalo)
+{
+	GraphHalo graphHalo;
+
+	graphHalo.ID = thisHalo.ID;
+	graphHalo.nPart = thisHalo.nAllPart();
+	graphHalo.isToken = thisHalo.isToken;
+	graphHalo.mTot = thisHalo.mTot;
+	graphHalo.rVir = thisHalo.rVir;
+	graphHalo.vMax = thisHalo.vMax;
+
+	for (int iX = 0; iX < 3; iX++)
+	{
+		graphHalo.X[iX] = thisHalo.X[iX];
+		graphHalo.V[iX] = thisHalo.V[iX];
+	}
+
+	halos.push_back(graphHalo);
+	desc.push_back(-1);
+	mainProg.push_back(-1);
+	nextProg.push_back(-1);
+
+	return halos.size() - 1;
+};
+
+
+/* Rebuild the ID index of a snapshot from its nodes */
+void TreeGraph::SortStep(int iStep)
+{
+	int32_t iFirst = First(iStep);
+	int32_t nNodes = First(iStep + 1) - iFirst;
+	vector<pair<uint64_t, int32_t>> idNodes(nNodes);
+
+	for (int32_t iN = 0; iN < nNodes; iN++)
+		idNodes[iN] = make_pair(halos[iFirst + iN].ID, iFirst + iN);
+
+	sort(idNodes.begin(), idNodes.end());
+
+	sortIDs[iStep].resize(nNodes);
+	sortNodes[iStep].resize(nNodes);
+
+	for (int32_t iN = 0; iN < nNodes; iN++)
+	{
+		sortIDs[iStep][iN] = idNodes[iN].first;
+		sortNodes[iStep][iN] = idNodes[iN].second;
+	}
+};
+
+
+/* The trees of step iStep connect the halos of snapshot iStep to their progenitors at snapshot iStep + 1.
+ * Steps have to be added in order, starting from zero. Only the halos at the first snapshot with at least minPartRoot
+ * particles start a tree, afterwards only the descendants already in the graph are followed, so that the graph holds
+ * just the trees that are going to be written. */
+void TreeGraph::AddStep(vector<MergerTree> &mergerTrees, int iStep, int minPartRoot)
+{
+	vector<int32_t> descNodes(mergerTrees.size());
+	vector<uint64_t> progIDs;
+
+	if (iStep == 0 && NSteps() == 0)
+	{
+		stepStart.push_back(0);
+		sortIDs.emplace_back();
+		sortNodes.emplace_back();
+	}
+
+	/* A step out of order would leave a snapshot out of every history and forest */
+	if (iStep != NSteps() - 1)
+	{
+		cout << "ERROR: step " << iStep << " added to a tree graph of " << NSteps() << " snapshots on task=" 
+			<< locTask << endl;
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	for (size_t iM = 0; iM < mergerTrees.size(); iM++)
+	{
+		descNodes[iM] = Find(iStep, mergerTrees[iM].mainHalo.ID);
+
+		if (iStep == 0 && descNodes[iM] < 0 && mergerTrees[iM].mainHalo.nAllPart() >= minPartRoot)
+			descNodes[iM] = AddNode(mergerTrees[iM].mainHalo);
+	}
+
+	if (iStep == 0)
+		SortStep(iStep);
+
+	/* The index of the next snapshot is known before the nodes are added, so that each progenitor is stored once */
+	for (size_t iM = 0; iM < mergerTrees.size(); iM++)
+		if (descNodes[iM] >= 0)
+			for (size_t iP = 0; iP < mergerTrees[iM].progHalo.size(); iP++)
+				progIDs.push_back(mergerTrees[iM].progHalo[iP].ID);
+
+	sort(progIDs.begin(), progIDs.end());
+	progIDs.erase(unique(progIDs.begin(), progIDs.end()), progIDs.end());
+
+	stepStart.push_back(Size());
+	sortIDs.push_back(progIDs);
+	sortNodes.emplace_back(progIDs.size(), -1);
+
+	vector<uint64_t> &nextIDs = sortIDs.back();
+	vector<int32_t> &nextNodes = sortNodes.back();
+
+	/* Progenitors are sorted by merit, the first one is the main progenitor */
+	for (size_t iM = 0; iM < mergerTrees.size(); iM++)
+	{
+		int32_t iDesc = descNodes[iM];
+		int32_t iPrev = -1;
+
+		if (iDesc < 0 || mainProg[iDesc] >= 0)
+			continue;
+
+		for (size_t iP = 0; iP < mergerTrees[iM].progHalo.size(); iP++)
+		{
+			Halo &progHalo = mergerTrees[iM].progHalo[iP];
+			size_t iID = lower_bound(nextIDs.begin(), nextIDs.end(), progHalo.ID) - nextIDs.begin();
+
+			if (nextNodes[iID] >= 0)
+				continue;
+
+			int32_t iProg = AddNode(progHalo);
+			nextNodes[iID] = iProg;
+			desc[iProg] = iDesc;
+
+			if (iPrev < 0)
+				mainProg[iDesc] = iProg;
+			else
+				nextProg[iPrev] = iProg;
+
+			iPrev = iProg;
+		}
+	}
+};
+
+
+/* Only the properties stored in the graph are set, all particles are counted as the first type */
+void TreeGraph::GetHalo(int32_t iNode, Halo &thisHalo)
+{
+	GraphHalo &graphHalo = halos[iNode];
+
+	thisHalo.ID = graphHalo.ID;
+	thisHalo.isToken = graphHalo.isToken;
+	thisHalo.mTot = graphHalo.mTot;
+	thisHalo.rVir = graphHalo.rVir;
+	thisHalo.vMax = graphHalo.vMax;
+
+	for (int iX = 0; iX < 3; iX++)
+	{
+		thisHalo.X[iX] = graphHalo.X[iX];
+		thisHalo.V[iX] = graphHalo.V[iX];
+	}
+
+	for (int iT = 0; iT < NPTYPES; iT++)
+		thisHalo.nPart[iT] = 0;
+
+	thisHalo.nPart[0] = graphHalo.nPart;
+};
+
+
+void TreeGraph::Clean()
+{
+	vector<GraphHalo>().swap(halos);
+	vector<int32_t>().swap(desc);
+	vector<int32_t>().swap(mainProg);
+	vector<int32_t>().swap(nextProg);
+	vector<int32_t>().swap(stepStart);
+	vector<vector<uint64_t>>().swap(sortIDs);
+	vector<vector<int32_t>>().swap(sortNodes);
+};
+
+
+bool TreeGraph::Save(Checkpoint &thisCheckpoint)
+{
+	return thisCheckpoint.WriteVector(halos) && thisCheckpoint.WriteVector(desc) && thisCheckpoint.WriteVector(mainProg) 
+		&& thisCheckpoint.WriteVector(nextProg) && thisCheckpoint.WriteVector(stepStart);
+};
+
+
+bool TreeGraph::Load(Checkpoint &thisCheckpoint)
+{
+	Clean();
+
+	if (!(thisCheckpoint.ReadVector(halos) && thisCheckpoint.ReadVector(desc) && thisCheckpoint.ReadVector(mainProg) 
+		&& thisCheckpoint.ReadVector(nextProg) && thisCheckpoint.ReadVector(stepStart)))
+		return false;
+
+	sortIDs.resize(NSteps());
+	sortNodes.resize(NSteps());
+
+	for (int iStep = 0; iStep < NSteps(); iStep++)
+		SortStep(iStep);
+
+	return true;
+};
@@ -0,0 +1,79 @@
+/*
+ *   METROC++: MErger TRees On C++, a scalable code for the computation of merger trees in cosmological simulations.
+ *   Copyright (C) Edoardo Carlesi 2018-2019
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TREEGRAPH_H
+#define TREEGRAPH_H
+
+#include <vector>
+#include <cstdint>
+#include "Halo.h"
+#include "MergerTree.h"
+#include "Checkpoint.h"
+
+using namespace std;
+
+
+/* Properties kept for each halo of the graph, enough to rebuild the histories and the forest files */
+struct GraphHalo {
+	uint64_t ID;
+	int32_t nPart, isToken;
+	float mTot, rVir, vMax;
+	float X[3], V[3];
+};
+
+
+/* Merger trees of all the snapshots as flat arrays. Nodes are numbered consecutively, snapshot after snapshot,
+ * and linked by integer indices (-1 if none): the descendant, the main progenitor and the next progenitor of the
+ * same descendant. Within each snapshot the nodes can be looked up by halo ID through a sorted array. */
+class TreeGraph {
+
+public:
+	TreeGraph();
+
+	vector<GraphHalo> halos;
+	vector<int32_t> desc, mainProg, nextProg;
+
+	int NSteps(void) { return stepStart.size(); };
+	int32_t Size(void) { return halos.size(); };
+
+	/* Nodes of a snapshot are in [First(iStep), First(iStep+1)) */
+	int32_t First(int);
+	int Step(int32_t);
+
+	// Node of a halo ID at a given snapshot, -1 if it is not in the graph
+	int32_t Find(int, uint64_t);
+
+	void AddStep(vector<MergerTree> &, int, int);
+	void GetHalo(int32_t, Halo &);
+	void Clean(void);
+
+	/* Restart files, the ID index is rebuilt when reading */
+	bool Save(Checkpoint &);
+	bool Load(Checkpoint &);
+
+private:
+	vector<int32_t> stepStart;
+
+	// Sorted halo IDs of each snapshot, and their nodes
+	vector<vector<uint64_t>> sortIDs;
+	vector<vector<int32_t>> sortNodes;
+
+	int32_t AddNode(Halo &);
+	void SortStep(int);
+};
+
+#endif
@@ -63,6 +63,9 @@ vector<map <uint64_t, vector<Particle>>> locMapParts;
 /* This map keeps track of the halo ids when reading from old mtree files */
 vector<map<uint64_t, int>> id2Index;
 
+/* Clean trees of all the steps */
+TreeGraph locTreeGraph;
+
 map <uint64_t, int> thisMapTrees;
 map <uint64_t, int> nextMapTrees;
 
@@ -96,6 +99,10 @@ string cosmologicalModel;
 int minPartCmp;
 int minPartHalo;
 
+int minPartRead;
+float minMhiresRead;
+float minMassRead;
+
 int nGrid;
 int facOrphanSteps;
 int maxOrphanSteps;
@@ -105,3 +112,22 @@ int nLocChunks;
 int nChunks;
 int nSnapsUse;
 int nSnaps;
+int prefetchMemory;
+int writeQueue;
+int outSingleFile;
+int minPartDatabase;
+int minPartHistory;
+int smoothHistory;
+int outForest;
+int minPartForest;
+int checkpointStep;
+int restartStep;
+int compressCheckpoint;
+int partIndex;
+int nReadThreads;
+int redistributeHalos;
+int bufferCells;
+int localBuffer;
+int nBufferRanges;
+int nMatchThreads;
+int runMode;
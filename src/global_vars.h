@@ -25,6 +25,7 @@
 #include "Grid.h"
 #include "Halo.h"
 #include "MergerTree.h"
+#include "TreeGraph.h"
 
 using namespace std;
 
@@ -60,6 +61,9 @@ extern vector<vector<MergerTree>> locCleanTrees;
 /* Helps connecting halos when rebuilidng the trees from input files */
 extern vector<map<uint64_t, int>> id2Index;
 
+/* Clean trees of all the steps, used to build the HaloTrees and the forest file */
+extern TreeGraph locTreeGraph;
+
 /* Particles on task, also allocated by particle type within each halo */
 extern vector<vector<vector<vector<uint64_t>>>> locParts;
 
@@ -89,6 +93,11 @@ extern size_t locHalosSize[2];
 extern int minPartCmp;
 extern int minPartHalo;
 
+/* Halos below these thresholds are discarded when reading the catalogs */
+extern int minPartRead;
+extern float minMhiresRead;
+extern float minMassRead;
+
 extern int nPTypes;
 extern int nTotHalos[2];
 extern int nLocHalos[2];
@@ -108,6 +117,8 @@ extern int nLocParts[2];
 extern int nGrid;
 
 extern float boxSize;
+
+// Largest halo velocity plus circular velocity, locally and on all tasks, used for the buffer thickness
 extern float totVmax;
 extern float locVmax;
 
@@ -126,6 +137,52 @@ extern int nTreeChunks;
 // Each halo catalog / particle file is split into this number of files
 extern int nChunks;	
 
+// Memory (in MB) that can be used to read the next halo & particle catalog in the background, 0 disables it
+extern int prefetchMemory;
+
+// Halos at the first snapshot with fewer particles are not stored in the SQLite database
+extern int minPartDatabase;
+
+// Write the full history of the halos at the first snapshot with at least this number of particles, 0 to skip
+extern int minPartHistory;
+extern int smoothHistory;
+
+// Write all the trees in a depth-first forest file, starting from the halos at the first snapshot with at least minPartForest particles
+extern int outForest;
+extern int minPartForest;
+
+// Write a single tree file per snapshot with MPI-IO instead of one per task
+extern int outSingleFile;
+
+// Number of snapshots whose trees can be waiting to be written by the background writer, 0 writes them in the main loop
+extern int writeQueue;
+
+// Write a restart file every checkpointStep steps (0 = never), restart the main loop from restartStep (0 = start from scratch)
+extern int checkpointStep;
+extern int restartStep;
+extern int compressCheckpoint;
+
+// Build and use a sidecar index of the halo blocks in the particle files, and the number of threads reading each file
+extern int partIndex;
+extern int nReadThreads;
+
+// Move the halos of each catalog to compact, particle-balanced subvolumes along a space-filling curve after reading
+extern int redistributeHalos;
+
+// Buffer thickness in grid cells, 0 computes it at each step from the halo velocities and radii, globally or for each node
+extern int bufferCells;
+extern int localBuffer;
+
+// ID intervals describing each buffer halo, whose particles are only sent if the receiving task holds enough IDs 
+// inside them. With 0 all the particles are sent
+extern int nBufferRanges;
+
+// Threads comparing the particles on each task, so that a node can run a single task holding one buffer and particle table
+extern int nMatchThreads;
+
+// 0 computes the merger trees, 1 reads them back from pathTree (on any number of tasks) and post-processes them
+extern int runMode;
+
 // Each tast has a local number of chunks to read (it should be equal for all tasks for better load balancing, but in general it can vary)
 extern int nLocChunks;  
 #endif 
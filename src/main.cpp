@@ -40,6 +40,7 @@
 #include "Halo.h"
 #include "MergerTree.h"
 #include "Cosmology.h"
+#include "InputStream.h"
 
 using namespace std;
 
@@ -56,8 +57,10 @@ int main(int argv, char **argc)
 	/* Read configuration file and initialize variables */
 	SettingsIO.ReadConfigFile(configFile);
 
-	/* Fire off MPI */
-	MPI_Init(&argv, &argc);
+	/* Fire off MPI. Only the main thread makes MPI calls, helper threads are only used for reading files and comparing
+	 * the particles */
+	int mpiThreads = 0;
+	MPI_Init_thread(&argv, &argc, MPI_THREAD_FUNNELED, &mpiThreads);
 	MPI_Comm_rank(MPI_COMM_WORLD, &locTask);
  	MPI_Comm_size(MPI_COMM_WORLD, &totTask);
 
@@ -74,6 +77,28 @@ int main(int argv, char **argc)
 	/* We are assuming that each task reads more than one file. TODO load balancing */
 	SettingsIO.DistributeFilesAmongTasks();
 
+	/* The decompressing, prefetching, writing and matching threads run alongside the main one, which cannot be avoided 
+	 * for compressed catalogs. Without them MPI_THREAD_FUNNELED is not needed. */
+	int useThreads = (prefetchMemory > 0 || writeQueue > 0 || nMatchThreads > 1 || nReadThreads > 1);
+
+	for (int iF = 0; iF < (int) SettingsIO.haloFiles.size(); iF++)
+		for (int jF = 0; jF < (int) SettingsIO.haloFiles[iF].size(); jF++)
+			if (InputStream::Compression(SettingsIO.haloFiles[iF][jF]) != InputStream::kPlain 
+				|| InputStream::Compression(SettingsIO.partFiles[iF][jF]) != InputStream::kPlain)
+				useThreads = 1;
+
+	MPI_Allreduce(MPI_IN_PLACE, &useThreads, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+	if (useThreads && mpiThreads < MPI_THREAD_FUNNELED)
+	{
+		if (locTask == 0)
+			cout << "ERROR: the MPI library does not provide MPI_THREAD_FUNNELED, which is needed by the helper threads." 
+				<< " Disable prefetchMemory, writeQueue, nMatchThreads, nReadThreads and the compressed catalogs." << endl;
+
+		MPI_Finalize();
+		exit(0);
+	}
+
 	if (locTask == 0)
 	{
 		cout << endl;
@@ -111,6 +136,29 @@ int main(int argv, char **argc)
 	
 		/* Ready? Go! */
 
+	if (runMode == 1)
+	{
+		/* The trees of each step are read back from pathTree, whatever the number of tasks that computed them, and go 
+		 * through the same outputs as freshly computed ones: they can be written again in another format or number of 
+		 * files, and fill the database, the halo histories and the forest */
+		for (iNumCat = 1; iNumCat < nSnapsUse; iNumCat++)
+		{
+			SettingsIO.ReadTrees();
+
+			if (minPartHistory > 0 || outForest)
+				BuildTrees();
+
+			SettingsIO.WriteTree(iNumCat);
+			FreeMergerTrees(iNumCat);
+		}
+
+		SettingsIO.FlushTrees();
+		SettingsIO.WriteSmoothTrees();
+
+		if (locTask == 0)
+			cout << "The trees have been post-processed." << endl;
+	}
+	else
 	{
 		/* Overrides the config file settings */
 		nTreeChunks = totTask;
@@ -128,15 +176,32 @@ int main(int argv, char **argc)
 			exit(0);
 		}
 #endif
-		/* Read particles and catalogs */
-		SettingsIO.ReadHalos();
+		/* The loop starts from the second catalog, or from the step the restart files were written for */
+		int iFirstCat = 1;
+
+		if (restartStep > 0)
+		{
+			SettingsIO.ReadCheckpoint(restartStep);
+			iFirstCat = restartStep;
+		} else {
+			/* Read particles and catalogs */
+			SettingsIO.ReadHalos();
 
 #ifdef VERBOSE
-		//if (locTask == 0)
-		//	SettingsIO.CheckStatus();
+			//if (locTask == 0)
+			//	SettingsIO.CheckStatus();
 #endif
 
-		SettingsIO.ReadParticles();	
+			SettingsIO.ReadParticles();	
+
+#ifndef ZOOM
+			if (redistributeHalos)
+				CommTasks.RedistributeHalos();
+#endif
+		}
+
+		/* Start reading the next catalog in the background */
+		SettingsIO.PrefetchCatalog(iFirstCat);
 
 #ifndef ZOOM
 		/* Now every task knows which subvolumes of the box belong to which task */
@@ -151,12 +216,23 @@ int main(int argv, char **argc)
 		}
 
 		/* Loop on halo and particle catalogs */
-		for (iNumCat = 1; iNumCat < nSnapsUse; iNumCat++)
+		for (iNumCat = iFirstCat; iNumCat < nSnapsUse; iNumCat++)
 		{
 			clock_t iniTime = clock();
 			iUseCat = 1;
 			SettingsIO.ReadHalos();
 			SettingsIO.ReadParticles();
+
+#ifndef ZOOM
+			if (redistributeHalos)
+				CommTasks.RedistributeHalos();
+#endif
+
+			/* While this step is being computed, read the halos and particles for the next one */
+			SettingsIO.PrefetchCatalog(iNumCat + 1);
+
+			/* The connections might have been computed by an earlier run on the same catalogs */
+			bool isCached = SettingsIO.ReadLinks(iNumCat);
 		
 			clock_t endTime = clock();
 			double elapsed = double(endTime - iniTime) / CLOCKS_PER_SEC;
@@ -170,15 +246,20 @@ int main(int argv, char **argc)
 #ifndef ZOOM		/* No buffer exchange in zoom mode */
 			iniTime = clock();
 
-			/* Now every task knows which nodes belongs to which task */
-			CommTasks.BroadcastAndGatherGrid();
+			/* The buffer halos are only needed to compute the connections */
+			if (!isCached)
+			{
+				/* Now every task knows which nodes belongs to which task */
+				CommTasks.BroadcastAndGatherGrid();
 
-			/* After reading in the second halo catalog, each task finds out which nodes it gets from the other tasks
-			 * The nodes are located on grid 1 based on the distribution of the nodes on grid 0 */
-			GlobalGrid[1].FindBufferNodes(GlobalGrid[0].locNodes);	
+				/* After reading in the second halo catalog, each task finds out which nodes it gets from the other tasks
+				 * The nodes are located on grid 1 based on the distribution of the nodes on grid 0 */
+				GlobalGrid[1].FindBufferNodes(GlobalGrid[0].locNodes, 
+					CommTasks.BufferCells(Cosmo, SettingsIO.aFactors[iNumCat], SettingsIO.aFactors[iNumCat - 1]));	
 
-			/* Now exchange the halos in the requested buffer zones among the different tasks. */
-			CommTasks.BufferSendRecv();
+				/* Now start exchanging the halos in the requested buffer zones among the different tasks. */
+				CommTasks.BufferSendRecv();
+			}
 
 			endTime = clock();
 			elapsed = double(endTime - iniTime) / CLOCKS_PER_SEC;
@@ -186,7 +267,7 @@ int main(int argv, char **argc)
 			if (locTask == 0)
 			{
 				SettingsIO.WriteLog(iNumCat, elapsed);
-				cout << "Buffer exchanged in " << elapsed << "s. " << endl;
+				cout << "Buffer exchange started in " << elapsed << "s. " << endl;
 			}
 #endif
 	
@@ -196,7 +277,20 @@ int main(int argv, char **argc)
 			iniTime = clock();
 		
 			/* Forward halo connections. This function also allocates the MergerTrees */
-			FindProgenitors(0, 1);
+			if (!isCached)
+			{
+#ifdef ZOOM
+				FindProgenitors(0, 1);
+#else
+				/* The local particles are compared while the buffer is being received, the buffer halos are 
+				 * only needed afterwards */
+				MatchParticles(0, 1);
+				CommTasks.BufferWait();
+				MatchBufferParticles();
+				AssignProgenitors(0, 1);
+#endif
+			}
+
 			MPI_Barrier(MPI_COMM_WORLD);
 
 			endTime = clock();
@@ -213,8 +307,13 @@ int main(int argv, char **argc)
 
 			iniTime = clock();
 	
-			/* Backward halo connections */
-			FindProgenitors(1, 0);
+			/* Backward halo connections, then store both directions before the trees are gathered */
+			if (!isCached)
+			{
+				FindProgenitors(1, 0);
+				SettingsIO.WriteLinks(iNumCat);
+			}
+
 			MPI_Barrier(MPI_COMM_WORLD);
 	
 			endTime = clock();
@@ -251,7 +350,12 @@ int main(int argv, char **argc)
 			iniTime = clock();
 
 			if (locTask == 0)
+			{
 				CleanTrees(iNumCat);
+
+				if (minPartHistory > 0 || outForest)
+					BuildTrees();
+			}
 			
 			/* Orphans will be found on the master task only, so we need to assign them to their parent task for tracking in the next step. */
 			CommTasks.SyncOrphanHalos();
@@ -279,6 +383,9 @@ int main(int argv, char **argc)
 			iniTime = clock();
 			CleanTrees(iNumCat);
 
+			if (minPartHistory > 0 || outForest)
+				BuildTrees();
+
 			SettingsIO.WriteTree(iNumCat); 	
 			MPI_Barrier(MPI_COMM_WORLD);
 #endif	/* GATHER_TREES */
@@ -300,6 +407,10 @@ int main(int argv, char **argc)
 			/* This cleans all the locMTree and locCleanTrees */
 			FreeMergerTrees(iNumCat);
 
+			/* The next step only needs the halos and particles of this one, which can be saved to restart the run from there */
+			if (checkpointStep > 0 && iNumCat % checkpointStep == 0 && iNumCat < nSnapsUse - 1)
+				SettingsIO.WriteCheckpoint(iNumCat);
+
 #ifdef VERBOSE
 			/* Dump some information on the memory allocated on the various structures */
 			MemoryCheck(iNumCat);
@@ -307,6 +418,12 @@ int main(int argv, char **argc)
 
 		}	/* Finish: the trees have now been built for this step */
 
+		/* Make sure the writer thread has written all the trees */
+		SettingsIO.FlushTrees();
+
+		/* The main branches are now complete */
+		SettingsIO.WriteSmoothTrees();
+
 		if (locTask == 0)
 			cout << "The loop on halo and particle catalogs has finished." << endl;
 	
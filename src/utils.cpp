@@ -109,6 +109,29 @@ unsigned int NumLines(const char * fileName)
 };
 
 
+size_t FileSize(string fileName)
+{
+	struct stat info;
+
+	if (stat(fileName.c_str(), &info) != 0)
+		return 0;
+
+	return info.st_size;
+};
+
+
+/* Last modification time of a file, 0 if it does not exist */
+time_t FileTime(string fileName)
+{
+	struct stat info;
+
+	if (stat(fileName.c_str(), &info) != 0)
+		return 0;
+
+	return info.st_mtime;
+};
+
+
 /* Check the size of globally allocated variables */
 void MemoryCheck(int iNum)
 {
@@ -374,6 +397,8 @@ void ShiftHalosPartsGrids()
 	for (int iH = 0; iH < nLocHalos[0]; iH++)
 		GlobalGrid[0].AssignToGrid(locHalos[0][iH].X, iH);
 
+	GlobalGrid[0].SortHalos();
+
 	/* Reallocate a grid for the next loop - it will be filled while reading the new files */
 	GlobalGrid[1].Init(nGrid, boxSize);
 
@@ -448,3 +473,138 @@ vector<int> SortIndexes(vector<float> vec) {
 	return idx;
 };
 
+
+
+/* Particle IDs are sorted and stored as the first ID followed by the differences between consecutive ones. 
+ * The differences come in blocks of ID_BLOCK, each one a word with the number of bits of its largest value followed 
+ * by all the values packed with that width. A full block of width nBits takes exactly nBits words, and values are 
+ * packed and unpacked with the same shifts for the whole block. */
+#define ID_BLOCK 64
+
+void EncodeIDs(vector<uint64_t> &thisIDs, vector<uint64_t> &thisBuffer)
+{
+	int nIDs = thisIDs.size();
+
+	if (nIDs == 0)
+		return;
+
+	sort(thisIDs.begin(), thisIDs.end());
+	thisBuffer.push_back(thisIDs[0]);
+
+	for (int iB = 1; iB < nIDs; iB += ID_BLOCK)
+	{
+		int nBlock = min(ID_BLOCK, nIDs - iB);
+		uint64_t thisDelta[ID_BLOCK], allBits = 0;
+		int nBits = 0;
+
+		for (int iD = 0; iD < nBlock; iD++)
+		{
+			thisDelta[iD] = thisIDs[iB + iD] - thisIDs[iB + iD - 1];
+			allBits |= thisDelta[iD];
+		}
+
+		while (nBits < 64 && (allBits >> nBits) > 0)
+			nBits++;
+
+		size_t iFirst = thisBuffer.size();
+		thisBuffer.push_back(nBits);
+		thisBuffer.resize(iFirst + 1 + (nBlock * nBits + 63) / 64, 0);
+
+		uint64_t *thisWords = thisBuffer.data() + iFirst + 1;
+
+		/* Equal IDs need no words at all */
+		for (int iD = 0; iD < nBlock && nBits > 0; iD++)
+		{
+			int iBit = iD * nBits;
+			int iWord = iBit >> 6, iShift = iBit & 63;
+
+			thisWords[iWord] |= thisDelta[iD] << iShift;
+
+			if (iShift + nBits > 64)
+				thisWords[iWord + 1] |= thisDelta[iD] >> (64 - iShift);
+		}
+	}
+};
+
+
+/* Decode nIDs particle IDs written by EncodeIDs, returns the number of words read */
+size_t DecodeIDs(const uint64_t *thisBuffer, int nIDs, vector<uint64_t> &thisIDs)
+{
+	size_t iWord = 0;
+
+	thisIDs.resize(nIDs);
+
+	if (nIDs == 0)
+		return 0;
+
+	thisIDs[0] = thisBuffer[iWord++];
+
+	for (int iB = 1; iB < nIDs; iB += ID_BLOCK)
+	{
+		int nBlock = min(ID_BLOCK, nIDs - iB);
+		int nBits = thisBuffer[iWord++];
+		uint64_t thisMask = (nBits == 64) ? ~0ULL : (1ULL << nBits) - 1;
+		const uint64_t *thisWords = thisBuffer + iWord;
+
+		/* A block of equal IDs has width 0 and no words, which might lie past the end of the buffer */
+		if (nBits == 0)
+			fill(thisIDs.begin() + iB, thisIDs.begin() + iB + nBlock, 0);
+		else
+			for (int iD = 0; iD < nBlock; iD++)
+			{
+				int iBit = iD * nBits;
+				int jWord = iBit >> 6, iShift = iBit & 63;
+				uint64_t thisDelta = thisWords[jWord] >> iShift;
+
+				if (iShift + nBits > 64)
+					thisDelta |= thisWords[jWord + 1] << (64 - iShift);
+
+				thisIDs[iB + iD] = thisDelta & thisMask;
+			}
+
+		/* The differences are summed once the block is unpacked */
+		for (int iD = 0; iD < nBlock; iD++)
+			thisIDs[iB + iD] += thisIDs[iB + iD - 1];
+
+		iWord += (nBlock * nBits + 63) / 64;
+	}
+
+	return iWord;
+};
+
+
+/* The intervals are cut at the widest gaps between consecutive IDs, the earliest ones first among equal gaps. 
+ * A list of n IDs gives 2 * min(nRanges, n) bounds. */
+void RangeIDs(const vector<uint64_t> &thisIDs, int nRanges, vector<uint64_t> &thisBounds)
+{
+	int nIDs = thisIDs.size();
+	int nCuts = min(nRanges, nIDs) - 1;
+	vector<pair<uint64_t, int>> thisGaps;
+
+	if (nCuts < 0)
+		return;
+
+	for (int iD = 1; iD < nIDs; iD++)
+		thisGaps.push_back(make_pair(thisIDs[iD] - thisIDs[iD-1], iD));
+
+	partial_sort(thisGaps.begin(), thisGaps.begin() + nCuts, thisGaps.end(), 
+		[](const pair<uint64_t, int> &gapOne, const pair<uint64_t, int> &gapTwo) 
+		{ return gapOne.first > gapTwo.first || (gapOne.first == gapTwo.first && gapOne.second < gapTwo.second); });
+
+	/* Each interval ends before a cut, the last one at the end of the list */
+	vector<int> thisCuts(nCuts + 1, nIDs);
+
+	for (int iC = 0; iC < nCuts; iC++)
+		thisCuts[iC] = thisGaps[iC].second;
+
+	sort(thisCuts.begin(), thisCuts.end());
+
+	int iFirst = 0;
+
+	for (auto const& iCut : thisCuts)
+	{
+		thisBounds.push_back(thisIDs[iFirst]);
+		thisBounds.push_back(thisIDs[iCut - 1]);
+		iFirst = iCut;
+	}
+};
@@ -22,6 +22,7 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <ctime>
 
 #include "global_vars.h"
 #include "utils.h"
@@ -32,6 +33,9 @@
 
 unsigned int NumLines(const char *);
 
+size_t FileSize(string);
+time_t FileTime(string);
+
 float VectorModule(float *);
 
 float* UnitVector(float *);
@@ -49,4 +53,11 @@ void ShiftHalosPartsGrids(void);
 vector<string> SplitString(string, string);
 
 vector<int> SortIndexes(vector<float>);
+
+/* Compact encoding of a list of particle IDs, used to communicate the buffer. The IDs are sorted when encoded */
+void EncodeIDs(vector<uint64_t> &, vector<uint64_t> &);
+size_t DecodeIDs(const uint64_t *, int, vector<uint64_t> &);
+
+// Smallest and largest ID of at most n intervals covering a sorted list of IDs, in increasing order
+void RangeIDs(const vector<uint64_t> &, int, vector<uint64_t> &);
 #endif